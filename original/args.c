@@ -2,10 +2,13 @@
  * Oliver Dixon. */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "converse.h"
 #include "args.h"
+#include "pool.h"
 
 #define SET_ARG(val, n) ( val |= n )
 
@@ -18,10 +21,51 @@ enum argument_status_t {
     ARGSTAT_UNABBR = -5, /* the command-abbreviation list was erroneous */
     ARGSTAT_NOMORE = -6, /* further arguments should not be considered */
     ARGSTAT_NOMREE = -7, /* ARGSTAT_NOMORE, but it was explicitly defined */
-    ARGSTAT_GLBPKG = -8  /* ARG_GLOBAL_ONLY and ARG_PKG_FILES_ONLY set */
+    ARGSTAT_GLBPKG = -8, /* ARG_GLOBAL_ONLY and ARG_PKG_FILES_ONLY set */
+    ARGSTAT_VALUE  = -9, /* the value given to an argument was invalid */
+    ARGSTAT_MODES  = -10, /* more than one exclusive result mode was set */
+    ARGSTAT_BATCH  = -11, /* queries were given with ARG_BATCH/ARG_DAEMON */
+    ARGSTAT_DAEMON = -12 /* ARG_DAEMON with ARG_BATCH or ARG_CLIENT */
 };
 
-opts_t options = 0;
+_Thread_local opts_t options = 0;
+_Thread_local enum format_t option_format = FORMAT_TEXT;
+_Thread_local unsigned long option_max_count = 0;
+unsigned int option_jobs = 0;
+enum engine_t option_engine = ENGINE_AUTO;
+const char * option_socket = NULL;
+enum io_t option_io = IO_SYNC;
+const char * option_trace = NULL;
+
+/* The options which may currently be set; see `process_query_args`. */
+static _Thread_local opts_t accepted = ~ ( opts_t ) 0;
+
+/* The long forms of the arguments, in the order of arg_positions_t. */
+static const char * const arg_full [ ] = {
+    "repo-names", "repo-paths", "help", "version", "list-repos",
+    "strict", "quiet", "no-case", "portdir", "print-needles",
+    "no-interrupt", "package", "nocolour", "global", "index",
+    "no-index", "jobs", "engine", "format", "count", "max-count",
+    "files-with-matches", "exists", "batch", "daemon", "client", "socket",
+    "io", "stats", "trace"
+};
+
+/* The names of the values of ARG_ENGINE, ARG_FORMAT, and ARG_IO. */
+static const char * const engines [ ] = {
+    /* in the order of engine_t */
+    "auto", "ac", "simd", "libc"
+}, * const formats [ ] = {
+    /* in the order of format_t */
+    "text", "ndjson", "tsv", "null"
+}, * const ios [ ] = {
+    /* in the order of io_t */
+    "sync", "uring"
+};
+
+/* TAKES_VALUE: the arguments which take a value; see `set_value`. */
+#define TAKES_VALUE(n) ( n == ARG_JOBS || n == ARG_ENGINE || \
+        n == ARG_FORMAT || n == ARG_MAX_COUNT || n == ARG_SOCKET || \
+        n == ARG_IO || n == ARG_TRACE )
 
 /* provide_arg_error: returns a human-readable string representing the provided
  * error code in `status`, as enumerated in `argument_status_t`. */
@@ -39,56 +83,166 @@ static const char * provide_arg_error ( int status )
                     " was unrecognised.";
         case ARGSTAT_GLBPKG: return "The global and package options" \
                     " cannot be set simultaneously.";
+        case ARGSTAT_VALUE:  return "The value given to the argument" \
+                    " was invalid.";
+        case ARGSTAT_MODES:  return "Only one of the count, files-" \
+                    "with-matches, and exists options can be set.";
+        case ARGSTAT_BATCH:  return "Queries cannot be given on the " \
+                    "command line with the batch or daemon options.";
+        case ARGSTAT_DAEMON: return "The daemon option cannot be set " \
+                    "with the batch or client options.";
 
         default:         return "Unknown error";
     }
 }
 
-/* match_arg: argument-matcher, supporting both long and short argument forms,
- * assuming that the arg_positions_t enum increments in powers of two. This
- * function returns zero on success, or -1 on failure (unrecognised argument),
- * populating the apos variable appropriately for the caller. */
+/* match_name: return the position of `value` in the list of `count` `names`,
+ * or -1 if it is not among them. */
 
-static int match_arg ( const char * arg, enum arg_positions_t * apos )
+static int match_name ( const char * value, const char * const * names,
+        size_t count )
 {
-    static const char * arg_full [ ] = {
-        "repo-names", "repo-paths", "help", "version", "list-repos",
-        "strict", "quiet", "no-case", "portdir", "print-needles",
-        "no-interrupt", "package", "nocolour", "global"
-    }, arg_abv [ ] = {
+    for ( size_t i = 0; i < count; i++ )
+        if ( strcmp ( value, names [ i ] ) == 0 )
+            return i;
+
+    return -1;
+}
+
+/* set_value: parse the `value` given to the argument `apos`, if it takes one:
+ * ARG_JOBS takes a number of workers between one and POOL_JOBS_MAX, ARG_ENGINE
+ * takes the name of an engine_t, ARG_FORMAT that of a format_t, ARG_MAX_COUNT
+ * a positive number of results, ARG_SOCKET and ARG_TRACE a path, and ARG_IO
+ * the name of an io_t. If the value is absent, ARGSTAT_LACK is returned, and
+ * if it is invalid, ARGSTAT_VALUE; ARGSTAT_OK otherwise. */
+
+static enum argument_status_t set_value ( enum arg_positions_t apos,
+        const char * value )
+{
+    char * end = NULL;
+    long jobs = 0;
+    unsigned long count = 0;
+    int pos = 0;
+
+    if ( !TAKES_VALUE ( apos ) )
+        return ARGSTAT_OK;
+
+    if ( value == NULL || value [ 0 ] == '\0' )
+        return ARGSTAT_LACK;
+
+    if ( apos == ARG_ENGINE ) {
+        if ( ( pos = match_name ( value, engines, sizeof ( engines ) /
+                        sizeof ( *engines ) ) ) == -1 )
+            return ARGSTAT_VALUE;
+
+        option_engine = pos;
+        return ARGSTAT_OK;
+    }
+
+    if ( apos == ARG_FORMAT ) {
+        if ( ( pos = match_name ( value, formats, sizeof ( formats ) /
+                        sizeof ( *formats ) ) ) == -1 )
+            return ARGSTAT_VALUE;
+
+        option_format = pos;
+        return ARGSTAT_OK;
+    }
+
+    if ( apos == ARG_IO ) {
+        if ( ( pos = match_name ( value, ios, sizeof ( ios ) /
+                        sizeof ( *ios ) ) ) == -1 )
+            return ARGSTAT_VALUE;
+
+        option_io = pos;
+        return ARGSTAT_OK;
+    }
+
+    if ( apos == ARG_SOCKET ) {
+        option_socket = value;
+        return ARGSTAT_OK;
+    }
+
+    if ( apos == ARG_TRACE ) {
+        option_trace = value;
+        return ARGSTAT_OK;
+    }
+
+    if ( apos == ARG_MAX_COUNT ) {
+        errno = 0;
+        count = strtoul ( value, &end, 10 );
+        if ( errno != 0 || *end != '\0' || value [ 0 ] == '-' ||
+                count == 0 )
+            return ARGSTAT_VALUE;
+
+        option_max_count = count;
+        return ARGSTAT_OK;
+    }
+
+    errno = 0;
+    jobs = strtol ( value, &end, 10 );
+    if ( errno != 0 || *end != '\0' || jobs < 1 || jobs > POOL_JOBS_MAX )
+        return ARGSTAT_VALUE;
+
+    option_jobs = jobs;
+    return ARGSTAT_OK;
+}
+
+/* match_arg: argument-matcher, supporting both long and short argument forms,
+ * assuming that the arg_positions_t enum increments in powers of two. A long
+ * form may be followed by "=<value>", in which case `value` is pointed to the
+ * value; see `set_value`. This function returns zero on success, or -1 on
+ * failure (unrecognised argument, or one which is not `accepted`), populating
+ * the apos variable appropriately for the caller. */
+
+static int match_arg ( const char * arg, enum arg_positions_t * apos,
+        const char ** value )
+{
+    static const char arg_abv [ ] = {
         /* For a long-form argument which does not have an abbreviated
          * form, the corresponding entry in arg_abv should be a NULL-
          * terminator. */
-        "nphvrsqcdeikog"
+        "nphvrsqcdeikogxXj\0\0\0\0\0\0\0\0\0\0\0\0"
     };
 
     /* `fargc`: full argument count. This should be more than or equal to
      * the count of non-NULL abbreviated arguments. */
     static const int fargc = sizeof ( arg_full ) / sizeof ( *arg_full );
+    const char * eq = strchr ( arg, '=' );
+    const size_t len = ( eq == NULL ) ? strlen ( arg ) - 2 :
+        ( size_t ) ( eq - & ( arg [ 2 ] ) );
 
     /* if the corresponding arg_abv value is NULL, there is no
      * shortened counterpart against which to check */
     for ( int i = 0; i < fargc && arg [ 0 ] == '-'; i++ )
         if ( ( arg [ 1 ] == '-' &&
-                strcmp ( & ( arg [ 2 ] ), arg_full [ i ] ) == 0 ) ||
+                strncmp ( & ( arg [ 2 ] ), arg_full [ i ], len ) == 0 &&
+                arg_full [ i ] [ len ] == '\0' ) ||
                 ( arg_abv [ i ] != '\0' &&
                   arg [ 1 ] == arg_abv [ i ] && arg [ 2 ] == '\0' ) ) {
             *apos = 1 << i;
+            *value = ( arg [ 1 ] == '-' && eq != NULL ) ? eq + 1 : NULL;
             break;
         }
 
-    /* unrecognised argument ? */
-    return ( *apos == ARG_UNKNOWN ) ? -1 : 0;
+    if ( ( *apos & accepted ) == 0 )
+        *apos = ARG_UNKNOWN; /* not accepted here; see `accepted` */
+
+    /* unrecognised argument, or a value given to one taking none ? */
+    return ( *apos == ARG_UNKNOWN || ( *value != NULL &&
+                !TAKES_VALUE ( *apos ) ) ) ? -1 : 0;
 }
 
 /* match_abbr_arg: given an abbreviated string beginning with '-', this function
  * sets the appropriate arguments for every character in the string. Should a
  * character be unrecognised or doubly defined, ARGSTAT_UNABBR or ARGSTAT_DOUBLE
- * is returned respectively. On success, ARGSTAT_OK is returned. */
+ * is returned respectively. An argument taking a value takes the rest of the
+ * string, or, if there is none, the `next` command-line argument, in which case
+ * `consumed` is set; see `set_value`. On success, ARGSTAT_OK is returned. */
 
-static enum argument_status_t match_abbr_arg ( const char * str )
+static enum argument_status_t match_abbr_arg ( const char * str,
+        const char * next, int * consumed )
 {
-    static const char * abbr_list = "nphvrsqcdeikog";
+    static const char * abbr_list = "nphvrsqcdeikogxXj";
     const int abbr_sz = strlen ( abbr_list );
     size_t len = strlen ( str );
     int found = 0;
@@ -97,12 +251,21 @@ static enum argument_status_t match_abbr_arg ( const char * str )
         found = 0;
 
         for ( int j = 0; j < abbr_sz; j++ )
-            if ( str [ i ] == abbr_list [ j ] ) {
+            if ( str [ i ] == abbr_list [ j ] &&
+                    CHK_ARG ( accepted, 1 << j ) != 0 ) {
                 if ( CHK_ARG ( options, 1 << j ) != 0 )
                     return ARGSTAT_DOUBLE;
                 SET_ARG ( options, 1 << j );
                 found = 1;
 
+                if ( ( 1 << j ) == ARG_JOBS ) {
+                    if ( str [ i + 1 ] != '\0' )
+                        return set_value ( ARG_JOBS, & ( str [ i + 1 ] ) );
+
+                    *consumed = 1;
+                    return set_value ( ARG_JOBS, next );
+                }
+
                 if ( str [ i + 1 ] == '\0' )
                     return ARGSTAT_OK;
 
@@ -119,14 +282,18 @@ static enum argument_status_t match_abbr_arg ( const char * str )
 /* argument_subprocessor: checks a single string as an argument; if this is an
  * abbreviated string, the `options` flag-list may be changed multiple times. If
  * the given string is empty or meaningless, ARGSTAT_EMPTY is returned, and
- * ARGSTAT_DOUBLE is returned if an argument has been doubly defined. On
- * success, ARGSTAT_OK is returned, and in the event of an abbreviated multi-
- * argument string, the return value is dictated by `match_abbr_arg`. */
-
-static enum argument_status_t argument_subprocessor ( char * arg )
+ * ARGSTAT_DOUBLE is returned if an argument has been doubly defined. If the
+ * argument takes a value which is not attached to it, the value is taken from
+ * `next`, and `consumed` is set. On success, ARGSTAT_OK is returned, and in the
+ * event of an abbreviated multi-argument string, the return value is dictated
+ * by `match_abbr_arg`. */
+
+static enum argument_status_t argument_subprocessor ( char * arg, char * next,
+        int * consumed )
 {
     enum argument_status_t argstat = ARGSTAT_OK;
     enum arg_positions_t apos = ARG_UNKNOWN;
+    const char * value = NULL;
 
     if ( arg [ 0 ] != '-' )
         return ARGSTAT_NOMORE;
@@ -141,7 +308,7 @@ static enum argument_status_t argument_subprocessor ( char * arg )
         return ARGSTAT_EMPTY;
     }
 
-    if ( match_arg ( arg, &apos ) == 0 ) {
+    if ( match_arg ( arg, &apos, &value ) == 0 ) {
         if ( CHK_ARG ( options, apos ) != 0 ) {
             /* full or shortened individual arguments */
             populate_info_buffer ( arg );
@@ -149,8 +316,19 @@ static enum argument_status_t argument_subprocessor ( char * arg )
         }
 
         SET_ARG ( options, apos );
+        if ( TAKES_VALUE ( apos ) && value == NULL ) {
+            /* the value is the next argument */
+            value = next;
+            *consumed = 1;
+        }
+
+        if ( ( argstat = set_value ( apos, value ) ) != ARGSTAT_OK ) {
+            populate_info_buffer ( arg );
+            return argstat;
+        }
     } else
-        if ( ( argstat = match_abbr_arg ( arg ) ) != ARGSTAT_OK ) {
+        if ( ( argstat = match_abbr_arg ( arg, next, consumed ) )
+                != ARGSTAT_OK ) {
             /* combined arguments */
             populate_info_buffer ( arg );
             return argstat;
@@ -165,9 +343,51 @@ static enum argument_status_t argument_subprocessor ( char * arg )
 
 static inline enum argument_status_t contradiction_check ( )
 {
-    return ( CHK_ARG ( options, ARG_GLOBAL_ONLY ) != 0 &&
-            CHK_ARG ( options, ARG_PKG_FILES_ONLY ) != 0 ) ?
-        ARGSTAT_GLBPKG : ARGSTAT_OK;
+    const opts_t modes = CHK_ARG ( options, ( ARG_COUNT | ARG_FILES_MATCH |
+                ARG_EXISTS ) );
+
+    if ( CHK_ARG ( options, ARG_GLOBAL_ONLY ) != 0 &&
+            CHK_ARG ( options, ARG_PKG_FILES_ONLY ) != 0 )
+        return ARGSTAT_GLBPKG;
+
+    if ( CHK_ARG ( options, ARG_DAEMON ) != 0 &&
+            CHK_ARG ( options, ( ARG_BATCH | ARG_CLIENT ) ) != 0 )
+        return ARGSTAT_DAEMON;
+
+    /* more than one bit set */
+    return ( ( modes & ( modes - 1 ) ) != 0 ) ? ARGSTAT_MODES : ARGSTAT_OK;
+}
+
+/* process_arg_list: process the arguments in `argv`, from the index `*idx`,
+ * until the first non-argument, or the end of the `argc` entries. On success,
+ * ARGSTAT_OK is returned, and `idx` is left at the first non-argument; on
+ * failure, the status of the offending argument is returned. */
+
+static enum argument_status_t process_arg_list ( int argc, char ** argv,
+        int * idx )
+{
+    enum argument_status_t argstat = ARGSTAT_OK;
+    int consumed = 0;
+
+    for ( ; *idx < argc; *idx += 1 + consumed ) {
+        consumed = 0;
+        if ( ( argstat = argument_subprocessor ( argv [ *idx ],
+                        argv [ *idx + 1 ], &consumed ) ) != ARGSTAT_OK ) {
+            if ( argstat == ARGSTAT_NOMORE )
+                /* do not consider further arguments */
+                break;
+
+            if ( argstat == ARGSTAT_NOMREE ) {
+                /* skip past the explicit argument-terminator */
+                ( *idx )++;
+                break;
+            }
+
+            return argstat;
+        }
+    }
+
+    return ARGSTAT_OK;
 }
 
 /* [exposed function] process_args: process the argument list in `argv` and
@@ -197,25 +417,19 @@ int process_args ( int argc, char ** argv, int * advanced_idx )
         return -1;
     }
 
-    for ( ; i < argc; i++ )
-        if ( ( argstat = argument_subprocessor ( argv [ i ] ) )
-                != ARGSTAT_OK ) {
-            if ( argstat == ARGSTAT_NOMORE )
-                /* do not consider further arguments */
-                break;
-
-            if ( argstat == ARGSTAT_NOMREE ) {
-                /* skip past the explicit argument-terminator */
-                i++;
-                break;
-            }
+    if ( ( argstat = process_arg_list ( argc, argv, &i ) ) != ARGSTAT_OK ) {
+        print_fatal ( error_prefix, argstat, &provide_arg_error );
+        return -1;
+    }
 
-            print_fatal ( error_prefix, argstat,
-                    &provide_arg_error );
-            return -1;
-        }
+    if ( ( argstat = contradiction_check ( ) ) == ARGSTAT_OK &&
+            CHK_ARG ( options, ( ARG_BATCH | ARG_DAEMON ) ) != 0 &&
+            i < argc )
+        /* the queries of a batch are read from stdin, and those of a
+         * daemon from its clients */
+        argstat = ARGSTAT_BATCH;
 
-    if ( ( argstat = contradiction_check ( ) ) != ARGSTAT_OK ) {
+    if ( argstat != ARGSTAT_OK ) {
         /* Finished. Check for obvious contradictions. */
         populate_info_buffer ( NULL );
         print_fatal ( error_prefix, argstat, &provide_arg_error );
@@ -226,3 +440,78 @@ int process_args ( int argc, char ** argv, int * advanced_idx )
     return 0;
 }
 
+/* [exposed function] process_query_args: process the options of a single query
+ * of a batch (see ARG_BATCH) or a client (see ARG_CLIENT), the first of the
+ * `argc` words in `argv`, which must be terminated by a NULL entry, as is
+ * `argv` of main. Only the options of `accept` are accepted, and they are
+ * added to those already in `options`; the caller must restore `options`, and
+ * any value of the options, once the query has been searched. Unlike
+ * `process_args`, a failure is only a warning (via print_warning), as the
+ * other queries are unaffected; -1 is returned, and the query should be
+ * skipped. On success, zero is returned, and `advanced_idx` is set to the
+ * index of the first substring in `argv`. */
+
+int process_query_args ( int argc, char ** argv, int * advanced_idx,
+        opts_t accept )
+{
+    const opts_t given = CHK_ARG ( options, accept );
+    enum argument_status_t argstat = ARGSTAT_OK;
+    int i = 0;
+
+    /* a query may repeat an option given on the command line */
+    options &= ~accept;
+    accepted = accept;
+    argstat = process_arg_list ( argc, argv, &i );
+    accepted = ~ ( opts_t ) 0;
+    options |= given;
+
+    if ( argstat == ARGSTAT_OK && ( argstat = contradiction_check ( ) )
+            != ARGSTAT_OK )
+        populate_info_buffer ( NULL );
+
+    if ( argstat != ARGSTAT_OK ) {
+        print_warning ( argstat, &provide_arg_error );
+        return -1;
+    }
+
+    *advanced_idx = i;
+    return 0;
+}
+
+/* [exposed function] unparse_args: write the long forms of the options of
+ * ARG_CLIENT_OPTIONS set in `options`, with their values, to the `buffer` of
+ * `size` bytes, as the words of a query accepted by `process_query_args`,
+ * followed by "--". Returns zero on success, or -1 if the buffer is too small.
+ */
+
+int unparse_args ( char * buffer, size_t size )
+{
+    size_t len = 0;
+    int written = 0;
+
+    buffer [ 0 ] = '\0';
+    for ( size_t i = 0; i < sizeof ( arg_full ) / sizeof ( *arg_full ); i++ ) {
+        const opts_t apos = ( opts_t ) 1 << i;
+
+        if ( CHK_ARG ( options, ( apos & ARG_CLIENT_OPTIONS ) ) == 0 )
+            continue;
+
+        if ( apos == ARG_FORMAT )
+            written = snprintf ( & ( buffer [ len ] ), size - len,
+                    "--%s=%s ", arg_full [ i ], formats [ option_format ] );
+        else if ( apos == ARG_MAX_COUNT )
+            written = snprintf ( & ( buffer [ len ] ), size - len,
+                    "--%s=%lu ", arg_full [ i ], option_max_count );
+        else
+            written = snprintf ( & ( buffer [ len ] ), size - len,
+                    "--%s ", arg_full [ i ] );
+
+        if ( written < 0 || ( size_t ) written >= size - len )
+            return -1;
+
+        len += written;
+    }
+
+    written = snprintf ( & ( buffer [ len ] ), size - len, "--" );
+    return ( written < 0 || ( size_t ) written >= size - len ) ? -1 : 0;
+}
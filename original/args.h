@@ -6,6 +6,8 @@
 
 #include <stdint.h>
 
+#include "automaton.h"
+
 #define CHK_ARG(val, n) ( val & n )
 
 /* The following command-line options are currently recognised:
@@ -32,7 +34,43 @@
  *    package pairs, and exclude global USE-flag-description files;
  *  - ARG_NO_COLOUR: disabled coloured output;
  *  - ARG_GLOBAL_ONLY: [conflicts with ARG_PKG_FILES_ONLY] do not search files
- *    containing package-local flags. */
+ *    containing package-local flags;
+ *  - ARG_BUILD_INDEX: rebuild the on-disk index of the USE-description files
+ *    before searching; no queries are required;
+ *  - ARG_NO_INDEX: search the USE-description files directly, neither reading
+ *    nor building the index;
+ *  - ARG_JOBS: search with the given number of workers, rather than one per
+ *    available processor (see `option_jobs`);
+ *  - ARG_ENGINE: find the needles with the given engine (see `engine_t` and
+ *    `option_engine`);
+ *  - ARG_FORMAT: print the results in the given machine-readable format,
+ *    rather than as text (see `format_t` and `option_format`);
+ *  - ARG_COUNT: print only the number of results;
+ *  - ARG_MAX_COUNT: stop the search once the given number of results have been
+ *    found (see `option_max_count`);
+ *  - ARG_FILES_MATCH: print only the path of every file with a result, and
+ *    stop searching each file at its first result;
+ *  - ARG_EXISTS: print nothing, and stop the search at the first result;
+ *  - ARG_BATCH: read the queries from stdin, one per line, each with its own
+ *    options (see ARG_QUERY_OPTIONS), searching the repositories loaded once
+ *    for all of them; no queries are accepted on the command line;
+ *  - ARG_DAEMON: load the repositories, and serve the queries of clients over
+ *    a Unix-domain socket until killed (see daemon.h), reloading the files
+ *    which change in the meantime;
+ *  - ARG_CLIENT: have the daemon search for the queries, if one is running,
+ *    and otherwise search in this process, as if ARG_CLIENT were not set;
+ *  - ARG_SOCKET: use the given socket for ARG_DAEMON and ARG_CLIENT, rather
+ *    than the default (see `option_socket` and `daemon_default_path`);
+ *  - ARG_IO: read the files with the given method (see `io_t` and
+ *    `option_io`);
+ *  - ARG_STATS: once the search is over, print the time taken by each of its
+ *    phases, and what it read and found, per repository, to stderr (see
+ *    stats.h); not with ARG_DAEMON;
+ *  - ARG_TRACE: write the spans of the search to the given file, as Chrome
+ *    trace events (see trace.h and `option_trace`); not with ARG_DAEMON.
+ *
+ * With any of ARG_COUNT to ARG_EXISTS (the "result modes"; see
+ * ARG_RESULT_MODES), the exit status reports whether there were any results. */
 
 enum arg_positions_t {
     ARG_UNKNOWN          =    0,
@@ -49,14 +87,75 @@ enum arg_positions_t {
     ARG_NO_MIDBUF_WARN   = 1024,
     ARG_PKG_FILES_ONLY   = 2048,
     ARG_NO_COLOUR        = 4096,
-    ARG_GLOBAL_ONLY      = 8192
+    ARG_GLOBAL_ONLY      = 8192,
+    ARG_BUILD_INDEX      = 16384,
+    ARG_NO_INDEX         = 32768,
+    ARG_JOBS             = 65536,
+    ARG_ENGINE           = 131072,
+    ARG_FORMAT           = 262144,
+    ARG_COUNT            = 524288,
+    ARG_MAX_COUNT        = 1048576,
+    ARG_FILES_MATCH      = 2097152,
+    ARG_EXISTS           = 4194304,
+    ARG_BATCH            = 8388608,
+    ARG_DAEMON           = 16777216,
+    ARG_CLIENT           = 33554432,
+    ARG_SOCKET           = 67108864,
+    ARG_IO               = 134217728,
+    ARG_STATS            = 268435456,
+    ARG_TRACE            = 536870912
+};
+
+#define ARG_RESULT_MODES \
+    ( ARG_COUNT | ARG_MAX_COUNT | ARG_FILES_MATCH | ARG_EXISTS )
+
+/* The options which may be given to each query of a batch; see ARG_BATCH. */
+#define ARG_QUERY_OPTIONS ( ARG_SEARCH_STRICT | ARG_SEARCH_NO_CASE | \
+        ARG_PKG_FILES_ONLY | ARG_GLOBAL_ONLY )
+
+/* The options which a client passes to the daemon with each query, and which
+ * therefore only apply to that query; see ARG_CLIENT. */
+#define ARG_CLIENT_OPTIONS ( ARG_QUERY_OPTIONS | ARG_PRINT_REPO_NAMES | \
+        ARG_PRINT_REPO_PATHS | ARG_PRINT_NEEDLE | ARG_NO_MIDBUF_WARN | \
+        ARG_NO_COLOUR | ARG_FORMAT | ARG_RESULT_MODES )
+
+/* format_t: the formats in which the results may be printed. FORMAT_TEXT is the
+ * (coloured) text of the matching entry; the others are machine-readable, each
+ * result being the fields of the entry, its repository, file, and needle. */
+
+enum format_t {
+    FORMAT_TEXT   = 0, /* the entry, as it appears in the file */
+    FORMAT_NDJSON = 1, /* a JSON object per line */
+    FORMAT_TSV    = 2, /* tab-separated fields; a line per result */
+    FORMAT_NULL   = 3  /* every field terminated by a null byte */
+};
+
+/* io_t: the methods by which the files may be read when searching them. */
+
+enum io_t {
+    IO_SYNC  = 0, /* each file is read by its worker, as it is searched */
+    IO_URING = 1  /* the files are loaded up front, in batches (see uring.h) */
 };
 
 /* uintN_t, such that log2(<highest `arg_position_t`>) <= N */
-typedef uint16_t opts_t;
+typedef uint32_t opts_t;
+
+/* The options which may differ from one query to the next (see
+ * `process_query_args`) are kept per thread, so that the queries of several
+ * clients can be searched at once; a thread searching on behalf of another
+ * must take a copy of them. */
+extern _Thread_local opts_t options;
+extern _Thread_local enum format_t option_format; /* the value of ARG_FORMAT */
+extern _Thread_local unsigned long option_max_count; /* ARG_MAX_COUNT, or 0 */
 
-extern opts_t  options;
+extern unsigned int option_jobs; /* the value of ARG_JOBS, or zero */
+extern enum engine_t option_engine; /* the value of ARG_ENGINE */
+extern const char * option_socket; /* the value of ARG_SOCKET, or NULL */
+extern enum io_t option_io; /* the value of ARG_IO */
+extern const char * option_trace; /* the value of ARG_TRACE, or NULL */
 int process_args ( int, char **, int * );
+int process_query_args ( int, char **, int *, opts_t );
+int unparse_args ( char *, size_t );
 
 #endif /* ARGS_H */
 
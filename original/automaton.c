@@ -0,0 +1,617 @@
+/* owd-euses: multi-needle (Aho-Corasick) automaton; see automaton.h.
+ * Oliver Dixon. */
+
+#define _GNU_SOURCE
+/* memmem */
+#include <string.h>
+#undef _GNU_SOURCE
+
+#include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define SKIP_BLOCK ( sizeof ( __m128i ) )
+#endif /* __SSE2__ */
+
+#include "automaton.h"
+
+#define HITS_INITIAL ( 256 ) /* Initial capacity of a hit list. */
+
+/* assign_classes: populate the byte-class map of `ac` from the bytes of the
+ * `needles`, returning the number of classes. Class zero is reserved for bytes
+ * which do not appear in any needle. If `no_case` is set, the upper- and
+ * lower-case forms of a letter share the same class. */
+
+static int assign_classes ( struct automaton_t * ac, char ** needles,
+        int ncount, int no_case )
+{
+    unsigned char folded_class [ 256 ] = { 0 };
+    int classes = 1;
+
+    for ( int i = 0; i < ncount; i++ )
+        for ( const unsigned char * b = ( unsigned char * ) needles [ i ];
+                *b != '\0'; b++ ) {
+            int folded = ( no_case ) ? tolower ( *b ) : *b;
+
+            if ( folded_class [ folded ] == 0 )
+                folded_class [ folded ] = classes++;
+        }
+
+    for ( int b = 0; b < 256; b++ )
+        ac->class_map [ b ] = folded_class [ ( no_case ) ?
+            tolower ( b ) : b ];
+
+    return classes;
+}
+
+/* insert_needles: construct the trie of the `needles` in `ac->delta`, in which
+ * zero denotes the absence of an edge. Each terminal state has its needles
+ * chained through `term` and `next_term`. The number of states is returned. */
+
+static int insert_needles ( struct automaton_t * ac, char ** needles,
+        int ncount, int * term, int * next_term )
+{
+    int states = 1;
+
+    for ( int i = 0; i < ncount; i++ ) {
+        int state = 0;
+
+        ac->lengths [ i ] = strlen ( needles [ i ] );
+        ac->multiline [ i ] = ( strchr ( needles [ i ], '\n' ) != NULL );
+
+        if ( ac->lengths [ i ] == 0 )
+            /* Empty needles are ignored by the searcher. */
+            continue;
+
+        for ( const unsigned char * b = ( unsigned char * ) needles [ i ];
+                *b != '\0'; b++ ) {
+            int * edge = & ( ac->delta [ state * ac->classes +
+                    ac->class_map [ *b ] ] );
+
+            if ( *edge == 0 )
+                *edge = states++;
+
+            state = *edge;
+        }
+
+        next_term [ i ] = term [ state ];
+        term [ state ] = i;
+    }
+
+    return states;
+}
+
+/* link_failures: complete the trie into a deterministic automaton, visiting the
+ * states in breadth-first order. Missing edges are replaced with the edge of
+ * the failure state, which is always shallower, and thus already complete. The
+ * visiting order is left in `order` for the construction of the outputs. */
+
+static void link_failures ( struct automaton_t * ac, int * fail, int * order )
+{
+    int head = 0, tail = 0;
+    const int classes = ac->classes;
+
+    fail [ 0 ] = 0;
+    order [ tail++ ] = 0;
+
+    while ( head < tail ) {
+        int state = order [ head++ ];
+
+        for ( int c = 0; c < classes; c++ ) {
+            int * edge = & ( ac->delta [ state * classes + c ] );
+            int fallback = ( state == 0 ) ? 0 :
+                ac->delta [ fail [ state ] * classes + c ];
+
+            if ( *edge == 0 ) {
+                *edge = fallback;
+                continue;
+            }
+
+            fail [ *edge ] = fallback;
+            order [ tail++ ] = *edge;
+        }
+    }
+}
+
+/* collect_outputs: flatten the needles ending in each state, including those
+ * inherited through its failure state, into `ac->outputs`. Returns zero on
+ * success, or -1 if the output table could not be allocated. */
+
+static int collect_outputs ( struct automaton_t * ac, const int * fail,
+        const int * order, const int * term, const int * next_term )
+{
+    size_t total = 0;
+    int state;
+
+    for ( int i = 0; i < ac->states; i++ ) {
+        int own = 0;
+
+        state = order [ i ];
+        for ( int n = term [ state ]; n != -1; n = next_term [ n ] )
+            own++;
+
+        ac->out_count [ state ] = own + ( ( state == 0 ) ? 0 :
+            ac->out_count [ fail [ state ] ] );
+        ac->out_start [ state ] = total;
+        total += ac->out_count [ state ];
+    }
+
+    if ( ( ac->outputs = malloc ( sizeof ( int ) * ( total + 1 ) ) ) == NULL )
+        return -1;
+
+    for ( int i = 1; i < ac->states; i++ ) {
+        int * dest = NULL;
+
+        state = order [ i ];
+        dest = & ( ac->outputs [ ac->out_start [ state ] ] );
+
+        for ( int n = term [ state ]; n != -1; n = next_term [ n ] )
+            * ( dest++ ) = n;
+
+        memcpy ( dest, & ( ac->outputs [ ac->out_start [ fail [ state ] ] ] ),
+                sizeof ( int ) * ac->out_count [ fail [ state ] ] );
+    }
+
+    return 0;
+}
+
+/* renumber_states: move the accepting states (those in which a needle ends) to
+ * the end of the numbering, and pre-multiply every transition by the number of
+ * classes, so the scanner needs neither a multiplication nor a table lookup to
+ * step and test the automaton. The root state remains state zero. Returns zero
+ * on success, or -1 if the new tables could not be allocated. */
+
+static int renumber_states ( struct automaton_t * ac )
+{
+    const int classes = ac->classes, states = ac->states;
+    int * map = malloc ( sizeof ( int ) * states ),
+        * delta = malloc ( sizeof ( int ) * states * classes ),
+        * out_start = malloc ( sizeof ( int ) * states ),
+        * out_count = malloc ( sizeof ( int ) * states ), next = 0;
+
+    if ( map == NULL || delta == NULL || out_start == NULL
+            || out_count == NULL ) {
+        free ( map );
+        free ( delta );
+        free ( out_start );
+        free ( out_count );
+        return -1;
+    }
+
+    for ( int s = 0; s < states; s++ )
+        if ( ac->out_count [ s ] == 0 )
+            map [ s ] = next++;
+
+    ac->accepting = next * classes;
+    for ( int s = 0; s < states; s++ )
+        if ( ac->out_count [ s ] != 0 )
+            map [ s ] = next++;
+
+    for ( int s = 0; s < states; s++ ) {
+        for ( int c = 0; c < classes; c++ )
+            delta [ map [ s ] * classes + c ] =
+                map [ ac->delta [ s * classes + c ] ] * classes;
+
+        out_start [ map [ s ] ] = ac->out_start [ s ];
+        out_count [ map [ s ] ] = ac->out_count [ s ];
+    }
+
+    free ( map );
+    free ( ac->delta );
+    free ( ac->out_start );
+    free ( ac->out_count );
+
+    ac->delta = delta;
+    ac->out_start = out_start;
+    ac->out_count = out_count;
+    return 0;
+}
+
+/* collect_starts: gather the bytes leaving the root state into `ac->starts`,
+ * enabling the skip-ahead in the scanner if there are few enough of them. */
+
+static void collect_starts ( struct automaton_t * ac )
+{
+    int count = 0;
+
+    for ( int b = 1; b < 256 && count <= AUTOMATON_STARTS_MAX; b++ )
+        if ( ac->delta [ ac->class_map [ b ] ] != 0 ) {
+            if ( count < AUTOMATON_STARTS_MAX )
+                ac->starts [ count ] = b;
+
+            count++;
+        }
+
+    ac->skip = ( count <= AUTOMATON_STARTS_MAX );
+    ac->starts [ ( ac->skip ) ? count : 0 ] = '\0';
+}
+
+/* compile_needles: compile each of the `needles` into `ac->needles` for the
+ * per-needle engines (see needle_compile), once, rather than for every buffer
+ * searched. Returns zero on success, or -1 if an allocation failed. */
+
+static int compile_needles ( struct automaton_t * ac, char ** needles,
+        int ncount, int no_case )
+{
+    if ( ( ac->needles = calloc ( ncount + 1, sizeof ( struct needle_t ) ) )
+            == NULL )
+        return -1;
+
+    for ( int i = 0; i < ncount; i++ )
+        if ( needle_compile ( & ( ac->needles [ i ] ), needles [ i ],
+                    no_case ) == -1 )
+            return -1;
+
+    return 0;
+}
+
+/* [exposed function] automaton_build: construct the automaton for the given
+ * `needles`, of which there are `ncount`, folding ASCII case if `no_case` is
+ * set, to be scanned with the `engine` (see engine_t). Empty needles never
+ * match. On success, zero is returned; on failure, -1 is returned, errno is set
+ * by the allocator, and `ac` is left empty (it is safe to pass it to
+ * `automaton_free`). */
+
+int automaton_build ( struct automaton_t * ac, char ** needles, int ncount,
+        int no_case, enum engine_t engine )
+{
+    int * fail = NULL, * order = NULL, * term = NULL, * next_term = NULL,
+        status = -1;
+    size_t max_states = 1;
+
+    memset ( ac, 0, sizeof ( struct automaton_t ) );
+    ac->ncount = ncount;
+    ac->no_case = no_case;
+    ac->engine = ( engine != ENGINE_AUTO ) ? engine :
+        ( ncount <= AUTOMATON_SIMD_MAX ) ? ENGINE_SIMD : ENGINE_AC;
+
+    if ( ac->engine == ENGINE_SIMD )
+        kernel_select ( );
+    ac->classes = assign_classes ( ac, needles, ncount, no_case );
+
+    for ( int i = 0; i < ncount; i++ )
+        max_states += strlen ( needles [ i ] );
+
+    if ( ( ac->delta = calloc ( max_states * ac->classes,
+                    sizeof ( int ) ) ) == NULL
+            || ( ac->out_start = calloc ( max_states, sizeof ( int ) ) )
+                == NULL
+            || ( ac->out_count = calloc ( max_states, sizeof ( int ) ) )
+                == NULL
+            || ( ac->lengths = calloc ( ncount + 1, sizeof ( size_t ) ) )
+                == NULL
+            || ( ac->multiline = calloc ( ncount + 1, sizeof ( int ) ) )
+                == NULL
+            || ( fail = calloc ( max_states, sizeof ( int ) ) ) == NULL
+            || ( order = calloc ( max_states, sizeof ( int ) ) ) == NULL
+            || ( term = malloc ( sizeof ( int ) * max_states ) ) == NULL
+            || ( next_term = calloc ( ncount + 1, sizeof ( int ) ) )
+                == NULL )
+        goto cleanup;
+
+    for ( size_t i = 0; i < max_states; i++ )
+        term [ i ] = -1;
+
+    ac->states = insert_needles ( ac, needles, ncount, term, next_term );
+    link_failures ( ac, fail, order );
+
+    if ( collect_outputs ( ac, fail, order, term, next_term ) == 0
+            && renumber_states ( ac ) == 0
+            && compile_needles ( ac, needles, ncount, no_case ) == 0 ) {
+        collect_starts ( ac );
+        status = 0;
+    }
+
+cleanup:
+    free ( fail );
+    free ( order );
+    free ( term );
+    free ( next_term );
+
+    if ( status == -1 ) {
+        /* free(3) may not preserve errno */
+        int error = errno;
+        automaton_free ( ac );
+        errno = error;
+    }
+
+    return status;
+}
+
+/* [exposed function] automaton_free: release the tables of an automaton. */
+
+void automaton_free ( struct automaton_t * ac )
+{
+    free ( ac->delta );
+    free ( ac->out_start );
+    free ( ac->out_count );
+    free ( ac->outputs );
+    free ( ac->lengths );
+    free ( ac->multiline );
+
+    for ( int i = 0; ac->needles != NULL && i < ac->ncount; i++ )
+        needle_free ( & ( ac->needles [ i ] ) );
+
+    free ( ac->needles );
+    memset ( ac, 0, sizeof ( struct automaton_t ) );
+}
+
+/* [exposed function] hit_list_init: prepare an empty hit list for an automaton
+ * of `ncount` needles. Returns zero on success, or -1 if the allocation failed,
+ * in which case errno is set appropriately. */
+
+int hit_list_init ( struct hit_list_t * hl, int ncount )
+{
+    hl->count = 0;
+    hl->capacity = HITS_INITIAL;
+    hl->ncount = ncount;
+    hl->offsets = malloc ( sizeof ( size_t ) * HITS_INITIAL );
+    hl->scratch = malloc ( sizeof ( size_t ) * HITS_INITIAL * 2 );
+    hl->first = calloc ( ncount + 1, sizeof ( size_t ) );
+    hl->line_end = calloc ( ncount + 1, sizeof ( size_t ) );
+
+    if ( hl->offsets == NULL || hl->scratch == NULL || hl->first == NULL
+            || hl->line_end == NULL ) {
+        hit_list_free ( hl );
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] hit_list_free: release the storage of a hit list. */
+
+void hit_list_free ( struct hit_list_t * hl )
+{
+    free ( hl->offsets );
+    free ( hl->scratch );
+    free ( hl->first );
+    free ( hl->line_end );
+
+    hl->offsets = hl->scratch = hl->first = hl->line_end = NULL;
+    hl->count = hl->capacity = 0;
+}
+
+/* hit_list_reserve: ensure there is room for another hit in the list, doubling
+ * its capacity if necessary. Returns zero on success, or -1 if the list could
+ * not grow. */
+
+static int hit_list_reserve ( struct hit_list_t * hl )
+{
+    size_t * offsets = NULL, * scratch = NULL;
+
+    if ( hl->count < hl->capacity )
+        return 0;
+
+    if ( ( offsets = realloc ( hl->offsets, sizeof ( size_t ) *
+                    hl->capacity * 2 ) ) == NULL )
+        return -1;
+
+    hl->offsets = offsets;
+    if ( ( scratch = realloc ( hl->scratch, sizeof ( size_t ) *
+                    hl->capacity * 4 ) ) == NULL )
+        return -1;
+
+    hl->scratch = scratch;
+    hl->capacity *= 2;
+    return 0;
+}
+
+/* hit_list_push: append an unsorted hit to the list. Returns zero on success,
+ * or -1 if the list could not grow. */
+
+static int hit_list_push ( struct hit_list_t * hl, size_t offset, int needle )
+{
+    if ( hit_list_reserve ( hl ) == -1 )
+        return -1;
+
+    hl->scratch [ hl->count * 2 ] = offset;
+    hl->scratch [ hl->count * 2 + 1 ] = needle;
+    hl->count++;
+    return 0;
+}
+
+/* group_hits: stably distribute the scanned hits into per-needle runs with a
+ * counting sort, so that each run remains in ascending order of offset. The
+ * per-needle line ends are no longer required, and serve as the cursors. */
+
+static void group_hits ( struct hit_list_t * hl )
+{
+    size_t * cursor = hl->line_end;
+
+    memset ( hl->first, 0, sizeof ( size_t ) * ( hl->ncount + 1 ) );
+    for ( size_t i = 0; i < hl->count; i++ )
+        hl->first [ hl->scratch [ i * 2 + 1 ] + 1 ]++;
+
+    for ( int i = 0; i < hl->ncount; i++ ) {
+        hl->first [ i + 1 ] += hl->first [ i ];
+        cursor [ i ] = hl->first [ i ];
+    }
+
+    for ( size_t i = 0; i < hl->count; i++ )
+        hl->offsets [ cursor [ hl->scratch [ i * 2 + 1 ] ]++ ] =
+            hl->scratch [ i * 2 ];
+}
+
+/* record_hits: record the needles ending at `pos`, within the `len` bytes at
+ * `buffer`, in the accepting state `state` (pre-multiplied). Only the first
+ * match of a needle on each line is recorded, as the caller resumes its search
+ * at the end of a matching line; needles spanning several lines are recorded at
+ * every position. Returns zero on success, or -1 if the hit list could not
+ * grow. */
+
+static int record_hits ( const struct automaton_t * ac, struct hit_list_t * hl,
+        const char * buffer, size_t len, const char * pos, int state )
+{
+    const int * needle = & ( ac->outputs [ ac->out_start [ state ] ] );
+
+    for ( int count = ac->out_count [ state ]; count > 0;
+            count--, needle++ ) {
+        size_t start = ( pos - buffer ) + 1 - ac->lengths [ *needle ];
+
+        if ( !ac->multiline [ *needle ] ) {
+            const char * eol = NULL;
+
+            if ( start < hl->line_end [ *needle ] )
+                continue; /* already matched on this line */
+
+            eol = memchr ( pos, '\n', len - ( pos - buffer ) );
+            hl->line_end [ *needle ] = ( eol == NULL ) ? ( size_t ) -1 :
+                ( size_t ) ( eol - buffer );
+        }
+
+        if ( hit_list_push ( hl, start, *needle ) == -1 )
+            return -1;
+    }
+
+    return 0;
+}
+
+/* find_caseless: return the first match of the compiled needle `nd`, folded
+ * to lower-case, in the `len` bytes at `buffer`, ignoring case, or NULL if
+ * there is none. libc has no caseless memmem(3), so each position beginning
+ * with the first letter of the needle is compared with strncasecmp(3). */
+
+static const char * find_caseless ( const char * buffer, size_t len,
+        const struct needle_t * nd )
+{
+    for ( size_t i = 0; len >= nd->len && i <= len - nd->len; i++ )
+        if ( tolower ( ( unsigned char ) buffer [ i ] ) == ( unsigned char )
+                nd->text [ 0 ] && strncasecmp ( & ( buffer [ i ] ),
+                    nd->text, nd->len ) == 0 )
+            return & ( buffer [ i ] );
+
+    return NULL;
+}
+
+/* find_needle: return the first match of the needle `i` of `ac` in the `len`
+ * bytes at `buffer`, or NULL if there is none. The bytes need not be
+ * null-terminated, and any null byte among them is searched like any other. */
+
+static inline const char * find_needle ( const struct automaton_t * ac, int i,
+        const char * buffer, size_t len )
+{
+    const struct needle_t * nd = & ( ac->needles [ i ] );
+
+    if ( ac->engine == ENGINE_SIMD )
+        return kernel_find ( buffer, len, nd );
+
+    return ( ac->no_case ) ? find_caseless ( buffer, len, nd ) :
+        memmem ( buffer, len, nd->text, nd->len );
+}
+
+/* scan_needles: the per-needle engines; see `automaton_scan`. The matches are
+ * found in order for one needle at a time, so they are appended to `offsets`
+ * already grouped. As with `record_hits`, the search for a needle resumes on
+ * the line following its match, unless the needle spans lines. */
+
+static int scan_needles ( const struct automaton_t * ac, const char * buffer,
+        size_t len, struct hit_list_t * hl )
+{
+    const char * match = NULL, * eol = NULL;
+
+    hl->count = 0;
+    for ( int i = 0; i < ac->ncount; i++ ) {
+        size_t pos = 0;
+
+        hl->first [ i ] = hl->count;
+        if ( ac->lengths [ i ] == 0 )
+            continue;
+
+        while ( pos < len && ( match = find_needle ( ac, i,
+                        & ( buffer [ pos ] ), len - pos ) ) != NULL ) {
+            if ( hit_list_reserve ( hl ) == -1 )
+                return -1;
+
+            hl->offsets [ hl->count++ ] = match - buffer;
+            if ( ac->multiline [ i ] )
+                pos = ( match - buffer ) + 1;
+            else if ( ( eol = memchr ( match, '\n', len - ( match -
+                                buffer ) ) ) != NULL )
+                pos = ( eol - buffer ) + 1;
+            else
+                break;
+        }
+    }
+
+    hl->first [ ac->ncount ] = hl->count;
+    return 0;
+}
+
+/* skip_to_start: return the first byte from `pos` to `end` which is in
+ * `ac->starts`, or `end` if there is none; a strcspn(3) bounded by `end`, so
+ * neither a null byte nor the end of the buffer is needed to stop it. Where
+ * SSE2 is available, sixteen bytes are compared with each start at a time. */
+
+static inline const unsigned char * skip_to_start (
+        const struct automaton_t * ac, const unsigned char * pos,
+        const unsigned char * end )
+{
+#ifdef __SSE2__
+    for ( ; ( size_t ) ( end - pos ) >= SKIP_BLOCK; pos += SKIP_BLOCK ) {
+        const __m128i block = _mm_loadu_si128 ( ( const __m128i * ) pos );
+        __m128i found = _mm_setzero_si128 ( );
+        unsigned int mask = 0;
+
+        for ( const char * s = ac->starts; *s != '\0'; s++ )
+            found = _mm_or_si128 ( found, _mm_cmpeq_epi8 ( block,
+                        _mm_set1_epi8 ( *s ) ) );
+
+        if ( ( mask = _mm_movemask_epi8 ( found ) ) != 0 )
+            return pos + __builtin_ctz ( mask );
+    }
+#endif /* __SSE2__ */
+
+    /* the bytes leaving the root state are exactly those in `starts` */
+    while ( pos < end && ac->delta [ ac->class_map [ *pos ] ] == 0 )
+        pos++;
+
+    return pos;
+}
+
+/* [exposed function] automaton_scan: find every needle of `ac` in the `len`
+ * bytes at `buffer`, leaving the matches grouped by needle in `hl` (see
+ * hit_list_t). The bytes need not be null-terminated, and are never read
+ * beyond, so a buffer may be a chunk of a larger one; every engine searches a
+ * null byte among them like any other. The automaton finds the needles in a
+ * single pass; the other engines make a pass per needle (see engine_t). This
+ * function returns zero on success, or -1 if the hit list could not grow, in
+ * which case errno is set appropriately. */
+
+int automaton_scan ( const struct automaton_t * ac, const char * buffer,
+        size_t len, struct hit_list_t * hl )
+{
+    const unsigned char * pos = ( const unsigned char * ) buffer,
+          * end = pos + len;
+    int state = 0;
+
+    if ( ac->engine != ENGINE_AC )
+        return scan_needles ( ac, buffer, len, hl );
+
+    hl->count = 0;
+    memset ( hl->line_end, 0, sizeof ( size_t ) * ( hl->ncount + 1 ) );
+
+    for ( ; ; pos++ ) {
+        if ( state == 0 && ac->skip )
+            /* no partial match is in progress */
+            pos = skip_to_start ( ac, pos, end );
+
+        if ( pos >= end )
+            break;
+
+        if ( ( state = ac->delta [ state + ac->class_map [ *pos ] ] )
+                < ac->accepting )
+            continue;
+
+        if ( record_hits ( ac, hl, buffer, len, ( const char * ) pos,
+                    state / ac->classes ) == -1 )
+            return -1;
+    }
+
+    group_hits ( hl );
+    return 0;
+}
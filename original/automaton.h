@@ -0,0 +1,90 @@
+/* owd-euses: multi-needle automaton signatures
+ * Oliver Dixon. */
+
+#ifndef AUTOMATON_H
+#define AUTOMATON_H
+
+#include <stddef.h>
+
+#include "kernel.h"
+
+/* The largest set of needle-starting bytes for which the scanner skips through
+ * the buffer to the next of them (see skip_to_start) instead of stepping the
+ * automaton. */
+#define AUTOMATON_STARTS_MAX ( 16 )
+
+/* The most needles for which ENGINE_AUTO chooses ENGINE_SIMD. Each needle costs
+ * the kernel a pass over the buffer, whereas the automaton always makes one,
+ * but steps through it a byte at a time; the kernel remains the faster up to
+ * about this many needles. */
+#define AUTOMATON_SIMD_MAX ( 32 )
+
+/* engine_t: the method by which `automaton_scan` finds the needles:
+ *
+ *  - ENGINE_AC: a single pass of the Aho-Corasick automaton, for all needles;
+ *  - ENGINE_SIMD: a pass of the vector kernel (see kernel_find) per needle;
+ *  - ENGINE_LIBC: a pass of memmem(3), or of strncasecmp(3) if ignoring case,
+ *    per needle, for comparison with the others;
+ *  - ENGINE_AUTO: ENGINE_SIMD for up to AUTOMATON_SIMD_MAX needles, and
+ *    ENGINE_AC otherwise, resolved by `automaton_build`. */
+
+enum engine_t {
+    ENGINE_AUTO = 0,
+    ENGINE_AC   = 1,
+    ENGINE_SIMD = 2,
+    ENGINE_LIBC = 3
+};
+
+/* automaton_t: an Aho-Corasick automaton built once from the query needles, and
+ * stored as a dense transition table indexed by [state][byte class]. Bytes
+ * which appear in none of the needles share a single class, keeping the table
+ * small enough to stay resident in the cache for the typical number of needles.
+ * If the automaton is case-insensitive, the folding is performed by
+ * `class_map`, so the scanner itself never calls tolower(3).
+ *
+ * The entries of `delta` are pre-multiplied by `classes`, and the states in
+ * which at least one needle ends are numbered last, so the scanner can detect a
+ * match with a single comparison against `accepting`. While the automaton rests
+ * in its root state, the scanner skips to the next byte in `starts`, the set of
+ * bytes beginning a needle, if that set is small enough to benefit.
+ *
+ * The tables are built whatever the engine, as they are small; the per-needle
+ * engines only use `needles`, `lengths`, and `multiline`. */
+
+struct automaton_t {
+    int * delta; /* transitions: delta [ state * classes + class ] */
+    int * out_start; /* per state: first entry in `outputs` */
+    int * out_count; /* per state: number of needles ending in the state */
+    int * outputs; /* needle indexes, grouped by state */
+    size_t * lengths; /* per needle: length of the needle */
+    int * multiline; /* per needle: non-zero if the needle contains '\n' */
+    struct needle_t * needles; /* per needle: compiled for the kernels */
+    enum engine_t engine;
+    int classes, states, ncount, accepting, skip, no_case;
+    unsigned char class_map [ 256 ];
+    char starts [ AUTOMATON_STARTS_MAX + 1 ];
+};
+
+/* hit_list_t: the matches found by a single scan of a buffer. After a call to
+ * `automaton_scan`, the offsets of the matches of needle `i` are stored, in
+ * ascending order, in offsets [ first [ i ] ] to
+ * offsets [ first [ i + 1 ] - 1 ]. The list is persistent across scans, and
+ * should be initialised once for the automaton with which it is used. */
+
+struct hit_list_t {
+    size_t * offsets; /* match offsets, grouped by needle */
+    size_t * scratch; /* unsorted (offset, needle) pairs from the scan */
+    size_t * first; /* per needle: index into `offsets`; ncount + 1 entries */
+    size_t * line_end; /* per needle: end of the line of the latest hit */
+    size_t count, capacity;
+    int ncount;
+};
+
+int automaton_build ( struct automaton_t *, char **, int, int, enum engine_t );
+void automaton_free ( struct automaton_t * );
+int hit_list_init ( struct hit_list_t *, int );
+void hit_list_free ( struct hit_list_t * );
+int automaton_scan ( const struct automaton_t *, const char *, size_t,
+        struct hit_list_t * );
+
+#endif /* AUTOMATON_H */
@@ -0,0 +1,89 @@
+/* owd-euses: batch-query reader; see batch.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "batch.h"
+#include "converse.h"
+
+/* [exposed function] query_init: prepare an empty query for `query_read`. */
+
+void query_init ( struct query_t * query )
+{
+    query->line = NULL;
+    query->size = 0;
+    query->words = NULL;
+    query->count = query->capacity = 0;
+    query->number = 0;
+}
+
+/* [exposed function] query_free: release the line and word list of a query. */
+
+void query_free ( struct query_t * query )
+{
+    free ( query->line );
+    free ( query->words );
+    query_init ( query );
+}
+
+/* push_word: append `word` to the word list of the `query`, or, if `word` is
+ * NULL, terminate the list without counting it. Returns zero on success, or -1
+ * if the list could not grow, in which case errno is set. */
+
+static int push_word ( struct query_t * query, char * word )
+{
+    char ** words = NULL;
+
+    if ( query->count == query->capacity ) {
+        int capacity = ( query->capacity == 0 ) ? 16 :
+            query->capacity * 2;
+
+        if ( ( words = realloc ( query->words, sizeof ( *words ) *
+                        capacity ) ) == NULL )
+            return -1;
+
+        query->words = words;
+        query->capacity = capacity;
+    }
+
+    query->words [ query->count ] = word;
+    if ( word != NULL )
+        query->count++;
+
+    return 0;
+}
+
+/* [exposed function] query_read: read the next line of `fp` into the `query`,
+ * and split it into its words; see query_t. Every line is a query, even if it
+ * is blank, so the results of a batch can be matched to its lines. Returns 1 if
+ * a query was read, zero at the end of the input, or -1 on failure, in which
+ * case errno and the information buffer are set appropriately. */
+
+int query_read ( struct query_t * query, FILE * fp )
+{
+    char * word = NULL, * save = NULL;
+
+    errno = 0;
+    if ( getline ( & ( query->line ), & ( query->size ), fp ) == -1 ) {
+        if ( errno == 0 )
+            return 0; /* end of the input */
+
+        populate_info_buffer ( "Batch input" );
+        return -1;
+    }
+
+    query->number++;
+    query->count = 0;
+    for ( word = strtok_r ( query->line, QUERY_BLANKS, &save ); ;
+            word = strtok_r ( NULL, QUERY_BLANKS, &save ) ) {
+        if ( push_word ( query, word ) == -1 ) {
+            populate_info_buffer ( "Query" );
+            return -1;
+        }
+
+        if ( word == NULL )
+            return 1; /* the list has been terminated */
+    }
+}
@@ -0,0 +1,30 @@
+/* owd-euses: batch-query reader signatures
+ * Oliver Dixon. */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#define QUERY_BLANKS " \t\r\n" /* Separators of the words of a query */
+
+/* query_t: a single query of a batch (see ARG_BATCH), being a line of the
+ * input, split in place into its `words`, which are separated by blanks: the
+ * options of the query, followed by its substrings. `words` is terminated by a
+ * NULL entry, as is `argv` of main. The line and the word list are kept, and
+ * grow as required, from one query to the next; `number` is that of the line,
+ * counted from one. */
+
+struct query_t {
+    char * line;
+    size_t size; /* the allocated size of `line`; see getline(3) */
+    char ** words;
+    int count, capacity;
+    unsigned long number;
+};
+
+void query_init ( struct query_t * );
+void query_free ( struct query_t * );
+int query_read ( struct query_t *, FILE * );
+
+#endif /* BATCH_H */
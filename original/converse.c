@@ -11,8 +11,13 @@
 
 /* Globally accessible message buffer for better error-reporting; it should only
  * be written to using the populate_info_buffer function, as it provides
- * overflow-protection and pretty truncation. */
-char info_buffer [ ERROR_MAX ];
+ * overflow-protection and pretty truncation. Each thread has its own, so the
+ * workers of a concurrent search cannot garble one another's messages. */
+_Thread_local char info_buffer [ ERROR_MAX ];
+
+/* The queue into which the warnings of this thread are deferred, if any; see
+ * diagnostics_t. */
+_Thread_local struct diagnostics_t * diagnostics = NULL;
 
 /* [exposed function] print_fatal: format a `status` code, prefixed with
  * `prefix`, and send it to stderr. This function relies on the global error
@@ -36,26 +41,62 @@ void print_fatal ( const char * prefix, int status,
             get_detail ( status ), ( status == 1 ) ? errno : status );
 }
 
+/* defer_warning: add the warning `status`, with the current errno and
+ * information buffer, to the queue of the calling thread. Returns zero on
+ * success, or -1 if the queue could not be extended, in which case the warning
+ * should be printed at once instead. */
+
+static int defer_warning ( int status, const char * ( * get_detail ) ( int ) )
+{
+    struct diagnostics_t * queue = diagnostics;
+    struct diagnostic_t * list = NULL;
+    size_t capacity = ( queue->capacity == 0 ) ? 4 : queue->capacity * 2;
+
+    if ( queue->count == queue->capacity ) {
+        if ( ( list = realloc ( queue->list, capacity * sizeof ( *list ) ) )
+                == NULL )
+            return -1;
+
+        queue->list = list;
+        queue->capacity = capacity;
+    }
+
+    keep_diagnostic ( & ( queue->list [ queue->count ] ) );
+    queue->list [ queue->count ].status = status;
+    queue->list [ queue->count++ ].get_detail = get_detail;
+    return 0;
+}
+
 /* [exposed function] print_warning: format the contents of the info buffer on
  * one line. This provides a succinct message designed for warnings which do not
  * generally change the flow of execution.  This function uses the `get_detail`
  * function to attain a summary regarding the `status`, which should be
  * compatible with the enumerable type expected by the `get_detail` function
- * dereference.
+ * dereference. If the calling thread defers its warnings (see diagnostics_t),
+ * the warning is queued, to be printed by `flush_diagnostics`. The line is
+ * written whole, even if other threads are warning at the same time.
  *
  * The same assumptions made by `print_fatal` are made in this function's
  * implementation; it is rather safe, nonetheless. */
 
 void print_warning ( int status, const char * ( * get_detail ) ( int ) )
 {
+    const int error = errno;
+
+    if ( diagnostics != NULL && defer_warning ( status, get_detail ) == 0 )
+        return;
+
+    flockfile ( stderr );
     fputs ( PROGRAM_NAME ": warning", stderr );
 
     if ( info_buffer [ 0 ] != '\0' )
         fprintf ( stderr, " (\"%s\")", info_buffer );
 
+    errno = error;
     fprintf ( stderr, ": %d(%c): %s\n",
             ( status == 1 ) ? errno : status, ( status == 1 ) ? 'S'
             : 'I', get_detail ( status ) );
+    funlockfile ( stderr );
 }
 
 /* [exposed function] populate_info_buffer: copy the `message` into the global
@@ -95,6 +136,63 @@ void populate_info_buffer ( const char * message )
     }
 }
 
+/* [exposed function] keep_diagnostic: keep the current errno and information
+ * buffer in `diag`, such as those of a failure in a worker, which are
+ * reported by another thread; see `restore_diagnostic`. */
+
+void keep_diagnostic ( struct diagnostic_t * diag )
+{
+    diag->status = 1;
+    diag->error = errno;
+    diag->get_detail = NULL;
+    strcpy ( diag->article, info_buffer );
+}
+
+/* [exposed function] restore_diagnostic: make the errno and information buffer
+ * kept in `diag` by `keep_diagnostic` those of the calling thread. */
+
+void restore_diagnostic ( const struct diagnostic_t * diag )
+{
+    strcpy ( info_buffer, diag->article );
+    errno = diag->error;
+}
+
+/* [exposed function] flush_diagnostics: print the warnings in the `queue`, in
+ * the order in which they were raised, and empty it. The information buffer of
+ * the calling thread is left as it was. */
+
+void flush_diagnostics ( struct diagnostics_t * queue )
+{
+    struct diagnostics_t * deferred = diagnostics;
+    struct diagnostic_t kept;
+
+    if ( queue->count == 0 )
+        return;
+
+    keep_diagnostic ( &kept );
+    diagnostics = NULL;
+
+    for ( size_t i = 0; i < queue->count; i++ ) {
+        restore_diagnostic ( & ( queue->list [ i ] ) );
+        print_warning ( queue->list [ i ].status,
+                queue->list [ i ].get_detail );
+    }
+
+    diagnostics = deferred;
+    restore_diagnostic ( &kept );
+    free_diagnostics ( queue );
+}
+
+/* [exposed function] free_diagnostics: discard the warnings in the `queue`,
+ * without printing them, and empty it. */
+
+void free_diagnostics ( struct diagnostics_t * queue )
+{
+    free ( queue->list );
+    queue->list = NULL;
+    queue->count = queue->capacity = 0;
+}
+
 /* [exposed function] print_version_info: uses the various PROGRAM_* definitions
  * to print program information to stdout. */
 
@@ -128,6 +226,14 @@ void print_help_info ( const char * invocation )
             "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
             "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
             "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
+            "--%-13s -%-3c\t%s\n--%-13s -%-3c\t%s\n" \
             "--%-13s -%-3c\t%s\n", invocation,
 
             "list-repos", 'r', "Prepend a list of located " \
@@ -155,6 +261,35 @@ void print_help_info ( const char * invocation )
                 " description in distinct colours.",
             "global", 'g', "Exclude all sources describing "
                 "package-local flags.",
+            "index", 'x', "Rebuild the index of the " \
+                "description files (no substrings needed).",
+            "no-index", 'X', "Search the description files " \
+                "directly, ignoring the index.",
+            "jobs N", 'j', "Search with N workers (default: " \
+                "one per processor).",
+            "engine=E", '\b', "Find substrings with E: auto, " \
+                "ac, simd, or libc.",
+            "format=F", '\b', "Print results as F: text, ndjson, " \
+                "tsv, or null.",
+            "count", '\b', "Print only the number of results.",
+            "max-count=N", '\b', "Stop after the first N results.",
+            "files-with-matches", '\b', "Print only the paths of the " \
+                "files with results.",
+            "exists", '\b', "Print nothing; exit successfully " \
+                "only if a result exists.",
+            "batch", '\b', "Read the queries from stdin, one per " \
+                "line, with their own options.",
+            "daemon", '\b', "Keep the repositories loaded, and serve " \
+                "the queries of clients.",
+            "client", '\b', "Have the daemon search, if one is " \
+                "running; otherwise, search here.",
+            "socket=PATH", '\b', "Use the daemon socket at PATH.",
+            "io=M", '\b', "Read the files with M: sync, or uring " \
+                "(batched).",
+            "stats", '\b', "Print the time taken by each phase, " \
+                "and counts of the work done, to stderr.",
+            "trace=FILE", '\b', "Write the spans of the search to " \
+                "FILE, as Chrome trace events.",
             "", '\b', "Consider all further arguments as " \
                 "substrings/queries." );
 }
@@ -165,20 +300,37 @@ void print_help_info ( const char * invocation )
 
 void list_repos ( struct repo_stack_t * stack, char * base )
 {
-    struct repo_t * repo = stack_peek ( stack );
+    struct repo_t * repo = NULL;
 
     fputs ( "Configuration directory: ", stdout );
     puts ( base );
     putchar ( '\n' );
 
-    if ( repo == NULL )
+    if ( stack->size == 0 )
         return; /* A lack of repositories has already been caught. */
 
-    do
+    for ( unsigned long i = 0; ( repo = stack_repo ( stack, i ) ) != NULL;
+            i++ )
         printf ( "Name: %-10s\tLocation: %-16s\n", repo->name,
                 repo->location );
-    while ( ( repo = repo->next ) != NULL );
 
     putchar ( '\n' );
 }
 
+
+/* [exposed function] print_json_string: print `str` to the `stream` as a JSON
+ * string, escaping what must be. */
+
+void print_json_string ( FILE * stream, const char * str )
+{
+    fputc ( '"', stream );
+    for ( ; *str != '\0'; str++ )
+        if ( *str == '"' || *str == '\\' )
+            fprintf ( stream, "\\%c", *str );
+        else if ( ( unsigned char ) *str < 0x20 )
+            fprintf ( stream, "\\u%04x", ( unsigned char ) *str );
+        else
+            fputc ( *str, stream );
+
+    fputc ( '"', stream );
+}
@@ -4,21 +4,51 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <stdio.h>
+
 #include "stack.h"
 
 /* In general, these functions should be the only calls directly conferring with
  * a standard output buffer. They are primarily for error-reporting, so should
  * not be able to fail to a point which would invoke a (further) fatal error. */
 
+#define ERROR_MAX ( 256 )
+extern _Thread_local char info_buffer [ ERROR_MAX ];
+
+/* diagnostic_t: the context of a failure or a warning, kept to be reported
+ * later, or by another thread: its `status`, interpreted by `get_detail` (if a
+ * warning), the errno at the time, and the information buffer, naming the
+ * article (such as a path) or stage at which it arose. */
+
+struct diagnostic_t {
+    int status, error;
+    const char * ( * get_detail ) ( int );
+    char article [ ERROR_MAX ];
+};
+
+/* diagnostics_t: the warnings raised by a thread while `diagnostics` points to
+ * the queue, rather than printed at once, so that those of the workers of a
+ * search can be printed in the order of the items which raised them (see
+ * pool_job_t), and the workers need not share stderr in the meantime. */
+
+struct diagnostics_t {
+    struct diagnostic_t * list;
+    size_t count, capacity;
+};
+
+extern _Thread_local struct diagnostics_t * diagnostics;
+
 void print_fatal ( const char *, int, const char * ( * ) ( int ) );
 void print_warning ( int, const char * ( * ) ( int ) );
 void populate_info_buffer ( const char * );
+void keep_diagnostic ( struct diagnostic_t * );
+void restore_diagnostic ( const struct diagnostic_t * );
+void flush_diagnostics ( struct diagnostics_t * );
+void free_diagnostics ( struct diagnostics_t * );
 void print_version_info ( void );
 void print_help_info ( const char * );
 void list_repos ( struct repo_stack_t *, char * );
-
-#define ERROR_MAX ( 256 )
-extern char info_buffer [ ERROR_MAX ];
+void print_json_string ( FILE *, const char * );
 
 #endif /* ERROR_H */
 
@@ -0,0 +1,387 @@
+/* owd-euses: query daemon, and its client; see daemon.h.
+ * Oliver Dixon. */
+
+#define _GNU_SOURCE
+/* struct ucred */
+#include <sys/socket.h>
+#undef _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "converse.h"
+#include "sink.h"
+#include "daemon.h"
+
+#define DAEMON_NAME      "owd-euses"
+#define DAEMON_BUFFER_SZ ( 65536 ) /* The relay buffer size of a client */
+#define DAEMON_FALLBACK  "/tmp/" DAEMON_NAME "-%lu" /* without a runtime dir */
+
+/* connection_t: a connection accepted by the daemon, to be served by a thread
+ * of its own; see `daemon_serve`. */
+
+struct connection_t {
+    int ( * serve ) ( void *, int );
+    void * state;
+    int fd;
+};
+
+/* private_dir: create the directory at `path`, accessible only to the user,
+ * if it does not exist, and verify that it is a directory (not a link to one)
+ * of the user, accessible to no other. As /tmp is shared, another user may
+ * have made it first, to have the socket placed within their reach. Returns
+ * zero if the directory is private, or -1 otherwise, in which case errno is
+ * set (EPERM, if it exists, but is not private). */
+
+static int private_dir ( const char * path )
+{
+    struct stat st;
+
+    if ( ( mkdir ( path, S_IRWXU ) == -1 && errno != EEXIST ) ||
+            lstat ( path, &st ) == -1 )
+        return -1;
+
+    if ( !S_ISDIR ( st.st_mode ) || st.st_uid != getuid ( ) ||
+            ( st.st_mode & ( S_IRWXG | S_IRWXO ) ) != 0 ) {
+        errno = EPERM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] daemon_default_path: place the path of the socket used if
+ * ARG_SOCKET is not given in `path`: "owd-euses.socket" in $XDG_RUNTIME_DIR,
+ * which is private to the user, or, failing that, in the directory
+ * "/tmp/owd-euses-<uid>", which is created, and verified to be private (see
+ * `private_dir`). Returns zero on success, or -1 if the path is too long, or
+ * the directory is not private, in which case errno is set. */
+
+int daemon_default_path ( char path [ DAEMON_PATH_MAX ] )
+{
+    const char * runtime = getenv ( "XDG_RUNTIME_DIR" );
+    int len = 0;
+
+    if ( runtime != NULL && runtime [ 0 ] == '/' )
+        len = snprintf ( path, DAEMON_PATH_MAX, "%s", runtime );
+    else {
+        len = snprintf ( path, DAEMON_PATH_MAX, DAEMON_FALLBACK,
+                ( unsigned long ) getuid ( ) );
+
+        if ( len >= 0 && len < DAEMON_PATH_MAX && private_dir ( path ) == -1 )
+            return -1;
+    }
+
+    if ( len >= 0 && len < DAEMON_PATH_MAX )
+        len += snprintf ( & ( path [ len ] ), DAEMON_PATH_MAX - len,
+                "/" DAEMON_NAME ".socket" );
+
+    if ( len < 0 || len >= DAEMON_PATH_MAX ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* open_socket: create a stream socket, placing the address of the `path` in
+ * `addr`. Returns the descriptor of the socket, or -1 on failure, in which case
+ * errno is set. */
+
+static int open_socket ( const char * path, struct sockaddr_un * addr )
+{
+    if ( strlen ( path ) >= sizeof ( addr->sun_path ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset ( addr, 0, sizeof ( *addr ) );
+    addr->sun_family = AF_UNIX;
+    strcpy ( addr->sun_path, path );
+
+    return socket ( AF_UNIX, SOCK_STREAM, 0 );
+}
+
+/* connect_socket: connect to the daemon listening on the socket at `path`.
+ * A socket listened on by a process of another user is refused (EPERM), so no
+ * query is sent to, and no result relayed from, one which may only be posing
+ * as the daemon. Returns the descriptor of the connection, or -1 on failure,
+ * in which case errno is set. */
+
+static int connect_socket ( const char * path )
+{
+    struct sockaddr_un addr;
+    struct ucred peer;
+    socklen_t peer_len = sizeof ( peer );
+    int fd = -1, error = 0;
+
+    if ( ( fd = open_socket ( path, &addr ) ) == -1 )
+        return -1;
+
+    if ( connect ( fd, ( struct sockaddr * ) &addr, sizeof ( addr ) )
+            == -1 || getsockopt ( fd, SOL_SOCKET, SO_PEERCRED, &peer,
+                &peer_len ) == -1 ) {
+        error = errno;
+        close ( fd );
+        errno = error;
+        return -1;
+    }
+
+    if ( peer.uid != getuid ( ) ) {
+        close ( fd );
+        errno = EPERM;
+        return -1;
+    }
+
+    return fd;
+}
+
+/* bind_socket: listen on a new socket at `path`, which is only accessible to
+ * the user. A socket left at `path` by a daemon which was stopped is replaced,
+ * but not that of a daemon which is still running (EADDRINUSE), whoever runs
+ * it, nor any other file. Returns the descriptor of the socket, or -1 on
+ * failure, in which case errno is set. */
+
+static int bind_socket ( const char * path )
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t mask = 0;
+    int fd = -1, status = 0, error = 0;
+
+    if ( ( fd = connect_socket ( path ) ) != -1 ) {
+        close ( fd );
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    if ( errno == ECONNREFUSED && lstat ( path, &st ) == 0 &&
+            S_ISSOCK ( st.st_mode ) && unlink ( path ) == -1 )
+        return -1;
+
+    if ( ( fd = open_socket ( path, &addr ) ) == -1 )
+        return -1;
+
+    mask = umask ( S_IXUSR | S_IRWXG | S_IRWXO );
+    status = bind ( fd, ( struct sockaddr * ) &addr, sizeof ( addr ) );
+    umask ( mask );
+
+    if ( status == -1 || listen ( fd, SOMAXCONN ) == -1 ) {
+        error = errno;
+        close ( fd );
+        errno = error;
+        return -1;
+    }
+
+    return fd;
+}
+
+/* serve_connection: the routine of a thread serving a single connection; see
+ * `daemon_serve`. */
+
+static void * serve_connection ( void * arg )
+{
+    struct connection_t conn = * ( struct connection_t * ) arg;
+
+    free ( arg );
+    conn.serve ( conn.state, conn.fd );
+    return NULL;
+}
+
+/* [exposed function] daemon_serve: listen on the socket at `path`, and serve
+ * every connection with `serve`, which is given `state` and the descriptor of
+ * the connection, and must close the latter. Each connection is served by a
+ * thread of its own, so clients are served at once, rather than one after the
+ * other; `serve` must therefore only read `state`. A connection which cannot be
+ * given a thread is served by the calling thread instead. SIGPIPE is ignored,
+ * so a client which has gone away is seen as EPIPE, rather than stopping the
+ * daemon. This function only returns on failure, returning -1, with errno and
+ * the information buffer set; otherwise, the daemon runs until it is stopped
+ * by a signal, and its socket is replaced by the next daemon. */
+
+int daemon_serve ( const char * path, int ( * serve ) ( void *, int ),
+        void * state )
+{
+    struct connection_t * conn = NULL;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd = -1, client = -1, status = 0;
+
+    populate_info_buffer ( path );
+    if ( signal ( SIGPIPE, SIG_IGN ) == SIG_ERR ||
+            ( fd = bind_socket ( path ) ) == -1 )
+        return -1;
+
+    if ( ( status = pthread_attr_init ( &attr ) ) != 0 ||
+            ( status = pthread_attr_setdetachstate ( &attr,
+                PTHREAD_CREATE_DETACHED ) ) != 0 ) {
+        close ( fd );
+        errno = status;
+        return -1;
+    }
+
+    for ( ; ; ) {
+        if ( ( client = accept ( fd, NULL, NULL ) ) == -1 ) {
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+
+            status = errno;
+            break;
+        }
+
+        if ( ( conn = malloc ( sizeof ( *conn ) ) ) != NULL ) {
+            conn->serve = serve;
+            conn->state = state;
+            conn->fd = client;
+
+            if ( pthread_create ( &thread, &attr, &serve_connection,
+                        conn ) == 0 )
+                continue;
+
+            free ( conn );
+        }
+
+        serve ( state, client );
+    }
+
+    pthread_attr_destroy ( &attr );
+    close ( fd );
+    errno = status;
+    return -1;
+}
+
+/* [exposed function] daemon_reply: write the trailer of a query to the client
+ * connected to `fd`, with the `reply` and the number of `results`; see
+ * DAEMON_TRAILER_SZ. Returns zero on success, or -1 on failure, in which case
+ * errno is set. */
+
+int daemon_reply ( int fd, enum daemon_reply_t reply, size_t results )
+{
+    char trailer [ DAEMON_TRAILER_SZ + 1 ];
+    struct iovec iov = { .iov_base = trailer,
+        .iov_len = DAEMON_TRAILER_SZ };
+
+    snprintf ( trailer, sizeof ( trailer ), "%c %021zu\n", reply, results );
+    return sink_writev ( fd, &iov, 1 );
+}
+
+/* parse_trailer: return the reply of the `trailer` of a query, placing the
+ * number of results in `results`, or DAEMON_ERRNO, with errno set to EPROTO,
+ * if it is malformed. */
+
+static enum daemon_reply_t parse_trailer ( const char * trailer,
+        size_t * results )
+{
+    char * end = NULL;
+
+    if ( ( trailer [ 0 ] == DAEMON_OK || trailer [ 0 ] == DAEMON_REJECTED ||
+                trailer [ 0 ] == DAEMON_FAILED ) && trailer [ 1 ] == ' ' &&
+            trailer [ DAEMON_TRAILER_SZ - 1 ] == '\n' ) {
+        errno = 0;
+        *results = strtoull ( & ( trailer [ 2 ] ), &end, 10 );
+        if ( errno == 0 && end == & ( trailer [ DAEMON_TRAILER_SZ - 1 ] ) )
+            return trailer [ 0 ];
+    }
+
+    errno = EPROTO;
+    return DAEMON_ERRNO;
+}
+
+/* relay: write the first `len` bytes of `buffer` to `out`, setting the
+ * information buffer on failure. Returns as `sink_writev`. */
+
+static int relay ( int out, char * buffer, size_t len )
+{
+    struct iovec iov = { .iov_base = buffer, .iov_len = len };
+
+    if ( len > 0 && sink_writev ( out, &iov, 1 ) == -1 ) {
+        populate_info_buffer ( "Output stream" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] daemon_request: send the query `request`, of `len` bytes,
+ * including its line feed, to the daemon listening on the socket at `path`,
+ * and relay its results to `out`, placing their number in `results`; see
+ * DAEMON_TRAILER_SZ. The results are relayed as they arrive, less the last
+ * bytes received, which may be the trailer. Returns the reply of the daemon;
+ * DAEMON_ABSENT, if no daemon could be reached, in which case nothing has been
+ * written; or DAEMON_ERRNO, with errno and the information buffer set, if the
+ * results could not be relayed, or the daemon went away before its trailer
+ * (EPROTO). */
+
+enum daemon_reply_t daemon_request ( const char * path, const char * request,
+        size_t len, int out, size_t * results )
+{
+    char buffer [ DAEMON_BUFFER_SZ ];
+    enum daemon_reply_t reply = DAEMON_ERRNO;
+    size_t held = 0, sent = 0;
+    ssize_t got = 0;
+    int fd = -1;
+
+    *results = 0;
+    if ( ( fd = connect_socket ( path ) ) == -1 )
+        return DAEMON_ABSENT;
+
+    for ( ; sent < len; sent += got )
+        /* MSG_NOSIGNAL: a daemon which has gone is not worth a SIGPIPE */
+        if ( ( got = send ( fd, & ( request [ sent ] ), len - sent,
+                        MSG_NOSIGNAL ) ) == -1 ) {
+            if ( errno != EINTR ) {
+                close ( fd );
+                return DAEMON_ABSENT;
+            }
+
+            got = 0;
+        }
+
+    shutdown ( fd, SHUT_WR );
+    populate_info_buffer ( "Daemon" );
+
+    while ( ( got = read ( fd, & ( buffer [ held ] ), sizeof ( buffer ) -
+                    held ) ) != 0 ) {
+        if ( got == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            close ( fd );
+            return DAEMON_ERRNO;
+        }
+
+        held += got;
+        if ( held == sizeof ( buffer ) ) {
+            /* keep back what may be the trailer */
+            if ( relay ( out, buffer, held - DAEMON_TRAILER_SZ ) == -1 ) {
+                close ( fd );
+                return DAEMON_ERRNO;
+            }
+
+            memmove ( buffer, & ( buffer [ held - DAEMON_TRAILER_SZ ] ),
+                    DAEMON_TRAILER_SZ );
+            held = DAEMON_TRAILER_SZ;
+        }
+    }
+
+    close ( fd );
+    if ( held < DAEMON_TRAILER_SZ ) {
+        errno = EPROTO;
+        return DAEMON_ERRNO;
+    }
+
+    held -= DAEMON_TRAILER_SZ;
+    if ( ( reply = parse_trailer ( & ( buffer [ held ] ), results ) )
+            == DAEMON_ERRNO || relay ( out, buffer, held ) == -1 )
+        return DAEMON_ERRNO;
+
+    return reply;
+}
@@ -0,0 +1,45 @@
+/* owd-euses: query-daemon signatures
+ * Oliver Dixon. */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+
+/* The size of a socket path, including its null-terminator; that of `sun_path`
+ * in the sockaddr_un of Linux. */
+#define DAEMON_PATH_MAX ( 108 )
+
+/* The protocol between a client and the daemon (see ARG_DAEMON and ARG_CLIENT)
+ * is one query per connection. The client writes the query as a single line,
+ * its words separated by spaces, as a query of a batch (see `query_read`): the
+ * options of the query, then "--", then its substrings. It then shuts down its
+ * side of the connection. The daemon writes the results, exactly as they would
+ * have been written by a search in the client, followed by a trailer of
+ * DAEMON_TRAILER_SZ bytes, "<reply> <results>\n", where <reply> is one of
+ * daemon_reply_t, and <results> the number of results, as 21 decimal digits;
+ * it then closes the connection. As the trailer is of a fixed size, the client
+ * knows it to be the last bytes before the end of the stream, whatever the
+ * format of the results. */
+
+#define DAEMON_TRAILER_SZ ( 24 )
+
+/* daemon_reply_t: the outcome of a query, as given in the trailer, and returned
+ * by `daemon_request`. Nothing but the trailer is written for a query which is
+ * rejected, so the client can search for it itself. */
+
+enum daemon_reply_t {
+    DAEMON_ERRNO    = -2,  /* the results could not be relayed; c.f. errno */
+    DAEMON_ABSENT   = -1,  /* no daemon could be reached; see daemon_request */
+    DAEMON_OK       = '0', /* every result was written */
+    DAEMON_REJECTED = '1', /* the query was invalid, and was not searched */
+    DAEMON_FAILED   = '2'  /* the search failed; the results are incomplete */
+};
+
+int daemon_default_path ( char [ DAEMON_PATH_MAX ] );
+int daemon_serve ( const char *, int ( * ) ( void *, int ), void * );
+int daemon_reply ( int, enum daemon_reply_t, size_t );
+enum daemon_reply_t daemon_request ( const char *, const char *, size_t, int,
+        size_t * );
+
+#endif /* DAEMON_H */
@@ -1,16 +1,18 @@
-/* owd-euses: main driver
+/* owd-euses: search driver, shared by the command line (see main.c) and the
+ * library (see libeuses.h)
  * Oliver Dixon. */
 
-#define _GNU_SOURCE
-/* strcasestr */
 #include <string.h>
-#undef _GNU_SOURCE
-
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <stddef.h> /* ptrdiff_t */
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "euses.h"
 #include "args.h"
@@ -18,23 +20,22 @@
 #include "stack.h"
 #include "colour.h"
 #include "globbing.h"
+#include "automaton.h"
+#include "lines.h"
+#include "reader.h"
+#include "index.h"
+#include "pool.h"
+#include "sink.h"
+#include "source.h"
+#include "uring.h"
+#include "stats.h"
+#include "trace.h"
+#include "batch.h"
+#include "daemon.h"
+#include "watch.h"
+#include "libeuses.h"
 
 #define BUFFER_SZ   ( 4096 ) /* Non-primary buffer size */
-#define SBUF_SZ     ( 512  ) /* Read-ahead size for printing underflows. */
-#define LBUF_SZ_MIN ( 512  ) /* Minimum primary buffer size. */
-
-#ifndef LBUF_SZ
-/* A user/distributor may want to change this. For an explanation of the
- * potential reasoning behind this, see the QUIRKS section of the manual. */
-#define LBUF_SZ     ( 8192 ) /* Default primary buffer size. */
-#else
-#if LBUF_SZ < LBUF_SZ_MIN
-/* Anything lower than LBUF_SZ_MIN would cause the output to be about as
- * readable as Finnegans Wake, as the previous (contextual) buffer information
- * would be skipped. */
-#error "LBUF_SZ cannot be so minute."
-#endif /* LBUF_SZ < LBUF_SZ_MIN */
-#endif /* LBUF_SZ */
 
 #define ASCII_MIN    ( 0x20 )
 #define ASCII_MAX    ( 0x7E )
@@ -46,65 +47,21 @@
 #define PORTAGE_MAKECONF   "/../make.conf"
 #define DEFAULT_REPO_NAME  "gentoo"
 
-enum status_t {
-    STATUS_ERRNO  =  1, /* c.f. perror or strerror on errno */
-    STATUS_OK     =  0, /* everything is OK */
-    STATUS_NOREPO = -1, /* no repository-description files were found */
-    STATUS_NOGENR = -2, /* no gentoo.conf repository-description file */
-    STATUS_ININME = -3, /* the ini file did not contain "[name]" */
-    STATUS_INILOC = -4, /* the location attribute doesn't exist */
-    STATUS_INILCS = -5, /* the location value exceeded PATH_MAX - 1 */
-    STATUS_INIEMP = -6  /* the repository-description file was empty */
-};
-
-enum warning_t {
-    WARNING_ERRNO =  1, /* c.f. errno */
-    WARNING_OK    =  0, /* everything is OK */
-    WARNING_RNONE = -1, /* no repositories; nothing to do */
-    WARNING_QNONE = -2, /* no queries; nothing to do */
-    WARNING_NONWL = -3, /* no newline found in the small buffer */
-    WARNING_PDEXT = -4, /* PORTDIR was detected */
-    WARNING_PDLST = -5, /* ARG_LIST_REPOS was set with PORTDIR */
-    WARNING_NOEOF = -6  /* a file was improperly/abruptly terminated */
-};
-
 enum dir_status_t {
     DIRSTAT_DONE  =  1, /* no more files in the stream */
     DIRSTAT_MORE  =  0, /* there may be more files in the stream */
     DIRSTAT_ERRNO = -1  /* an error occurred; c.f. errno */
 };
 
-enum buffer_status_t {
-    BUFSTAT_BORDR =  2, /* the buffer is full and the file is fully read */
-    BUFSTAT_MORE  =  1, /* the file has been buffered; room for more */
-    BUFSTAT_FULL  =  0, /* part of the file has been buffered; it is full */
-    BUFSTAT_ERRNO = -1  /* an error occurred in fread/fopen; c.f. errno */
-};
 
-/* buffer_info_t should be kept persistent by the caller, for use by functions
- * directly modifying the trans-directory and trans-file buffer. This is a
- * spurious attempt to eliminate the need for static variables inside the
- * buffered reader functions, thus ensuring thread-safety in all cases, should
- * such a need arise. Multiple instances of a buffer-directory set can also be
- * maintained simultaneously, regardless of the threading style. We don't need
- * another strtok(_r) situation. */
-
-struct buffer_info_t {
-    FILE * fp; /* the file currently being read */
-    size_t idx; /* the index into the current buffer; DO NOT TOUCH */
-    enum buffer_status_t status; /* for the caller: status of the reader */
-    char * buffer; /* buffer pointer, assumed to be of size LBUF_SZ */
-    char * path; /* path of `fp` */
-    int truncated; /* truncation status */
-};
 
-/* provide_gen_error: returns a human-readable string representing an error
- * code, as enumerated in status_t. If the passed code is STATUS_ERRNO, the
- * strerror function is used with the current value of errno. This function
- * takes an integer as opposed to the `status_t` enum so it can be used with
- * similar functions in a function pointer. */
+/* [exposed function] provide_gen_error: returns a human-readable string
+ * representing an error code, as enumerated in status_t. If the passed code is
+ * STATUS_ERRNO, the strerror function is used with the current value of errno.
+ * This function takes an integer as opposed to the `status_t` enum so it can be
+ * used with similar functions in a function pointer. */
 
-static const char * provide_gen_error ( int status )
+const char * provide_gen_error ( int status )
 {
     switch ( status ) {
         case STATUS_OK:     return "Everything is OK.";
@@ -119,24 +76,28 @@ static const char * provide_gen_error ( int status )
                     "contain the location attribute.";
         case STATUS_INILCS: return "A repository-description file" \
                     "contains an unwieldy location value.";
+        case STATUS_CLOSED: return "The output was closed before " \
+                    "every result was written.";
+        case STATUS_REMOTE: return "The daemon could not complete " \
+                    "the search.";
 
         default: return "Unknown error.";
     }
 }
 
-/* provide_gen_warning: identical to `provide_gen_error`, except this function
- * deals with non-fatal warnings, returning a human-readable string representing
- * the warning. The `status` code should be compatible with the `warning_t`
- * type. */
+/* [exposed function] provide_gen_warning: identical to `provide_gen_error`,
+ * except this function deals with non-fatal warnings, returning a
+ * human-readable string representing the warning. The `status` code should be
+ * compatible with the `warning_t` type. */
 
-static const char * provide_gen_warning ( int status )
+const char * provide_gen_warning ( int status )
 {
     switch ( status ) {
         case WARNING_ERRNO: return strerror ( errno );
         case WARNING_RNONE: return "No repositories were found.";
         case WARNING_QNONE: return "No queries were provided.";
-        case WARNING_NONWL: return "The entry did not end with a " \
-                    "new-line.";
+        case WARNING_TRUNC: return "The entry exceeds the buffer, " \
+                    "and was printed truncated.";
         case WARNING_PDEXT: return PROGRAM_NAME " has detected the " \
                     "existence of PORTDIR, either as an " \
                     "environment variable, or existing " \
@@ -149,22 +110,14 @@ static const char * provide_gen_warning ( int status )
         case WARNING_PDLST: return "Disregarding the repository-" \
                     "listing request due to the presence" \
                     " of PORTDIR.";
-        case WARNING_NOEOF: return "The file was rudely terminated.";
+        case WARNING_FROZEN: return "Changes to the repositories are " \
+                    "no longer followed; restart the daemon " \
+                    "to see them.";
 
         default: return "Unknown warning.";
     }
 }
 
-/* fnull: close and null a non-null file pointer. */
-
-static inline void fnull ( FILE ** fp )
-{
-    if ( *fp != NULL ) {
-        fclose ( *fp );
-        *fp = NULL;
-    }
-}
-
 /* dnull: close and null a non-null directory stream pointer. */
 
 static inline void dnull ( DIR ** dp )
@@ -319,59 +272,49 @@ static enum status_t get_keyval_value ( char location [ PATH_MAX ],
 
 /* buffer_repo_description: employing length-checks, load, buffer, and close,
  * the given repository-description file, allowing the driver to disregard the
- * file pointer. On success, STATUS_OK is returned, and on failure, either
- * STATUS_ERRNO (with errno set appropriately), or STATUS_DCLONG is returned. If
- * the file is empty, STATUS_INIEMP is returned. */
+ * source (see `source_t`). On success, STATUS_OK is returned, and on failure,
+ * either STATUS_ERRNO (with errno set appropriately), or STATUS_DCLONG is
+ * returned. If the file is empty, STATUS_INIEMP is returned. */
 
 static enum status_t buffer_repo_description ( char path [ ],
         char buffer [ BUFFER_SZ ] )
 {
-    FILE * fp = fopen ( path, "r" );
-    long f_len = 0;
-    size_t bytes_read = 0;
+    struct source_t src = SOURCE_INIT;
+    ssize_t bytes_read = 0;
 
-    if ( fp == NULL )
+    if ( source_open ( &src, AT_FDCWD, path ) == -1 )
         return STATUS_ERRNO;
 
-    if ( fseek ( fp, 0, SEEK_END ) == -1 ||
-            ( f_len = ftell ( fp ) ) == -1 ) {
-        fnull ( &fp );
-        return STATUS_ERRNO;
-    }
-
-    rewind ( fp );
-    if ( f_len >= BUFFER_SZ ) {
+    if ( src.st.st_size >= BUFFER_SZ ) {
         /* the repository-description file would not fit the buffer */
-        fnull ( &fp );
+        source_close ( &src );
         errno = EFBIG;
         return STATUS_ERRNO;
     }
 
-    if ( f_len == 0 ) {
+    if ( src.st.st_size == 0 ) {
         /* the file is empty, and the INI-parser would fail */
-        fnull ( &fp );
+        source_close ( &src );
         return STATUS_INIEMP;
     }
 
-    if ( ( bytes_read = fread ( buffer, sizeof ( char ), BUFFER_SZ - 1,
-                    fp ) ) < BUFFER_SZ - 1
-            && !feof ( fp ) ) {
-        fnull ( &fp );
+    bytes_read = source_read ( &src, buffer, BUFFER_SZ - 1 );
+    source_close ( &src );
+
+    if ( bytes_read == -1 )
         return STATUS_ERRNO;
-    }
 
-    fnull ( &fp );
     buffer [ bytes_read ] = '\0';
     return STATUS_OK;
 }
 
 /* parse_repo_description: parse the repository-description file, attaining the
- * base location and the name, populating the given struct accordingly. If the
+ * base location and the name, placing them in `location` and `name`. If the
  * repository-description file exceeds the generous amount as provided by the
  * buffer, STATUS_DCLONG is returned. */
 
-static enum status_t parse_repo_description ( struct repo_t * repo,
-        char desc_path [ ] )
+static enum status_t parse_repo_description ( char location [ PATH_MAX ],
+        char name [ NAME_MAX + 1 ], char desc_path [ ] )
 {
     char buffer [ BUFFER_SZ ];
     enum status_t status = STATUS_OK;
@@ -379,9 +322,9 @@ static enum status_t parse_repo_description ( struct repo_t * repo,
 
     if ( ( status = buffer_repo_description ( desc_path, buffer ) )
             != STATUS_OK || ( status =
-                ini_get_name ( repo->name, buffer, &offset ) )
+                ini_get_name ( name, buffer, &offset ) )
             != STATUS_OK || ( status = 
-                get_keyval_value ( repo->location,
+                get_keyval_value ( location,
                     & ( buffer [ offset ] ), "location" ) )
             != STATUS_OK ) {
         /* All these functions operate on the same desc_path. */
@@ -392,37 +335,29 @@ static enum status_t parse_repo_description ( struct repo_t * repo,
     return STATUS_OK;
 }
 
-/* register_repo: allocates memory for a repository, initialises it with empty
- * values its location on the filesystem, and adds it to the stack. If the
- * physical location exceeds the length allowed by PATH_MAX, or malloc cannot
- * allocate enough memory, errno is set appropriately and STATUS_ERRNO is
+/* register_repo: parse the repository-description file `filename` in `base`,
+ * and push the repository it describes to the stack; see stack_push. If the
+ * physical location exceeds the length allowed by PATH_MAX, or the repository
+ * cannot be registered, errno is set appropriately and STATUS_ERRNO is
  * returned. On success, STATUS_OK is returned. */
 
 static enum status_t register_repo ( char base [ ], char * filename,
         struct repo_stack_t * stack )
 {
-    struct repo_t * repo = malloc ( sizeof ( struct repo_t ) );
     enum status_t status = STATUS_OK;
-    char desc_path [ PATH_MAX ];
-
-    if ( repo == NULL ) {
-        populate_info_buffer ( filename );
-        return STATUS_ERRNO;
-    }
+    char desc_path [ PATH_MAX ], location [ PATH_MAX ], name [ NAME_MAX + 1 ];
 
-    if ( construct_path ( desc_path, base, filename ) == -1 ) {
-        free ( repo );
+    if ( construct_path ( desc_path, base, filename ) == -1 )
         return STATUS_ERRNO;
-    }
 
-    if ( ( status = parse_repo_description ( repo, desc_path ) )
-            != STATUS_OK ) {
-        free ( repo );
+    if ( ( status = parse_repo_description ( location, name, desc_path ) )
+            != STATUS_OK )
         return status;
-    }
 
-    repo->next = NULL;
-    stack_push ( stack, repo );
+    if ( stack_push ( stack, name, location ) == -1 ) {
+        populate_info_buffer ( filename );
+        return STATUS_ERRNO;
+    }
 
     return STATUS_OK;
 }
@@ -487,769 +422,1919 @@ static enum status_t enumerate_repo_descriptions ( char base [ ],
     return STATUS_NOGENR;
 }
 
-/* feof_stream: feof alternative, removing the reliance on file-handling
- * functions, such as fread, to set the end-of-file indicator. Unfortunately,
- * when reading a file of size N into a buffer of identical capacity, fread
- * only flags EOF upon attempting to read the (N+1)th character; thus, feof
- * cannot be relied upon. This function returns -1 on error, zero if the file
- * has not reached the end, and 1 if the inverse is true. In any case, the file
- * cursor is reverted to its previous state. */
+/* find_line_bounds: find the previous '\n', and the next '\n', of the line of
+ * buffer_start containing substr_start. Both line feeds are located with the
+ * line index built when the buffer was filled, so the cost does not depend
+ * upon the position of the match in the buffer. `marker` is then set as the
+ * end of the current line, or NULL if the line continues beyond the buffer, to
+ * avoid getting stuck in an infinite loop (this should be reset by the
+ * relevant caller(s) every time a new needle/search term is sought), and
+ * `record` is set to the fields of the line; see `line_index_record`. The
+ * buffer is only read, so a mapped file may be searched by several threads at
+ * once (see ARG_DAEMON). This function returns the start of the line. */
 
-static int feof_stream ( FILE * fp )
+static char * find_line_bounds ( char * buffer_start, char * substr_start,
+        char ** marker, struct line_index_t * lines,
+        const struct record_t ** record )
 {
-    long pos = 0, len = 0;
-
-    if ( ( pos = ftell ( fp ) ) == -1 || fseek ( fp, 0, SEEK_END ) == -1 )
-        return -1;
+    size_t feed = line_index_find ( lines, substr_start - buffer_start );
+    char * start = ( feed == 0 ) ? buffer_start :
+        & ( buffer_start [ lines->newlines [ feed - 1 ] + 1 ] );
+
+    /* marker is set to NULL if there's no closing newline, in which case
+     * printers classify the match as "truncated". Every line, including the
+     * last of the file, ends with a line feed, as a line too long for the
+     * streamed buffer is reported by `report_long_line` instead; see
+     * `populate_buffer` and `map_file`. */
+    *marker = ( feed == lines->count ) ? NULL :
+        & ( buffer_start [ lines->newlines [ feed ] ] );
+
+    *record = line_index_record ( lines, feed, buffer_start );
+    return start;
+}
 
-    if ( ( len = ftell ( fp ) ) == -1 ) {
-        fseek ( fp, pos, SEEK_SET );
-        return -1;
-    }
+/* print_truncation_notice: complete the printing of an entry which exceeded the
+ * streamed buffer (see `populate_buffer`), of which only the start was
+ * printed, with " [...]" and, unless ARG_NO_MIDBUF_WARN is set, a warning
+ * regarding the file. */
 
-    if ( fseek ( fp, pos, SEEK_SET ) == -1 )
-        return -1;
+static void print_truncation_notice ( struct buffer_info_t * bi )
+{
+    sink_literal ( bi->out, " [...]\n" );
 
-    /* Due to the behaviour of `get_seamless_buffer`, `pos` may exceed
-     * `len`, but still be valid (and indicate end-of-file). */
-    return ( pos >= len );
+    if ( CHK_ARG ( options, ARG_NO_MIDBUF_WARN ) == 0 ) {
+        populate_info_buffer ( bi->path );
+        print_warning ( WARNING_TRUNC, &provide_gen_warning );
+    }
 }
 
-/* organise_buffer: given a populated buffer `bi->buffer`, this function
- * determines the nature of the buffer in relation to the status of the file
- * pointer, `bi->fp`. If the buffer is full, and there is more to be read
- * from the file, BUFSTAT_FULL is returned. If the buffer is full, and the file
- * has ended, BUFSTAT_BORDR (the borderline case) is returned, whereas
- * BUFSTAT_MORE is returned if the file has been exhausted and there is more
- * room in the buffer. If any error occurs, BUFSTAT_ERRNO is returned, and
- * `errno` and the information buffer are populated appropriately.
- *
- * This function always closes (and NULLs; see fnull) the relevant file
- * pointer should (a) the file have ended, or (b) an error occurs. */
+/* print_uncoloured_output: print the `len` bytes of `result_str` uncoloured to
+ * `bi->out`. If the entry has been truncated, this is shown by
+ * `print_truncation_notice`. */
 
-static enum buffer_status_t determine_buffer_nature ( size_t bw,
-        struct buffer_info_t * bi, char * path )
+static void print_uncoloured_output ( const char * result_str, size_t len,
+        struct buffer_info_t * bi )
 {
-    if ( bw < LBUF_SZ - 1 ) {
-        if ( ( bi->idx += bw ) == LBUF_SZ - 1 ) {
-            bi->idx = 0;
-            return BUFSTAT_FULL;
-        }
-
-        bi->buffer [ bi->idx ] = '\0';
-        if ( feof_stream ( bi->fp ) == 1 ) {
-            /* the buffer has not been filled because the file has
-             * no more bytes */
-            fnull ( & ( bi->fp ) );
-            return BUFSTAT_MORE;
-        }
+    sink_write ( bi->out, result_str, len );
 
-        /* the buffer has not been filled because there was an error
-         * with fread, the details of which were written to errno */
-        populate_info_buffer ( path );
-        fnull ( & ( bi->fp ) );
-        return BUFSTAT_ERRNO;
-    } else {
-        bi->idx = 0;
+    if ( bi->truncated )
+        print_truncation_notice ( bi );
+    else
+        sink_putc ( bi->out, '\n' );
+}
 
-        if ( feof_stream ( bi->fp ) == 1 ) {
-            /* borderline case: the buffer has been filled, and the
-             * file has ended */
-            fnull ( & ( bi->fp ) );
-            return BUFSTAT_BORDR;
-        }
+/* print_coloured_block: properly format and print a coloured block of the `len`
+ * bytes of `str` to `out` according to the defined sequences in "colour.h". The
+ * fields are written as spans of `str`, between the escape sequences, the
+ * lengths of which are known at compile-time. This function assumes that the
+ * `sep{1,2}_idx` indexes have been properly located in `str` (see
+ * `line_index_record`), and will not lead to segfaults when being used to
+ * index into it. */
 
-        /* the buffer has been filled, and there is still more in the
-         * current file */
-        return BUFSTAT_FULL;
+static void print_coloured_block ( struct sink_t * out, const char * str,
+        size_t len, ptrdiff_t sep1_idx, ptrdiff_t sep2_idx )
+{
+    if ( sep1_idx > 0 ) {
+        /* category-package */
+        sink_literal ( out, HIGHLIGHT_PACKAGE );
+        sink_write ( out, str, sep1_idx );
+        sink_literal ( out, HIGHLIGHT_STD ":" HIGHLIGHT_USEFLAG );
+        sink_write ( out, & ( str [ sep1_idx + 1 ] ),
+                sep2_idx - sep1_idx - 1 );
+    } else {
+        /* global USE-flag */
+        sink_literal ( out, HIGHLIGHT_USEFLAG );
+        sink_write ( out, str, sep2_idx );
     }
+
+    sink_literal ( out, HIGHLIGHT_STD );
+    sink_write ( out, & ( str [ sep2_idx ] ), len - sep2_idx );
 }
 
-/* populate_buffer: assuming the buffer_info_t structure remains persistent and
- * unmodified by the caller, this function loads a file, provided by `path` into
- * the given buffer of LBUF_SZ. If the buffer is filled, BUFSTAT_FULL or
- * BUFSTAT_BORDR is returned, dependent upon the position of the file cursor; if
- * the file has filled the buffer perfectly, BUFSTAT_BORDR (borderline case) is
- * returned. If the buffer has not been filled due to a lack of bytes in the
- * file, BUFSTAT_MORE is returned, and the next call to this function should
- * contain a new path. If the file cannot be opened or read, BUFSTAT_ERRNO is
- * returned, and the caller must confer with errno. */
+/* print_coloured_result: print the `len` bytes of `result_str` to `bi->out`
+ * using the HIGHLIGHT_PACKAGE and HIGHLIGHT_USEFLAG colours, with the flag
+ * description being printed in HIGHLIGHT_STD, according to its `record`. If an
+ * entry is poorly formatted, it is silently skipped, unless it has been
+ * truncated before its description, in which case it is printed uncoloured. */
 
-static enum buffer_status_t populate_buffer ( struct buffer_info_t * bi )
+static void print_coloured_result ( const char * result_str, size_t len,
+        const struct record_t * record, struct buffer_info_t * bi )
 {
-    size_t bw = 0;
+    const ptrdiff_t sep1_idx = record->pkgflag, sep2_idx = record->flagdesc;
 
-    if ( ( bi->fp == NULL && ( bi->fp = fopen ( bi->path, "r" ) )
-                == NULL ) ) {
-        /* the file cannot be opened */
-        populate_info_buffer ( bi->path );
-        return BUFSTAT_ERRNO;
+    if ( sep2_idx <= 0 ) {
+        if ( bi->truncated )
+            print_uncoloured_output ( result_str, len, bi );
+
+        return; /* poorly formatted entry; skip */
     }
 
-    /* ensure the buffer is null-terminated */
-    bi->buffer [ LBUF_SZ - 1 ] = '\0';
-    bw = fread ( & ( bi->buffer [ bi->idx ] ), sizeof ( char ),
-            LBUF_SZ - 1 - bi->idx, bi->fp );
+    print_coloured_block ( bi->out, result_str, len, sep1_idx, sep2_idx );
 
-    return determine_buffer_nature ( bw, bi, bi->path );
+    if ( bi->truncated )
+        print_truncation_notice ( bi );
+    else
+        sink_putc ( bi->out, '\n' );
 }
 
-/* init_buffer_instance: initialise a buffer_info_t structure with default
- * values, allocating the large file buffer (LBUF_SZ). This function returns -1
- * on error (errno is set appropriately by malloc), or zero on success. */
+/* print_repo_field: print `field` of the details of a repository to `out`,
+ * followed by "::", in HIGHLIGHT_REPO unless ARG_NO_COLOUR is set. */
 
-static int init_buffer_instance ( struct buffer_info_t * bi )
+static void print_repo_field ( struct sink_t * out, const char * field )
 {
-    if ( ( bi->buffer = malloc ( sizeof ( char ) * LBUF_SZ ) )
-            == NULL ) {
-        populate_info_buffer ( "Large file buffer" );
-        return -1;
+    if ( CHK_ARG ( options, ARG_NO_COLOUR ) != 0 ) {
+        sink_puts ( out, field );
+        sink_literal ( out, "::" );
+        return;
     }
 
-    bi->fp = NULL;
-    bi->idx = 0;
-    bi->status = BUFSTAT_MORE;
-    bi->path = NULL;
-
-    return 0;
+    sink_literal ( out, HIGHLIGHT_REPO );
+    sink_puts ( out, field );
+    sink_literal ( out, HIGHLIGHT_STD "::" );
 }
 
-/* find_line_bounds: find the previous '\n', and the next '\n', and return an
- * accordingly null-terminated version of buffer_start, using substr_start as a
- * point of reference. `marker` is then set as the end of the current buffer, to
- * avoid getting stuck in an infinite loop (this should be reset by the relevant
- * caller(s) every time a new needle/search term is sought). This function
- * returns the start of the appropriately null-terminated line. If the entry is
- * poorly formatted, NULL is returned. */
-
-static char * find_line_bounds ( char * buffer_start, char * substr_start,
-        char ** marker )
-{
-    char tmp = '\0', * start = NULL, * end = NULL;
-    long key_idx = substr_start - buffer_start;
-
-    if ( key_idx != 0 ) {
-        /* This not is the first entry in the buffer. */
-        tmp = buffer_start [ key_idx ];
-        buffer_start [ key_idx ] = '\0';
-
-        if ( ( start = strrchr ( buffer_start, '\n' ) ) == NULL )
-            start = buffer_start;
-        else if ( * ( start++ ) == '\0' ) {
-            /* the entry illegitimate/poorly formatted */
-            buffer_start [ key_idx ] = tmp;
-            return NULL;
-        }
+/* field_t: a field of a result in a machine-readable format; a span of the
+ * entry, or of the details of its repository, file, or needle. A NULL `str`
+ * is an absent field, such as the package of a global flag. */
 
-        buffer_start [ key_idx ] = tmp;
-    } else
-        start = buffer_start;
+struct field_t {
+    const char * name, * str;
+    size_t len;
+};
 
-    end = strchr ( substr_start, '\n' );
-    *marker = end; /* marker is set to NULL if there's no closing newline */
+enum field_position_t {
+    FIELD_REPO, FIELD_LOCATION, FIELD_PACKAGE, FIELD_FLAG, FIELD_DESC,
+    FIELD_NEEDLE, FIELD_FILE, FIELD_COUNT
+};
 
-    if ( end != NULL )
-        /* A match appears at the end of one buffer, and continues in
-         * another, in which case the match can be classified by
-         * printers as "truncated". This might be a false-positive due
-         * to the file ending abruptly (no line feed/EOF), but that is
-         * incredibly rare and only causes a very slight output
-         * modification. */
-        substr_start [ end - substr_start ] = '\0';
+/* print_escaped: print the `len` bytes of `str` to `out`, replacing only the
+ * bytes which cannot appear in a field of the format `option_format`: for
+ * FORMAT_NDJSON, the quotation mark, reverse solidus, and control characters;
+ * for FORMAT_TSV, the tab, line feed, carriage return, and backslash. The
+ * spans between them are written directly from `str`. */
 
-    return start;
-}
+static void print_escaped ( struct sink_t * out, const char * str,
+        size_t len )
+{
+    static const char hex [ ] = "0123456789abcdef";
+    size_t start = 0;
 
-/* process_seamless_buffer: validate/parse and print from the start of the
- * seamless buffer to the first newline. If any of the sub-functions fail, the
- * appropriate warning is returned; WARNING_OK being returned on success. */
+    for ( size_t i = 0; i < len; i++ ) {
+        const unsigned char c = str [ i ];
+        char escape [ 6 ] = { '\\', ( char ) c, '0', '0', hex [ c >> 4 ],
+            hex [ c & 0x0F ] };
+        size_t escape_len = 2;
 
-static enum warning_t process_seamless_buffer ( struct buffer_info_t * bi,
-        char buffer [ SBUF_SZ ], long * pos )
-{
-    ptrdiff_t newline_idx = 0;
-    char * newline_pos = strchr ( buffer, '\n' );
+        if ( option_format == FORMAT_NDJSON ) {
+            if ( c >= 0x20 && c != '"' && c != '\\' )
+                continue;
 
-    if ( newline_pos == NULL )
-        /* No newline found. The warning for a failed fseek takes
-         * precedence over the absence of a newline. */
-        return ( fseek ( bi->fp, *pos, SEEK_SET ) == -1 ) ?
-            WARNING_ERRNO : WARNING_NONWL;
+            if ( c < 0x20 ) {
+                escape [ 1 ] = 'u';
+                escape_len = 6;
+            }
+        } else {
+            if ( c != '\t' && c != '\n' && c != '\r' && c != '\\' )
+                continue;
 
-    *pos += ( newline_idx = newline_pos - buffer );
+            escape [ 1 ] = ( c == '\t' ) ? 't' : ( c == '\n' ) ? 'n' :
+                ( c == '\r' ) ? 'r' : '\\';
+        }
 
-    if ( errno != 0 || fseek ( bi->fp, *pos, SEEK_SET ) == -1 )
-        /* an error occurred with the buffer-collation or the
-         * position-reversal (fseek to `pos`). */
-        return WARNING_ERRNO;
+        sink_write ( out, & ( str [ start ] ), i - start );
+        sink_write ( out, escape, escape_len );
+        start = i + 1;
+    }
 
-    /* This buffer is temporary; it will be thrown away by the caller. Thus,
-     * adding this arbitrary NULL-terminator is perfectly safe. */
-    buffer [ newline_idx ] = '\0';
-    return WARNING_OK;
+    sink_write ( out, & ( str [ start ] ), len - start );
 }
 
-/* get_seamless_buffer: give the illusion of a seamless buffer, by allocating a
- * relatively small buffer (SBUF_SZ) to accommodate from the current position to
- * the end of the line, should that line appear in a subsequent buffer. This
- * function places the file cursor of `bi->fp` to the point after the newline,
- * to avoid double-searching. If, for any reason, the next line cannot be read
- * and parsed, a non-OK warning code is returned, and the information buffer is
- * populated accordingly. On success, the appropriate contents are placed in
- * `buffer` and WARNING_OK is returned. */
+/* print_fields: print the `fields` of a single result to `out` in the format
+ * `option_format`: a JSON object on a line, with null for absent fields, and
+ * "truncated" set if `truncated` is; the fields on a line, separated by tabs;
+ * or every field terminated by a null byte, with absent fields empty. */
 
-static enum warning_t get_seamless_buffer ( char buffer [ SBUF_SZ ],
-        struct buffer_info_t * bi ) 
+static void print_fields ( struct sink_t * out, const struct field_t * fields,
+        int truncated )
 {
-    enum warning_t warn_status = WARNING_OK;
-    long pos = 0;
+    for ( int i = 0; i < FIELD_COUNT; i++ ) {
+        const struct field_t * field = & ( fields [ i ] );
 
-    errno = 0;
+        switch ( option_format ) {
+            case FORMAT_NDJSON:
+                sink_puts ( out, ( i == 0 ) ? "{\"" : ",\"" );
+                sink_puts ( out, field->name );
+                sink_literal ( out, "\":" );
 
-    /* (Attempt to) take the current position of the file, so it can be
-     * reverted after the `fread`. This allows `populate_buffer` to
-     * correctly read in the next buffer. To prevent researching the
-     * remainder of the buffer, the position should be incremented to the
-     * immediate character after the located newline, as a double-match in a
-     * line would lead to the same line being printed twice. */
+                if ( field->str == NULL ) {
+                    sink_literal ( out, "null" );
+                    break;
+                }
 
-    if ( bi->fp == NULL ) {
-        /* This case should not be silently skipped, as the truncation
-         * flag was a false-positive (the bufferer closed the file due
-         * to hitting the end, but the file wasn't properly EOF-
-         * terminated). */
-        populate_info_buffer ( bi->path );
-        return WARNING_NOEOF;
+                sink_putc ( out, '"' );
+                print_escaped ( out, field->str, field->len );
+                sink_putc ( out, '"' );
+                break;
+            case FORMAT_TSV:
+                if ( i > 0 )
+                    sink_putc ( out, '\t' );
+
+                if ( field->str != NULL )
+                    print_escaped ( out, field->str, field->len );
+                break;
+            default:
+                if ( field->str != NULL )
+                    sink_write ( out, field->str, field->len );
+
+                sink_putc ( out, '\0' );
+                break;
+        }
     }
 
-    if ( ( pos = ftell ( bi->fp ) ) == -1 ) {
-        populate_info_buffer ( bi->path );
-        return WARNING_ERRNO;
+    if ( option_format == FORMAT_NDJSON )
+        sink_puts ( out, truncated ? ",\"truncated\":true}\n" : "}\n" );
+    else if ( option_format == FORMAT_TSV )
+        sink_putc ( out, '\n' );
+}
+
+/* print_structured_result: print the `len` bytes of `result_str`, with the
+ * fields `record`, from the repo `repo`, found with `needle` in `bi->path`, to
+ * `bi->out` in the machine-readable format `option_format`; see
+ * `print_fields`. Every field is written from where it already lies, without
+ * being copied beforehand. Poorly formatted entries have no flag, so are
+ * skipped. */
+
+static void print_structured_result ( const char * result_str, size_t len,
+        const struct record_t * record, struct repo_t * repo,
+        const char * needle, struct buffer_info_t * bi )
+{
+    const ptrdiff_t pkgflag = record->pkgflag, flagdesc = record->flagdesc;
+    const size_t flag = ( pkgflag > 0 ) ? pkgflag + 1 : 0,
+          desc = flagdesc + 3; /* " - " */
+    struct field_t fields [ FIELD_COUNT ] = {
+        [ FIELD_REPO ] = { "repo", repo->name, strlen ( repo->name ) },
+        [ FIELD_LOCATION ] = { "location", repo->location,
+            strlen ( repo->location ) },
+        [ FIELD_PACKAGE ] = { "package", NULL, 0 },
+        [ FIELD_FLAG ] = { "flag", & ( result_str [ flag ] ),
+            flagdesc - flag },
+        [ FIELD_DESC ] = { "description", & ( result_str [ desc ] ),
+            ( desc < len ) ? len - desc : 0 },
+        [ FIELD_NEEDLE ] = { "needle", needle, strlen ( needle ) },
+        [ FIELD_FILE ] = { "file", bi->path, strlen ( bi->path ) }
+    };
+
+    if ( flagdesc <= 0 )
+        return; /* poorly formatted entry; skip */
+
+    if ( pkgflag > 0 ) {
+        fields [ FIELD_PACKAGE ].str = result_str;
+        fields [ FIELD_PACKAGE ].len = pkgflag;
     }
 
-    fread ( buffer, sizeof ( char ), SBUF_SZ - 1, bi->fp );
+    print_fields ( bi->out, fields, bi->truncated );
 
-    if ( ( warn_status = process_seamless_buffer ( bi, buffer, &pos ) )
-            != WARNING_OK ) {
+    if ( bi->truncated && CHK_ARG ( options, ARG_NO_MIDBUF_WARN ) == 0 ) {
         populate_info_buffer ( bi->path );
-        return warn_status;
+        print_warning ( WARNING_TRUNC, &provide_gen_warning );
     }
-
-    return WARNING_OK;
 }
 
-/* print_uncoloured_output: print the `result_str` uncoloured to stdout. If the
- * buffer has been truncated, `get_seamless_buffer` is used to pick up the rest
- * of the line. */
+/* print_search_result: print a search result, the `len` bytes of `result_str`,
+ * with the fields `record`, from the repo `repo`, to `bi->out`, respecting the
+ * ARG_PRINT_REPO_PATHS and ARG_PRINT_REPO_NAMES command-line arguments. If
+ * `bi->truncated` is set (the entry exceeded the streamed buffer), " [...]" is
+ * printed to indicate the truncation. Machine-readable formats are printed by
+ * `print_structured_result` instead. */
 
-static void print_uncoloured_output ( char * result_str,
+static void print_search_result ( const char * result_str, size_t len,
+        const struct record_t * record, struct repo_t * repo, char * needle,
         struct buffer_info_t * bi )
 {
-    if ( ! ( bi->truncated ) ) {
-        puts ( result_str );
+    if ( option_format != FORMAT_TEXT ) {
+        print_structured_result ( result_str, len, record, repo, needle,
+                bi );
         return;
     }
 
-    /* The buffer has been truncated. Declaring variables here is rather
-     * poor practice, however needlessly expanding the stack by SBUF_SZ for
-     * 99% of matches would also be poor practice. */
-    char extra_buffer [ SBUF_SZ ];
-    enum warning_t warn_status = WARNING_OK;
+    if ( CHK_ARG ( options, ARG_PRINT_NEEDLE ) != 0 ) {
+        /* `needle` should probably be the original search string; not
+         * modified by `construct_query`. */
+        sink_putc ( bi->out, '(' );
+        sink_puts ( bi->out, needle );
+        sink_literal ( bi->out, ") " );
+    }
 
-    fputs ( result_str, stdout );
+    if ( CHK_ARG ( options, ARG_PRINT_REPO_PATHS ) != 0 ) {
+        /* ARG_PRINT_REPO_PATHS implies ARG_PRINT_REPO_NAMES */
+        print_repo_field ( bi->out, repo->location );
+        print_repo_field ( bi->out, repo->name );
+    } else if ( CHK_ARG ( options, ARG_PRINT_REPO_NAMES ) != 0 )
+        print_repo_field ( bi->out, repo->name );
 
-    if ( ( warn_status = get_seamless_buffer ( extra_buffer, bi ) )
-            == WARNING_OK )
-        /* If a warning has been issued by `print_warning`, there is no
-         * need to add an additional newline. */
-        puts ( extra_buffer );
-    else {
-        puts ( " [...]" );
-        if ( CHK_ARG ( options, ARG_NO_MIDBUF_WARN ) == 0 )
-            print_warning ( warn_status, &provide_gen_warning );
-    }
+    if ( CHK_ARG ( options, ARG_NO_COLOUR ) )
+        print_uncoloured_output ( result_str, len, bi );
+    else
+        print_coloured_result ( result_str, len, record, bi );
 }
 
-/* correct_transbuffer_indexes: if the previous indexes of colour-changing
- * delimiters are infeasible, this function searches for them in the read-ahead
- * buffer, `buffer`, and sets the indexes and their respective corresponding
- * buffers. If the entry is poorly formatted, -1 is returned; zero is returned
- * on success. */
+/* verify_strict_compliance: assuming `ARG_SEARCH_STRICT` is set, this function
+ * determines whether a match `idx` bytes into its line, with the fields
+ * `record`, begins in the flag field, returning zero if it does, and -1
+ * otherwise. */
 
-static int correct_transbuffer_indexes ( const char * buffer,
-        ptrdiff_t * sep1_idx, ptrdiff_t * sep2_idx, char ** idx1_buf,
-        char ** idx2_buf )
+static inline int verify_strict_compliance ( ptrdiff_t idx,
+        const struct record_t * record )
 {
-    /* If either of the indexes present with values suggesting an
-     * unaddressable location, they do not exist in the primary buffer, but
-     * may exist in the secondary. Thus, check there. The secondary buffer
-     * is always NULL-terminated, so a return value of NULL definitively
-     * states that the delimiter does not exist on the line. */
+    return ( ( record->pkgflag <= 0 || idx > record->pkgflag ) &&
+            idx < record->flagdesc ) ? 0 : -1;
+}
 
-    if ( *sep1_idx <= 0 || *sep1_idx >= BUFFER_SZ ) {
-        *sep1_idx = strchr ( buffer, ':' ) - buffer;
-        *idx1_buf = ( char * ) buffer;
-    }
+/* next_hit: return the next match of the current needle in the hit list which
+ * begins at or after `resume`, advancing the cursor `idx` past it, or NULL if
+ * the needle has no further matches in the buffer. The search in the buffer
+ * resumes at the end of the previous matching line, so any remaining hits on
+ * that line are skipped. */
 
-    if ( *sep2_idx <= 0 || *sep2_idx >= BUFFER_SZ ) {
-        *sep2_idx = strstr ( buffer, " - " ) - buffer;
-        *idx2_buf = ( char * ) buffer;
-    }
+static inline char * next_hit ( const struct hit_list_t * hits, size_t * idx,
+        size_t end, char * buffer_start, const char * resume )
+{
+    for ( ; *idx < end; ( *idx )++ )
+        if ( buffer_start + hits->offsets [ *idx ] >= resume )
+            return buffer_start + hits->offsets [ ( *idx )++ ];
 
-    return ( *sep2_idx <= 0 ) ? -1 : 0; /* poorly formatted entry ? */
+    return NULL;
 }
 
-/* print_coloured_block: properly format and print a coloured block, which could
- * be transbuffer, according to the defined sequences in "colour.h". This
- * function assumes that the `sep{1,2}_idx` indexes have been properly
- * normalised, and will not lead to segfaults when being used to index into
- * their respective buffers. */
+/* is_printable: return non-zero if the entry of `record` would be printed in
+ * the current format: poorly formatted entries, without a flag field, are only
+ * printed as they are, uncoloured (see `print_search_result`). */
 
-static void print_coloured_block ( char * primary_buffer, char * idx1_buf,
-        ptrdiff_t sep1_idx, char * idx2_buf, ptrdiff_t sep2_idx )
+static int is_printable ( const struct record_t * record,
+        const struct buffer_info_t * bi )
 {
-    idx2_buf [ sep2_idx ] = '\0';
-
-    if ( sep1_idx > 0 ) {
-        /* category-package */
-        fputs ( HIGHLIGHT_PACKAGE, stdout );
-        if ( idx1_buf != primary_buffer )
-            fputs ( primary_buffer, stdout );
-        idx1_buf [ sep1_idx ] = '\0';
-        fputs ( idx1_buf, stdout );
-        fputs ( HIGHLIGHT_STD ":" HIGHLIGHT_USEFLAG, stdout );
-        fputs ( & ( idx1_buf [ sep1_idx + 1 ] ), stdout );
-    } else {
-        /* global USE-flag */
-        fputs ( HIGHLIGHT_USEFLAG, stdout );
-        fputs ( idx1_buf, stdout );
-    }
+    if ( record->flagdesc > 0 )
+        return 1;
 
-    fputs ( HIGHLIGHT_STD, stdout );
-    idx2_buf [ sep2_idx ] = ' ';
-    fputs ( & ( idx2_buf [ sep2_idx ] ), stdout );
+    return option_format == FORMAT_TEXT && ( bi->truncated ||
+            CHK_ARG ( options, ARG_NO_COLOUR ) != 0 );
 }
 
-/* print_coloured_transbuffer_result: print a match in colour from a truncated
- * buffer. This function rectifies nonsensical indexes, by normalising them to
- * the secondary read-ahead buffer (c.f. `correct_transbuffer_indexes`). */
+/* report_result: report a result, the `len` bytes of `result_str`, according
+ * to the result mode (see ARG_RESULT_MODES): with ARG_FILES_MATCH, the path of
+ * the file is printed, terminated as the format requires; with ARG_COUNT and
+ * ARG_EXISTS, nothing is printed, as only `bi->results` is of interest; and
+ * otherwise, the result is printed by `print_search_result`. Entries which
+ * would not be printed are not results. Returns 1 if the search of the current
+ * file should stop, or zero if it should continue. */
 
-static void print_coloured_transbuffer_result ( char * result_str,
-        struct buffer_info_t * bi, ptrdiff_t sep1_idx,
-        ptrdiff_t sep2_idx )
+static int report_result ( const char * result_str, size_t len,
+        const struct record_t * record, struct repo_t * repo, char * needle,
+        struct buffer_info_t * bi )
 {
-    enum warning_t warn_status = WARNING_OK;
-    char extra_buffer [ SBUF_SZ ], * idx1_buf = result_str,
-     * idx2_buf = result_str;
+    if ( !is_printable ( record, bi ) )
+        return 0;
 
-    if ( ( warn_status = get_seamless_buffer ( extra_buffer, bi ) )
-            != WARNING_OK ) {
-        /* If the seamless buffer cannot be retrieved for some reason,
-         * just print the match from the primary buffer without
-         * colouring. */
-        fputs ( result_str, stdout );
-        puts ( " [...]" );
-        if ( CHK_ARG ( options, ARG_NO_MIDBUF_WARN ) == 0 )
-            print_warning ( warn_status, &provide_gen_warning );
+    bi->results++;
 
-        return;
+    if ( CHK_ARG ( options, ARG_FILES_MATCH ) != 0 ) {
+        stats_count ( STAT_LINES, 1 );
+        sink_puts ( bi->out, bi->path );
+        sink_putc ( bi->out, ( option_format == FORMAT_NULL ) ? '\0' :
+                '\n' );
+        return 1;
     }
 
-    if ( correct_transbuffer_indexes ( extra_buffer, &sep1_idx, &sep2_idx,
-                &idx1_buf, &idx2_buf ) == -1 )
-        return;
+    if ( CHK_ARG ( options, ( ARG_COUNT | ARG_EXISTS ) ) == 0 ) {
+        const enum stats_phase_t phase = stats_phase ( PHASE_PRINT );
 
-    print_coloured_block ( result_str, idx1_buf, sep1_idx, idx2_buf,
-            sep2_idx );
+        print_search_result ( result_str, len, record, repo, needle, bi );
+        stats_count ( STAT_LINES, 1 );
+        stats_phase ( phase );
+    }
 
-    if ( idx1_buf == result_str && idx2_buf == result_str )
-        /* finish printing the description */
-        puts ( extra_buffer );
-    else
-        putchar ( '\n' );
+    return ( CHK_ARG ( options, ARG_EXISTS ) != 0 || ( option_max_count > 0
+                && bi->results >= option_max_count ) ) ? 1 : 0;
 }
 
-/* locate_field_delims: find the index of the two field-delimiters in `str`,
- * placing the index of the package-flag separator and flag-description
- * separator in `pkg_flag` and `flagdesc` respectively. */
+/* output_failed: return non-zero, with errno and the information buffer set,
+ * if the results could no longer be written to `bi->out`. */
 
-static inline void locate_field_delims ( char * str, ptrdiff_t * pkgflag,
-        ptrdiff_t * flagdesc )
+static int output_failed ( const struct buffer_info_t * bi )
 {
-    ptrdiff_t tmp;
-    *flagdesc = strstr ( str, " - " ) - str;
-
-    if ( ( tmp = strchr ( str, ':' ) - str ) < *flagdesc )
-        /* Ensure the package-flag delimiter precedes the
-         * flag-description delimiter. */
-        *pkgflag = tmp;
+    if ( bi->out->error == 0 )
+        return 0;
 
-    /* strstr, on most libc implementations, is extremely fast for short
-     * needles (usually a maximum of three characters). Only when the needle
-     * exceeds 256 characters is the standard two-way algorithm used, and
-     * even that uses a shift table. */
+    errno = bi->out->error;
+    populate_info_buffer ( "Output stream" );
+    return 1;
 }
 
-/* print_coloured_result: print `result_str` to stdout using the
- * HIGHLIGHT_PACKAGE and HIGHLIGHT_USEFLAG colours, with the flag description
- * being printed in HIGHLIGHT_STD. If an entry is poorly formatted, it is
- * silently skipped. */
+/* note_long_line: with the streamed window `buffer` of `bi` lying within, or
+ * ending, a line too long for the buffer (see long_line_t), note each of the
+ * `ncount` needles with a match in that line, among the `hits`, in
+ * `bi->long_hits`, so it is reported once, when the line has ended; see
+ * `report_long_line`. The record of the line is that of its first window.
+ * Returns zero on success, or -1 if `bi->long_hits` could not grow, in which
+ * case errno and the information buffer are set. */
 
-static void print_coloured_result ( char * result_str,
-        struct buffer_info_t * bi )
+static int note_long_line ( char * buffer, int ncount,
+        const struct hit_list_t * hits, struct buffer_info_t * bi )
 {
-    ptrdiff_t sep1_idx = -1, sep2_idx = -1;
-    locate_field_delims ( result_str, &sep1_idx, &sep2_idx );
+    /* the line ends at the first line feed of its last window */
+    const size_t end = ( bi->long_line == LONG_END ) ?
+        bi->lines.newlines [ 0 ] : ( size_t ) -1;
+    const int strict = CHK_ARG ( options, ARG_SEARCH_STRICT ) != 0;
+    unsigned char * long_hits = NULL;
+
+    if ( bi->long_line == LONG_BEGIN ) {
+        if ( bi->long_hits_len < ncount ) {
+            if ( ( long_hits = realloc ( bi->long_hits, ncount ) ) == NULL ) {
+                populate_info_buffer ( bi->path );
+                return -1;
+            }
 
-    if ( bi->truncated ) {
-        print_coloured_transbuffer_result ( result_str, bi, sep1_idx,
-                sep2_idx );
-        return;
+            bi->long_hits = long_hits;
+            bi->long_hits_len = ncount;
+        }
+
+        memset ( bi->long_hits, 0, ncount );
+        bi->long_record = *line_index_record ( & ( bi->lines ), 0, buffer );
     }
 
-    if ( sep2_idx <= 0 )
-        return; /* poorly formatted entry; skip */
+    if ( bi->buffer [ 0 ] == LINE_COMMENT )
+        return 0; /* comments are not entries */
+
+    for ( int i = 0; i < ncount; i++ )
+        for ( size_t h = hits->first [ i ]; !bi->long_hits [ i ] &&
+                h < hits->first [ i + 1 ] && hits->offsets [ h ] < end; h++ )
+            bi->long_hits [ i ] = !strict || verify_strict_compliance (
+                    bi->line_offset + hits->offsets [ h ],
+                    & ( bi->long_record ) ) == 0;
 
-    /* In single-buffer mode, both indexes regard the primary buffer. */
-    print_coloured_block ( result_str, result_str, sep1_idx, result_str,
-            sep2_idx );
-    putchar ( '\n' );
+    return 0;
 }
 
-/* print_search_result: print a search result, `result_str`, from the repo
- * `repo`, to stdout, respecting the ARG_PRINT_REPO_PATHS and
- * ARG_PRINT_REPO_NAMES command-line arguments. If `bi->truncated` is set (the
- * result continues in another buffer), a temporary SBUF_SZ buffer is allocated
- * on the stack to print the rest of the line (up until the next '\n'). If this
- * fails for any reason, " [...]" is printed to indicate a truncation. See
- * `get_seamless_buffer` for more information. */
+/* report_long_line: report the line too long for the streamed buffer which has
+ * ended in the current window, if the needle `i` of `needles` matched it (see
+ * `note_long_line`). Only its kept start is printed, truncated; any field not
+ * wholly within it is not. Returns as `report_result`. */
 
-static void print_search_result ( char * result_str, struct repo_t * repo,
-        char * needle, struct buffer_info_t * bi )
+static int report_long_line ( int i, char ** needles, struct repo_t * repo,
+        struct buffer_info_t * bi )
 {
-    if ( CHK_ARG ( options, ARG_PRINT_NEEDLE ) != 0 )
-        /* `needle` should probably be the original search string; not
-         * modified by `construct_query`. */
-        printf ( "(%s) ", needle );
+    struct record_t record = bi->long_record;
 
-    if ( CHK_ARG ( options, ARG_PRINT_REPO_PATHS ) != 0 )
-        /* ARG_PRINT_REPO_PATHS implies ARG_PRINT_REPO_NAMES */
-        printf ( ( CHK_ARG ( options, ARG_NO_COLOUR ) ) ?
-                "%s::%s::" : HIGHLIGHT_REPO "%s" HIGHLIGHT_STD
-                "::" HIGHLIGHT_REPO "%s" HIGHLIGHT_STD "::",
-                repo->location, repo->name );
-    else if ( CHK_ARG ( options, ARG_PRINT_REPO_NAMES ) != 0 )
-        printf ( ( CHK_ARG ( options, ARG_NO_COLOUR ) ) ? "%s::" :
-                HIGHLIGHT_REPO "%s" HIGHLIGHT_STD "::",
-                repo->name );
+    if ( !bi->long_hits [ i ] )
+        return 0;
 
-    if ( CHK_ARG ( options, ARG_NO_COLOUR ) )
-        print_uncoloured_output ( result_str, bi );
-    else
-        print_coloured_result ( result_str, bi );
+    if ( record.flagdesc + 3 > ( ptrdiff_t ) bi->head ) {
+        /* the description begins beyond the kept start */
+        record.pkgflag = record.flagdesc = -1;
+    }
+
+    bi->truncated = 1;
+    return report_result ( bi->buffer, bi->head, &record, repo,
+            needles [ i ], bi );
 }
 
-/* verify_strict_compliance: assuming `ARG_SEARCH_STRICT` is set, this function
- * determines whether `mt_start` begins in the flag field, returning zero if it
- * does, and -1 otherwise. */
+/* scan_buffer: search the `len` bytes at `buffer`, which need not be
+ * null-terminated (see `automaton_scan`), for the provided `needles`, of which
+ * there are `ncount`. All needles are located by `automaton_scan` with the
+ * engine of `ac` before any is printed; the results are then printed grouped by
+ * needle, in the order in which the needles were given. The results of each
+ * needle form a section of the output (see `pool_section`), so those of the
+ * chunks of a file can be merged into the same order as if the file were
+ * searched whole. A streamed window within a line too long for the buffer has
+ * its matches noted, and that line reported once it has ended; see
+ * `note_long_line`. `buffer` is only read. It returns zero on success, 1 if the
+ * search of the file should stop early (see `report_result`), or -1 if the hit
+ * list could not be extended, or the results could not be written to `bi->out`
+ * (such as when the reader of a pipe has gone), in which case errno is set
+ * appropriately. */
 
-static inline int verify_strict_compliance ( char * ln_start, char * mt_start )
+static int scan_buffer ( char * buffer, size_t len, char ** needles,
+        int ncount, const struct automaton_t * ac, struct hit_list_t * hits,
+        struct repo_t * repo, struct buffer_info_t * bi )
 {
-    ptrdiff_t pkgflag = -1, flagdesc = -1, idx = mt_start - ln_start;
+    /* ln_start: start of the matching line; mt_start: start of the match */
+    char * ln_start = NULL, * buffer_start = buffer, * mt_start = NULL;
+    const struct record_t * record = NULL;
+    int stop = 0;
 
-    locate_field_delims ( ln_start, &pkgflag, &flagdesc );
-    return ( ( pkgflag <= 0 || idx > pkgflag ) && idx < flagdesc ) ? 0 : -1;
-}
+    if ( automaton_scan ( ac, buffer, len, hits ) == -1 ) {
+        populate_info_buffer ( bi->path );
+        return -1;
+    }
 
-/* search_buffer: search the `buffer` for the provided `needles`, of which there
- * are `ncount`. This function searches and prints the results as soon as they
- * are found, and, providing uninterrupted execution, exits with `buffer`
- * unchanged. */
+    stats_count ( STAT_MATCHES, hits->first [ ncount ] );
 
-static void search_buffer ( char buffer [ LBUF_SZ ], char ** needles,
-        int ncount, struct repo_t * repo, struct buffer_info_t * bi )
-{
-    /* ln_start: start of the matching line; mt_start: start of the match */
-    char * ln_start = NULL, * buffer_start = buffer, * mt_start = NULL,
-        * ( * searcher ) ( const char *, const char * ) =
-            ( CHK_ARG ( options, ARG_SEARCH_NO_CASE ) != 0 ) ?
-            &strcasestr : &strstr;
+    if ( bi->long_line != LONG_NONE && note_long_line ( buffer, ncount, hits,
+                bi ) == -1 )
+        return -1;
 
     for ( int i = 0; i < ncount; i++ ) {
+        size_t hit_idx = hits->first [ i ];
         buffer = buffer_start;
 
-        if ( needles [ i ] [ 0 ] == '\0' )
-            /* Ignore entries consisting of erroneous or empty
-             * needles. */
+        if ( bi->long_line == LONG_BEGIN || bi->long_line == LONG_MIDDLE ) {
+            /* nothing is reported until the line has ended */
+            pool_section ( bi->out );
             continue;
+        }
+
+        if ( bi->long_line == LONG_END ) {
+            /* The line began before the window, so is reported first;
+             * the search resumes after it. */
+            buffer = & ( buffer_start [ bi->lines.newlines [ 0 ] + 1 ] );
+            stop = report_long_line ( i, needles, repo, bi );
+
+            if ( output_failed ( bi ) )
+                return -1;
+
+            if ( stop )
+                return 1; /* see `report_result` */
+        }
 
-        while ( ( mt_start = searcher ( buffer, needles [ i ] ) )
+        /* Entries consisting of erroneous or empty needles never appear
+         * in the hit list. */
+        while ( ( mt_start = next_hit ( hits, &hit_idx,
+                        hits->first [ i + 1 ], buffer_start, buffer ) )
                 != NULL ) {
-            if ( ( ln_start = find_line_bounds ( buffer, mt_start,
-                            &buffer ) ) == NULL
-                    || *ln_start == LINE_COMMENT )
-                break;
+            if ( * ( ln_start = find_line_bounds ( buffer_start,
+                                mt_start, &buffer, & ( bi->lines ),
+                                &record ) ) == LINE_COMMENT ) {
+                /* Comments are not entries; skip to the next line. */
+                if ( buffer == NULL )
+                    break;
+
+                continue;
+            }
 
             if ( CHK_ARG ( options, ARG_SEARCH_STRICT ) != 0
-                    && verify_strict_compliance ( ln_start,
-                        mt_start ) == -1 ) {
+                    && verify_strict_compliance ( mt_start - ln_start,
+                        record ) == -1 ) {
                 if ( buffer == NULL )
                     break;
 
-                mt_start [ buffer - mt_start ] = '\n';
                 continue;
             }
 
             bi->truncated = ( buffer == NULL );
-            print_search_result ( ln_start, repo,
-                    needles [ i ], bi );
+            stop = report_result ( ln_start, ( buffer == NULL ) ?
+                    strlen ( ln_start ) : ( size_t ) ( buffer -
+                        ln_start ), record, repo, needles [ i ], bi );
+
+            if ( output_failed ( bi ) )
+                return -1; /* stop as soon as the output has failed */
+
+            if ( stop )
+                return 1; /* see `report_result` */
+
             if ( buffer == NULL )
                 break; /* end of buffer; see `marker` */
-
-            /* undo the change made by `find_line_bounds` */
-            mt_start [ buffer - mt_start ] = '\n';
         }
+
+        pool_section ( bi->out );
     }
+
+    return 0;
 }
 
-/* get_next_file: if the glob_buf has a path beyond gl_pathv [ *idx ], this
- * function returns a pointer to the relevant string, and the given index is
- * incremented. If no such path exists, NULL is returned. */
+/* search_buffer: a single pass of the searcher over a buffer, traced as such
+ * (see ARG_TRACE); see `scan_buffer`, as which it returns. */
 
-static inline char * get_next_file ( glob_t * glob_buf, size_t * idx )
+static int search_buffer ( char * buffer, size_t len, char ** needles,
+        int ncount, const struct automaton_t * ac, struct hit_list_t * hits,
+        struct repo_t * repo, struct buffer_info_t * bi )
 {
-    return ( *idx >= glob_buf->gl_pathc ) ? NULL :
-        glob_buf->gl_pathv [ ( *idx )++ ];
+    const unsigned long long start = trace_now ( );
+    int status = 0;
+
+    trace_probe ( search__start, bi->path, len );
+    status = scan_buffer ( buffer, len, needles, ncount, ac, hits, repo,
+            bi );
+    trace_probe ( search__done, bi->path, status );
+    trace_span ( "search", "search", start, bi->path, "matches",
+            hits->first [ ncount ] );
+    return status;
 }
 
-/* process_glob_list: given a populated glob_t structure, this function searches
- * all files specified in `gl_pathv` for each of the `needles`, of which there
- * should be `ncount`. The `repo` also enables increased verbosity by the
- * printing functions, should it have been requested at the command-line. `bi`
- * is a persistent buffer held by the caller; it is the responsibility of the
- * caller to free `glob_buf` and `repo`, as they are statically allocated. On
- * success, this function returns zero, or -1 on failure. In the latter event,
- * STATUS_ERRNO should be assumed. The information buffer is populated
- * appropriately. */
+#ifndef CHUNK_SZ
+/* Files larger than this are split into chunks of (roughly) this size, so the
+ * largest files do not leave all but one worker idle. */
+#define CHUNK_SZ ( 65536 )
+#endif /* CHUNK_SZ */
+
+/* search_task_t: a single USE-description file to be searched: either its
+ * entries in the index or its mapping (`text`, of `len` bytes), or, if `text`
+ * is NULL, the file itself at `path`, opened as `name` relative to `dir` (see
+ * `glob_entry_t`). `repo` is the repository to which it belongs. If the file
+ * has been split, `text` is only a chunk of whole lines, and `joins` is set
+ * for every chunk but the first. */
+
+struct search_task_t {
+    char * path, * text;
+    const char * name;
+    int dir;
+    size_t len;
+    struct repo_t * repo;
+    int joins;
+};
 
-static int process_glob_list ( struct buffer_info_t * bi, glob_t * glob_buf,
-        char ** needles, int ncount, struct repo_t * repo )
-{
-    size_t file_idx = 0;
+/* search_plan_t: the files to be searched, as tasks, in the order in which
+ * their results are printed. Once made, a plan is only read, so it may be
+ * searched by any number of runs (see `search_run_t`), even at once. A plan
+ * made for a batch or a daemon (see ARG_BATCH and ARG_DAEMON) is searched once
+ * per query: it has a task for every file, whatever the options, so `select`
+ * is set, and each task is only searched if it is selected by the options of
+ * the query (see `glob_selects`); and `resident` is set, so every file is
+ * mapped in advance, and read only once. A plan which may be kept long after
+ * it was made, that of a snapshot (see `snapshot_t`), has `lasting` set, and
+ * its files are loaded, rather than mapped; see `make_resident`. */
+
+struct search_plan_t {
+    struct search_task_t * tasks;
+    size_t count, capacity, chunk_sz; /* chunk_sz: zero if not splitting */
+    struct glob_list_t * globs; /* per repository, if searched directly */
+    struct resident_t ** maps; /* files mapped in advance; see plan_map */
+    size_t map_count;
+    int select, resident, lasting;
+    int opens; /* some task has no `text`, so its file is opened */
+    struct uring_block_t * loads; /* files loaded up front; see plan_load */
+    const struct search_plan_t * previous; /* see `prepare_search` */
+    size_t cursor; /* the map of `previous` after that last shared */
+};
 
-    for ( ; ; ) {
-        /* attempt to get the next file */
-        if ( ( bi->status == BUFSTAT_BORDR
-                || bi->status == BUFSTAT_MORE ) &&
-                ( ( bi->path = get_next_file ( glob_buf,
-                                &file_idx ) )
-                  == NULL ) )
-            break; /* exhausted; next repo */
+/* resident_t: a file mapped in advance by a plan (see `plan_map`), with the
+ * `stamp` it had when it was mapped. The plan which replaces that of a daemon
+ * (see `serve_t`) shares the files which are unchanged, so each counts the
+ * plans holding it in `refs`, and is released by the last; the plans may be
+ * freed by different threads, so the count is atomic. */
+
+struct resident_t {
+    struct buffer_info_t file;
+    struct index_stamp_t stamp;
+    atomic_uint refs;
+    char path [ ]; /* that of `file` */
+};
 
-        switch ( bi->status = populate_buffer ( bi ) ) {
-            case BUFSTAT_ERRNO:
-                return -1;
-            case BUFSTAT_BORDR:
-            case BUFSTAT_MORE:
-                break;
-            case BUFSTAT_FULL:
-                search_buffer ( bi->buffer, needles,
-                        ncount, repo, bi );
-                break;
-        }
-    }
+/* prefetch_state_t: the state of the prefetch of a single task; see
+ * `prefetch_t`. */
 
-    if ( bi->status != BUFSTAT_FULL )
-        /* BUFSTAT_FULL: buffer already searched */
-        search_buffer ( bi->buffer, needles, ncount, repo, bi );
+enum prefetch_state_t {
+    PREFETCH_NONE  = 0, /* not prefetched (yet) */
+    PREFETCH_BUSY  = 1, /* being opened by the worker prefetching it */
+    PREFETCH_READY = 2, /* open in `src`, for the worker searching the task */
+    PREFETCH_TAKEN = 3  /* the task has begun; too late to prefetch it */
+};
 
-    return 0;
-}
+/* prefetch_t: the file of a task, opened in advance by `prefetch_task`, so it
+ * is read by the kernel while the tasks before it are searched. The `state` is
+ * only changed atomically, so neither the task nor its prefetch ever waits for
+ * the other: whichever is late gives way. */
 
-/* search_files: search the profiles / *.desc files in the repo `location`
- * directory to find any of the given needles. Once a repository's files have
- * been completely scanned, it is popped from the stack and freed. This function
- * manages the buffering and searching of the files in a recursive (call-stack)
- * manner, and passes errors down the chain to the caller; all errors are
- * reduced to be of the type status_t, allowing for the safe use of
- * provide_gen_error. All sub-functions populate the global information buffer
- * when appropriate. */
+struct prefetch_t {
+    atomic_int state;
+    struct source_t src;
+};
 
-static enum status_t search_files ( struct repo_stack_t * stack,
-        char ** needles, int ncount )
-{
-    struct repo_t * repo = NULL;
-    struct buffer_info_t bi;
-    glob_t glob_buf = { .gl_pathc = 0 };
+/* search_run_t: the state shared, read-only, by every worker searching the
+ * `plan` for a single query: the compiled needles, and the per-thread options
+ * of the thread running the query, which each worker takes for its own (see
+ * `options`). The exceptions are `results`, in which each task has the number
+ * of its results, written by the worker searching it alone, and `prefetch`, in
+ * which each task has its prefetched file, if the plan `opens` any, which is
+ * taken as the task begins, and which is opened `ahead` tasks before then (see
+ * `prefetch_task`). */
+
+struct search_run_t {
+    const struct search_plan_t * plan;
+    char ** needles;
+    int ncount;
+    const struct automaton_t * ac;
+    size_t * results;
+    struct prefetch_t * prefetch;
+    size_t ahead;
+    opts_t options;
+    enum format_t format;
+    unsigned long max_count;
+    const struct search_output_t * output;
+};
 
-    if ( init_buffer_instance ( &bi ) == -1 )
-        return STATUS_ERRNO;
+/* search_output_t: the destination of the results of a run: the descriptor
+ * `fd`, or, if `emit` is set, `emit` itself, which is given `data`, and the
+ * printed results in order, as they are completed (see pool_job_t). */
+
+struct search_output_t {
+    int fd;
+    int ( * emit ) ( void * data, const char * results, size_t len );
+    void * data;
+};
 
-    while ( ( repo = stack_pop ( stack ) ) != NULL ) {
-        /* discard previous buffer on repo change */
-        bi.buffer [ 0 ] = '\0';
+/* search_worker_t: the private state of a single worker. Each has its own
+ * buffer and hit list, as anticipated by `buffer_info_t`. */
 
-        if ( populate_glob ( repo->location, &glob_buf ) == -1 ||
-                process_glob_list ( &bi, &glob_buf, needles,
-                    ncount, repo ) == -1 ) {
-            free ( bi.buffer );
-            free ( repo );
-            globfree ( &glob_buf );
-            return STATUS_ERRNO;
-        }
+struct search_worker_t {
+    struct buffer_info_t bi;
+    struct hit_list_t hits;
+};
 
-        free ( repo );
-        globfree ( &glob_buf );
+/* search_whole_buffer: index and search the `text` of `len` bytes, of whole
+ * lines, holding the whole of the file at `bi->path` (such as a mapping, or its
+ * entries in the index), or a chunk of it (see `plan_task`). The text is only
+ * read, and never beyond `len` (see `automaton_scan`), so a chunk may be
+ * searched while the next, which immediately follows it, is searched by
+ * another worker. Returns zero on success, 1 if the search stopped early (see
+ * `search_buffer`), or -1 on failure, in which case errno and the information
+ * buffer are set appropriately. */
+
+static int search_whole_buffer ( struct buffer_info_t * bi, char * text,
+        size_t len, char ** needles, int ncount, const struct automaton_t * ac,
+        struct hit_list_t * hits, struct repo_t * repo )
+{
+    line_index_reset ( & ( bi->lines ) );
+    if ( line_index_extend ( & ( bi->lines ), text, 0, len ) == -1 ) {
+        populate_info_buffer ( bi->path );
+        return -1;
     }
 
-    free ( bi.buffer );
-    return STATUS_OK;
+    return search_buffer ( text, len, needles, ncount, ac, hits, repo,
+            bi );
 }
 
-/* portdir_makeconf: attempt to extract the value from the "PORTDIR" key-value
- * pair in $PORTAGE_CONFIGROOT/make.conf. On success, this function returns
- * STATUS_OK. The caller can determine whether a key has been found by testing
- * the first character of `value` for a null-terminator. There is no requirement
- * to confer with the error buffer here, as errors are non-fatal. */
+/* search_mapped_file: search the file mapped by `map_file`, releasing the
+ * mapping afterwards. Returns as `search_whole_buffer`. */
 
-static enum status_t portdir_makeconf ( char base [ PATH_MAX ],
-        char value [ PATH_MAX ] )
+static int search_mapped_file ( struct buffer_info_t * bi, char ** needles,
+        int ncount, const struct automaton_t * ac, struct hit_list_t * hits,
+        struct repo_t * repo )
 {
-    char buffer [ BUFFER_SZ ];
-    FILE * fp = NULL;
-    enum status_t status = STATUS_OK;
+    int status = search_whole_buffer ( bi, bi->map, bi->map_size, needles,
+            ncount, ac, hits, repo );
 
-    if ( construct_path ( value, base, PORTAGE_MAKECONF ) == -1 ||
-            ( fp = fopen ( value, "r" ) ) == NULL )
-        return STATUS_ERRNO;
+    unmap_file ( bi );
+    return status;
+}
 
-    value [ 0 ] = '\0';
+/* stream_file: read the file at `bi->path` through the large file buffer, one
+ * window of whole lines at a time (see `populate_buffer`), searching each
+ * window as it is filled, until the file ends, or the search stops early (see
+ * `search_buffer`), in which case 1 is returned. Returns zero on success, or
+ * -1 on failure, in which case STATUS_ERRNO should be assumed. */
 
-    if ( fread ( buffer, sizeof ( char ), PATH_MAX - 1, fp ) <
-            PATH_MAX - 1 && ! feof ( fp ) ) {
-        fnull ( &fp );
-        return STATUS_ERRNO;
-    }
+static int stream_file ( struct buffer_info_t * bi, char ** needles,
+        int ncount, const struct automaton_t * ac, struct hit_list_t * hits,
+        struct repo_t * repo )
+{
+    enum stats_phase_t phase = PHASE_NONE;
+    unsigned long long start = 0;
+    int status = 0;
 
-    fnull ( &fp );
+    /* a match is never split between the windows of a long line */
+    bi->overlap = 0;
+    for ( int i = 0; i < ncount; i++ )
+        if ( ac->lengths [ i ] > bi->overlap + 1 )
+            bi->overlap = ac->lengths [ i ] - 1;
 
-    if ( ( status = get_keyval_value ( value, buffer, "PORTDIR" ) )
-            != STATUS_OK )
-        return ( status == STATUS_INILOC ) ? STATUS_OK : status;
-    else
-        /* Extraneous obliques make no difference when placed as prefixes
-         * and suffixes to a UNIX path. */
-        replace_char ( value, '"', '/' );
+    do {
+        start = trace_now ( );
+        trace_probe ( fill__start, bi->path, bi->src.offset );
+        phase = stats_phase ( PHASE_READ );
+        bi->status = populate_buffer ( bi );
+        stats_phase ( phase );
+        trace_probe ( fill__done, bi->path, bi->len );
+        trace_span ( "read", "fill", start, bi->path, "bytes", bi->len );
+        if ( bi->status == BUFSTAT_ERRNO ) {
+            status = -1;
+            break;
+        }
 
-    return STATUS_OK;
+        if ( ( status = search_buffer ( & ( bi->buffer [ bi->start ] ),
+                        bi->end - bi->start, needles, ncount, ac, hits, repo,
+                        bi ) ) != 0 ) {
+            /* failed, or no more of the file is needed */
+            source_close ( & ( bi->src ) );
+            break;
+        }
+    } while ( bi->status == BUFSTAT_FULL );
+
+    /* every other buffer searched is of whole lines */
+    bi->long_line = LONG_NONE;
+    return status;
 }
 
-/* portdir_complain: issue an appropriate warning regarding the existence of
- * PORTDIR; this can be disabled entirely using ARG_NO_COMPLAINING. If
- * ARG_LIST_REPOS is also set, a further warning is issued stating that a
- * session with PORTDIR renders a repository-listing useless. */
+/* search_file: search the file at `bi->path` for each of the `needles`, of
+ * which there should be `ncount`, using the automaton `ac` and its hit list.
+ * The file is mapped and searched in place where possible (see `map_file`),
+ * and streamed through the buffer of `bi` otherwise. The `repo` also enables
+ * increased verbosity by the printing functions, should it have been requested
+ * at the command-line. On success, this function returns zero, or 1 if the
+ * search stopped early (see `search_buffer`), or -1 on failure. In the latter
+ * event, STATUS_ERRNO should be assumed. The information buffer is populated
+ * appropriately. */
 
-static void portdir_complain ( )
+static int search_file ( struct buffer_info_t * bi, char ** needles,
+        int ncount, const struct automaton_t * ac, struct hit_list_t * hits,
+        struct repo_t * repo )
 {
-    if ( CHK_ARG ( options, ARG_NO_COMPLAINING ) == 0 ) {
-        print_warning ( WARNING_PDEXT, &provide_gen_warning );
-        putchar ( '\n' );
-
-        if ( CHK_ARG ( options, ARG_LIST_REPOS ) != 0 ) {
-            print_warning ( WARNING_PDLST, &provide_gen_warning );
-            putchar ( '\n' );
-        }
+    const unsigned long long start = trace_now ( );
+    const enum stats_phase_t phase = stats_phase ( PHASE_READ );
+    const enum map_status_t mapped = map_file ( bi );
+
+    stats_phase ( phase );
+    trace_span ( "read", "map", start, bi->path, "bytes", bi->map_size );
+    switch ( mapped ) {
+        case MAPSTAT_EMPTY:
+            return 0;
+        case MAPSTAT_OK:
+            return search_mapped_file ( bi, needles, ncount, ac, hits,
+                    repo );
+        case MAPSTAT_FALLB:
+            break;
     }
+
+    return stream_file ( bi, needles, ncount, ac, hits, repo );
 }
 
-/* portdir_attempt_envvar: attempt to retrieve the value of PORTDIR from the
- * environment variable string with getenv(3). If, for any reason, this cannot
- * be completed, -1 is returned; this is not necessarily a fatal error, and
- * should not be treated as such. On success, some heap memory is allocated and
- * pushed to the stack, and zero is returned. */
+/* push_task: append a task to the `plan`; see `search_task_t`. Returns zero on
+ * success, or -1 if the list could not grow, in which case errno is set. */
 
-static int portdir_attempt_envvar ( struct repo_stack_t * stack )
+static int push_task ( struct search_plan_t * plan,
+        const struct search_task_t * task )
 {
-    struct repo_t * tmp_repo = NULL;
-    char * value = getenv ( "PORTDIR" );
+    struct search_task_t * tasks = NULL;
 
-    if ( value != NULL && ( tmp_repo = malloc ( sizeof ( struct repo_t ) ) )
-            != NULL ) {
-        strcpy ( tmp_repo->name, DEFAULT_REPO_NAME );
+    if ( plan->count == plan->capacity ) {
+        size_t capacity = ( plan->capacity == 0 ) ? 64 :
+            plan->capacity * 2;
 
-        if ( strlen ( value ) < PATH_MAX ) {
-            strcpy ( tmp_repo->location, value );
-            stack_push ( stack, tmp_repo );
-            portdir_complain ( );
-
-            return 0;
+        if ( ( tasks = realloc ( plan->tasks, sizeof ( *tasks ) *
+                        capacity ) ) == NULL ) {
+            populate_info_buffer ( "Task list" );
+            return -1;
         }
 
-        free ( tmp_repo );
+        plan->tasks = tasks;
+        plan->capacity = capacity;
     }
 
-    return -1;
+    plan->tasks [ plan->count++ ] = *task;
+    return 0;
 }
 
-/* portdir_attempt_file: this function exhibits very similar behaviour to
+/* plan_task: plan the search of the file at `path`, opened as `name` relative
+ * to `dir`; see `search_task_t`. If the `text` of the file is larger than
+ * `plan->chunk_sz`, it is split into chunks of whole lines, each of which is a
+ * task; the text must then end with a line feed. Returns as `push_task`. */
+
+static int plan_task ( struct search_plan_t * plan, char * path,
+        const char * name, int dir, char * text, size_t len,
+        struct repo_t * repo )
+{
+    struct search_task_t task = {
+        .path = path, .name = name, .dir = dir, .text = text, .len = len,
+        .repo = repo
+    };
+    char * feed = NULL;
+
+    if ( text == NULL )
+        plan->opens = 1;
+
+    if ( text == NULL || plan->chunk_sz == 0 || len <= plan->chunk_sz )
+        return push_task ( plan, &task );
+
+    for ( size_t start = 0, end = 0; start < len; start = end ) {
+        /* end each chunk after the first line feed past its size */
+        end = start + plan->chunk_sz;
+        feed = ( end >= len ) ? NULL : memchr ( & ( text [ end - 1 ] ),
+                '\n', len - ( end - 1 ) );
+        end = ( feed == NULL ) ? len : ( size_t ) ( feed - text ) + 1;
+
+        task.text = & ( text [ start ] );
+        task.len = end - start;
+        task.joins = ( start > 0 );
+
+        if ( push_task ( plan, &task ) == -1 )
+            return -1;
+    }
+
+    return 0;
+}
+
+/* share_resident: return the map of the file at `path` in the plan replaced
+ * by `plan`, if there is one, and the file is unchanged since it was mapped
+ * (its stamp being `stamp`), counting `plan` as one of its holders; or NULL.
+ * The maps are sought from the cursor onwards, wrapping around, as the files
+ * are usually planned in the same order as before, so each is found at once. */
+
+static struct resident_t * share_resident ( struct search_plan_t * plan,
+        const char * path, const struct index_stamp_t * stamp )
+{
+    const struct search_plan_t * previous = plan->previous;
+    struct resident_t * map = NULL;
+
+    for ( size_t i = 0; previous != NULL && i < previous->map_count; i++ ) {
+        map = previous->maps [ ( plan->cursor + i ) % previous->map_count ];
+
+        if ( strcmp ( map->path, path ) == 0 ) {
+            plan->cursor = ( plan->cursor + i + 1 ) % previous->map_count;
+            if ( index_stamps_differ ( & ( map->stamp ), stamp ) )
+                return NULL;
+
+            atomic_fetch_add ( & ( map->refs ), 1 );
+            return map;
+        }
+    }
+
+    return NULL;
+}
+
+/* release_resident: release the hold of a plan on the `map`, which is freed if
+ * no other plan holds it. */
+
+static void release_resident ( struct resident_t * map )
+{
+    if ( atomic_fetch_sub ( & ( map->refs ), 1 ) == 1 ) {
+        unmap_file ( & ( map->file ) );
+        free ( map );
+    }
+}
+
+/* make_resident: map the file of `ent`, the stamp of which is `stamp`. If the
+ * map is `lasting`, as for a daemon or a library context, the file is loaded
+ * instead (see `load_file`), as it may change in place long before the map is
+ * released, which would fault a mapping. On success, zero is returned, and
+ * `map` is the new map, held once, or NULL if the file cannot be mapped. On
+ * failure, -1 is returned, and errno is set. */
+
+static int make_resident ( const struct glob_entry_t * ent,
+        const struct index_stamp_t * stamp, int lasting,
+        struct resident_t ** map )
+{
+    enum map_status_t status = MAPSTAT_OK;
+
+    if ( ( *map = malloc ( sizeof ( **map ) + strlen ( ent->path ) + 1 ) )
+            == NULL ) {
+        populate_info_buffer ( ent->path );
+        return -1;
+    }
+
+    memset ( & ( ( *map )->file ), 0, sizeof ( ( *map )->file ) );
+    ( *map )->file.src = ( struct source_t ) SOURCE_INIT;
+    strcpy ( ( *map )->path, ent->path );
+    ( *map )->file.path = ( *map )->path;
+    ( *map )->file.name = ent->name;
+    ( *map )->file.dir = ent->dir;
+    ( *map )->stamp = *stamp;
+    atomic_init ( & ( ( *map )->refs ), 1 );
+
+    status = ( lasting ) ? load_file ( & ( ( *map )->file ) ) :
+        map_file ( & ( ( *map )->file ) );
+
+    /* left open if the file is to be streamed instead */
+    source_close ( & ( ( *map )->file.src ) );
+    if ( status != MAPSTAT_OK ) {
+        free ( *map );
+        *map = NULL;
+        return 0;
+    }
+
+    /* the map may outlive the directory of `ent` */
+    ( *map )->file.name = ( *map )->path;
+    ( *map )->file.dir = AT_FDCWD;
+    return 0;
+}
+
+/* plan_map: if the file of `ent` is large enough to be split (see
+ * `plan_task`), or the plan is `resident`, map it into memory in advance (see
+ * `make_resident`), keeping the mapping in `plan->maps` until the plan is
+ * freed, and point `text` and `len` to it. The mapping of an unchanged file is
+ * shared with the plan replaced by this one, if any (see `share_resident`),
+ * rather than being made again. Otherwise, or if the file cannot be mapped,
+ * `text` is left NULL, and the file is searched whole by a single worker.
+ * Returns zero on success, or -1 on failure, in which case errno is set. */
+
+static int plan_map ( struct search_plan_t * plan,
+        const struct glob_entry_t * ent, char ** text, size_t * len )
+{
+    struct resident_t ** maps = NULL, * map = NULL;
+    struct index_stamp_t stamp;
+    struct stat st;
+
+    *text = NULL;
+    if ( fstatat ( ent->dir, ent->name, &st, 0 ) == -1 ||
+            ( !plan->resident && ( plan->chunk_sz == 0 ||
+                ( size_t ) st.st_size <= plan->chunk_sz ) ) )
+        return 0;
+
+    index_stamp ( &st, &stamp );
+    if ( ( map = share_resident ( plan, ent->path, &stamp ) ) == NULL &&
+            make_resident ( ent, &stamp, plan->lasting, &map ) == -1 )
+        return -1;
+
+    if ( map == NULL )
+        return 0;
+
+    if ( ( maps = realloc ( plan->maps, sizeof ( *maps ) *
+                    ( plan->map_count + 1 ) ) ) == NULL ) {
+        populate_info_buffer ( "Mapping list" );
+        release_resident ( map );
+        return -1;
+    }
+
+    plan->maps = maps;
+    plan->maps [ plan->map_count++ ] = map;
+    *text = map->file.map;
+    *len = map->file.map_size;
+    return 0;
+}
+
+/* plan_index: plan a task for every file in the loaded index `ix` which would
+ * be selected by the command-line arguments (see `glob_selects`), in the order
+ * in which the files would be searched directly. `stack` holds the
+ * repositories of the index, in the same order (see `index_load`). Returns
+ * zero on success, or -1 on failure (see `plan_task`). */
+
+static int plan_index ( struct search_plan_t * plan, struct index_t * ix,
+        struct repo_stack_t * stack )
+{
+    for ( uint64_t i = 0; i < ix->header->repo_count; i++ ) {
+        const struct index_repo_t * ir = & ( ix->repos [ i ] );
+        struct repo_t * repo = stack_repo ( stack, i );
+
+        for ( uint64_t f = ir->first_file; f < ir->first_file +
+                ir->file_count; f++ ) {
+            const struct index_file_t * file = & ( ix->files [ f ] );
+            char * path = & ( ix->blob [ file->path ] );
+
+            if ( glob_selects ( path ) && plan_task ( plan, path, path,
+                        AT_FDCWD, & ( ix->blob [ file->text ] ),
+                        file->text_len, repo ) == -1 )
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* plan_load: with ARG_IO set to IO_URING, load every file of the glob list
+ * `gl` into memory up front, in batches (see `uring_load`), pointing `files` to
+ * the list of them, in the order of `gl`, to be freed by the caller; the memory
+ * holding them is kept in `plan->loads` until the plan is freed. A file which
+ * is not loaded is planned as usual. `files` is left NULL otherwise, or if the
+ * plan is `resident`, as its files are mapped by `plan_map`. Returns zero on
+ * success, or -1 on failure, in which case errno is set. */
+
+static int plan_load ( struct search_plan_t * plan,
+        const struct glob_list_t * gl, struct uring_file_t ** files )
+{
+    *files = NULL;
+    if ( option_io != IO_URING || plan->resident || gl->count == 0 )
+        return 0;
+
+    if ( ( *files = malloc ( sizeof ( **files ) * gl->count ) ) == NULL ) {
+        populate_info_buffer ( "Load list" );
+        return -1;
+    }
+
+    for ( size_t f = 0; f < gl->count; f++ ) {
+        ( *files ) [ f ].name = gl->entries [ f ].name;
+        ( *files ) [ f ].dir = gl->entries [ f ].dir;
+    }
+
+    if ( uring_load ( *files, gl->count, & ( plan->loads ) ) == -1 )
+        return -1;
+
+    for ( size_t f = 0; stats_enabled && f < gl->count; f++ )
+        if ( ( *files ) [ f ].text != NULL ) {
+            stats_count ( STAT_OPENS, 1 );
+            stats_count ( STAT_BYTES, ( *files ) [ f ].len );
+        }
+
+    return 0;
+}
+
+/* plan_files: plan a task for every file of every repository on the `stack`,
+ * as collated by `populate_glob`, so the files are searched directly. The
+ * lists, and the directories they hold open, are kept in `plan->globs`, and
+ * must be released by the caller with `glob_free` (see `free_plan`), even on
+ * failure. Returns zero on success, or -1 on failure, in which case
+ * STATUS_ERRNO should be assumed. */
+
+static int plan_files ( struct search_plan_t * plan,
+        struct repo_stack_t * stack )
+{
+    struct repo_t * repo = NULL;
+    struct uring_file_t * files = NULL;
+    enum stats_phase_t phase = PHASE_NONE;
+    unsigned long long start = 0, step = 0;
+    int status = 0;
+
+    if ( ( plan->globs = malloc ( sizeof ( *plan->globs ) *
+                    ( stack->size + 1 ) ) ) == NULL ) {
+        populate_info_buffer ( "Glob list" );
+        return -1;
+    }
+
+    for ( size_t i = 0; i <= stack->size; i++ )
+        plan->globs [ i ] = ( struct glob_list_t ) GLOB_LIST_INIT;
+
+    for ( size_t i = 0; status == 0 &&
+            ( repo = stack_repo ( stack, i ) ) != NULL; i++ ) {
+        start = step = trace_now ( );
+        trace_probe ( repo__start, repo->name, repo->location );
+        stats_repo ( repo );
+        phase = stats_phase ( PHASE_GLOB );
+        if ( populate_glob ( repo->location, & ( plan->globs [ i ] ) )
+                == -1 )
+            status = -1;
+
+        trace_span ( "glob", "populate_glob", step, repo->location, "files",
+                plan->globs [ i ].count );
+        step = trace_now ( );
+        stats_phase ( PHASE_READ );
+        if ( status == 0 && plan_load ( plan, & ( plan->globs [ i ] ),
+                    &files ) == -1 )
+            status = -1;
+
+        if ( files != NULL )
+            trace_span ( "read", "load", step, repo->location, "files",
+                    plan->globs [ i ].count );
+
+        for ( size_t f = 0; status == 0 && f < plan->globs [ i ].count;
+                f++ ) {
+            const struct glob_entry_t * ent =
+                & ( plan->globs [ i ].entries [ f ] );
+            char * text = ( files == NULL ) ? NULL : files [ f ].text;
+            size_t len = ( text == NULL ) ? 0 : files [ f ].len;
+
+            if ( ( text == NULL && plan_map ( plan, ent, &text, &len )
+                        == -1 ) || plan_task ( plan, ent->path, ent->name,
+                        ent->dir, text, len, repo ) == -1 )
+                status = -1;
+        }
+
+        stats_phase ( phase );
+        trace_probe ( repo__done, repo->name, plan->globs [ i ].count );
+        trace_span ( "repo", repo->name, start, repo->location, "files",
+                plan->globs [ i ].count );
+        free ( files );
+        files = NULL;
+    }
+
+    stats_repo ( NULL );
+    return status;
+}
+
+/* free_plan: release the tasks, mappings, loads, and glob lists of the `plan`,
+ * of which there are `repo_count`; a mapping shared with another plan is kept
+ * for the latter. */
+
+static void free_plan ( struct search_plan_t * plan, unsigned long repo_count )
+{
+    if ( plan->globs != NULL )
+        for ( unsigned long i = 0; i < repo_count; i++ )
+            glob_free ( & ( plan->globs [ i ] ) );
+
+    for ( size_t i = 0; i < plan->map_count; i++ )
+        release_resident ( plan->maps [ i ] );
+
+    uring_release ( plan->loads );
+    free ( plan->globs );
+    free ( plan->maps );
+    free ( plan->tasks );
+}
+
+/* init_search_worker: prepare the private state of a worker; see pool_job_t. */
+
+static int init_search_worker ( void ** state, void * shared )
+{
+    const struct search_run_t * run = shared;
+    struct search_worker_t * worker = malloc ( sizeof ( *worker ) );
+
+    /* this may be a new thread; see `options` */
+    options = run->options;
+    option_format = run->format;
+    option_max_count = run->max_count;
+
+    if ( worker == NULL ) {
+        populate_info_buffer ( "Worker" );
+        return -1;
+    }
+
+    if ( hit_list_init ( & ( worker->hits ), run->ncount ) == -1 ) {
+        populate_info_buffer ( "Hit list" );
+        free ( worker );
+        return -1;
+    }
+
+    if ( init_buffer_instance ( & ( worker->bi ) ) == -1 ) {
+        hit_list_free ( & ( worker->hits ) );
+        free ( worker );
+        return -1;
+    }
+
+    *state = worker;
+    return 0;
+}
+
+/* free_search_worker: release the private state of a worker. */
+
+static void free_search_worker ( void * state )
+{
+    struct search_worker_t * worker = state;
+
+    hit_list_free ( & ( worker->hits ) );
+    free_buffer_instance ( & ( worker->bi ) );
+    free ( worker );
+}
+
+/* prefetch_task: open the file of the task `item` of the `run`, if it has one
+ * to be opened, and advise the kernel to read it, so it is read while the
+ * tasks before it are searched, rather than once its own task has begun; see
+ * `prefetch_t`. Errors are disregarded, as the task opens the file itself if
+ * it has not been prefetched, and reports them then. */
+
+static void prefetch_task ( const struct search_run_t * run, size_t item )
+{
+    const struct search_task_t * task = NULL;
+    struct prefetch_t * pf = NULL;
+    int state = PREFETCH_NONE;
+
+    if ( run->prefetch == NULL || item >= run->plan->count )
+        return;
+
+    task = & ( run->plan->tasks [ item ] );
+    pf = & ( run->prefetch [ item ] );
+
+    if ( task->text != NULL || ( run->plan->select &&
+                !glob_selects ( task->path ) ) ||
+            !atomic_compare_exchange_strong ( & ( pf->state ), &state,
+                PREFETCH_BUSY ) )
+        return;
+
+    stats_repo ( task->repo );
+    if ( source_open ( & ( pf->src ), task->dir, task->name ) == -1 ) {
+        atomic_store ( & ( pf->state ), PREFETCH_NONE );
+        return;
+    }
+
+    source_prefetch ( & ( pf->src ) );
+    stats_count ( STAT_READAHEAD, 1 );
+    state = PREFETCH_BUSY;
+    if ( !atomic_compare_exchange_strong ( & ( pf->state ), &state,
+                PREFETCH_READY ) )
+        /* the task has begun without it */
+        source_close ( & ( pf->src ) );
+}
+
+/* take_prefetch: begin the task `item` of the `run`, taking its file into
+ * `bi->src` if it has been prefetched; otherwise, the file is opened by the
+ * reader, as usual. */
+
+static void take_prefetch ( const struct search_run_t * run, size_t item,
+        struct buffer_info_t * bi )
+{
+    struct prefetch_t * pf = NULL;
+
+    if ( run->prefetch == NULL )
+        return;
+
+    pf = & ( run->prefetch [ item ] );
+    if ( atomic_exchange ( & ( pf->state ), PREFETCH_TAKEN ) ==
+            PREFETCH_READY )
+        bi->src = pf->src;
+}
+
+/* release_prefetch: close the files prefetched by the `run` which were never
+ * taken, as the run stopped before their tasks, and free the prefetch list.
+ * The workers must be done. */
+
+static void release_prefetch ( struct search_run_t * run )
+{
+    for ( size_t i = 0; run->prefetch != NULL && i < run->plan->count; i++ )
+        if ( atomic_load ( & ( run->prefetch [ i ].state ) ) ==
+                PREFETCH_READY )
+            source_close ( & ( run->prefetch [ i ].src ) );
+
+    free ( run->prefetch );
+    run->prefetch = NULL;
+}
+
+/* run_search_task: search the file of a single task, printing the results to
+ * `out`; see pool_job_t. The file of the task `run->ahead` after this one is
+ * prefetched meanwhile, as that is roughly the next to be taken by this worker
+ * once every other worker has taken its own. */
+
+static int run_search_task ( void * state, void * shared, size_t item,
+        struct sink_t * out )
+{
+    struct search_worker_t * worker = state;
+    const struct search_run_t * run = shared;
+    const struct search_task_t * task = & ( run->plan->tasks [ item ] );
+    const size_t results = worker->bi.results;
+    const unsigned long long start = trace_now ( );
+    enum stats_phase_t phase = PHASE_NONE;
+    int status = 0;
+
+    worker->bi.out = out;
+    worker->bi.path = task->path;
+    worker->bi.name = task->name;
+    worker->bi.dir = task->dir;
+
+    if ( run->plan->select && !glob_selects ( task->path ) )
+        return 0; /* not selected by the options of this query */
+
+    trace_probe ( file__start, task->path, item );
+    stats_repo ( task->repo );
+    phase = stats_phase ( PHASE_READ );
+    take_prefetch ( run, item, & ( worker->bi ) );
+    prefetch_task ( run, item + run->ahead );
+    stats_repo ( task->repo ); /* that of the prefetched file may differ */
+    stats_phase ( PHASE_SEARCH );
+
+    if ( task->text != NULL )
+        status = search_whole_buffer ( & ( worker->bi ), task->text,
+                task->len, run->needles, run->ncount, run->ac,
+                & ( worker->hits ), task->repo );
+    else
+        status = search_file ( & ( worker->bi ), run->needles,
+                run->ncount, run->ac, & ( worker->hits ), task->repo );
+
+    stats_phase ( phase );
+    run->results [ item ] = worker->bi.results - results;
+    trace_probe ( file__done, task->path, run->results [ item ] );
+    trace_span ( "file", task->path, start, task->repo->name, "results",
+            run->results [ item ] );
+
+    /* Stopping early ends only the file with ARG_FILES_MATCH, but
+     * every search with ARG_EXISTS and ARG_MAX_COUNT. */
+    return ( status == 1 && CHK_ARG ( options, ARG_FILES_MATCH ) != 0 ) ?
+        0 : status;
+}
+
+/* joins_search_task: return non-zero if the task `item` is a chunk continuing
+ * the file of the task before it; see pool_job_t. */
+
+static int joins_search_task ( void * shared, size_t item )
+{
+    const struct search_run_t * run = shared;
+
+    return run->plan->tasks [ item ].joins;
+}
+
+/* splittable: return non-zero if files may be split into chunks for `jobs`
+ * workers: there must be more than one, and none of the needles may span lines,
+ * as a match of such a needle could cross from one chunk into the next. If `ac`
+ * is NULL, the needles are those of a batch, none of which can span lines, as
+ * each query is a single line. */
+
+static int splittable ( int jobs, const struct automaton_t * ac )
+{
+    for ( int i = 0; ac != NULL && i < ac->ncount; i++ )
+        if ( ac->multiline [ i ] )
+            return 0;
+
+    return jobs > 1;
+}
+
+/* open_index: load the on-disk index for the repositories on the `stack` into
+ * `ix`, (re)building it first if it is outdated, or if ARG_BUILD_INDEX is set.
+ * An outdated index is rebuilt from the files which have changed, the entries
+ * of the others being reused (see `index_build`); ARG_BUILD_INDEX reads every
+ * file afresh. This function returns INDEX_OK if the index is ready. Unless
+ * ARG_BUILD_INDEX is set, the index is a cache, so INDEX_STALE is returned if
+ * it is unavailable for any reason, and the files should be searched directly.
+ * If ARG_BUILD_INDEX is set and the index cannot be built, INDEX_ERRNO is
+ * returned, and errno and the information buffer are set appropriately. */
+
+static enum index_status_t open_index ( struct index_t * ix,
+        struct repo_stack_t * stack )
+{
+    char path [ PATH_MAX ];
+    const int rebuild = CHK_ARG ( options, ARG_BUILD_INDEX ) != 0;
+    enum index_status_t status = INDEX_OK;
+
+    if ( index_default_path ( path ) == -1 ) {
+        if ( !rebuild )
+            return INDEX_STALE;
+
+        populate_info_buffer ( "Index path" );
+        return INDEX_ERRNO;
+    }
+
+    if ( rebuild )
+        status = index_build ( path, stack, NULL );
+    else if ( index_load ( ix, path, stack ) == INDEX_OK )
+        return INDEX_OK;
+    else {
+        status = index_build ( path, stack, ix );
+        index_unload ( ix );
+    }
+
+    if ( status != INDEX_OK )
+        return rebuild ? INDEX_ERRNO : INDEX_STALE;
+
+    if ( ( status = index_load ( ix, path, stack ) ) != INDEX_OK )
+        /* changed again while it was rebuilt */
+        index_unload ( ix );
+
+    return status;
+}
+
+/* search_t: a search of the profiles / *.desc files of every repository on the
+ * `stack`, prepared once by `prepare_search`, and run by `run_search` for one
+ * set of needles, or, for a batch or a daemon (see ARG_BATCH and ARG_DAEMON),
+ * for the needles of every query in turn, by up to `jobs` workers each. Once
+ * prepared, a search is only read, so a daemon may run several at once. */
+
+struct search_t {
+    struct search_plan_t plan;
+    struct index_t ix;
+    enum index_status_t ix_status;
+    struct repo_stack_t * stack;
+    int jobs;
+};
+
+/* finish_search: release the plan and the index of the `search`. The
+ * repositories are left on the stack. */
+
+static void finish_search ( struct search_t * search )
+{
+    if ( search->ix_status == INDEX_OK )
+        index_unload ( & ( search->ix ) );
+
+    free_plan ( & ( search->plan ), search->stack->size );
+}
+
+/* prepare_search: prepare a search of the repositories on the `stack` for the
+ * needles compiled into `ac`, or for those of the queries of a batch or a
+ * daemon if `ac` is NULL. Unless ARG_NO_INDEX is set, the entries are searched
+ * in the on-disk index, which is rebuilt if any of the files has changed;
+ * otherwise, or if the index is unavailable, the files themselves are searched.
+ * The files are planned to be searched concurrently by up to `option_jobs`
+ * workers, with the largest split into chunks (see `plan_task`). The plan of a
+ * batch or a daemon has every file, whatever the options, and all of them are
+ * mapped in advance; see `search_plan_t`. If `lasting` is set, the search may
+ * be kept long after it returns, so the files are loaded instead. If
+ * `previous` is not NULL, it is the search which this one replaces, with which
+ * the mappings of the files which are unchanged are shared (see `plan_map`);
+ * it may be finished at any time after this function returns. On failure, the
+ * search is released, and STATUS_ERRNO is returned. */
+
+static enum status_t prepare_search ( struct search_t * search,
+        struct repo_stack_t * stack, const struct automaton_t * ac,
+        const struct search_t * previous, int lasting )
+{
+    const opts_t selection = CHK_ARG ( options, ( ARG_PKG_FILES_ONLY |
+                ARG_GLOBAL_ONLY ) );
+    enum stats_phase_t phase = PHASE_NONE;
+    int status = 0;
+
+    memset ( search, 0, sizeof ( *search ) );
+    search->stack = stack;
+    search->ix_status = INDEX_STALE;
+    search->plan.previous = ( previous != NULL ) ? & ( previous->plan ) :
+        NULL;
+    search->plan.lasting = lasting;
+    search->jobs = ( option_jobs > 0 ) ? ( int ) option_jobs :
+        pool_default_jobs ( );
+
+    if ( CHK_ARG ( options, ARG_NO_INDEX ) == 0 ||
+            CHK_ARG ( options, ARG_BUILD_INDEX ) != 0 ) {
+        const unsigned long long start = trace_now ( );
+
+        phase = stats_phase ( PHASE_READ );
+        search->ix_status = open_index ( & ( search->ix ), stack );
+        stats_phase ( phase );
+        trace_span ( "read", "index", start, NULL, NULL, 0 );
+        if ( search->ix_status == INDEX_ERRNO )
+            return STATUS_ERRNO;
+    }
+
+    /* a file is only listed once, and stopping items are not grouped */
+    search->plan.chunk_sz = ( splittable ( search->jobs, ac ) &&
+            CHK_ARG ( options, ( ARG_FILES_MATCH | ARG_EXISTS |
+                    ARG_MAX_COUNT ) ) == 0 ) ? CHUNK_SZ : 0;
+
+    if ( ac == NULL ) {
+        /* every query selects its own files */
+        search->plan.select = search->plan.resident = 1;
+        options &= ~selection;
+    }
+
+    if ( ac != NULL && ac->ncount == 0 )
+        /* ARG_BUILD_INDEX without queries: nothing to search */
+        ;
+    else if ( search->ix_status == INDEX_OK && CHK_ARG ( options,
+                ARG_NO_INDEX ) == 0 )
+        status = plan_index ( & ( search->plan ), & ( search->ix ),
+                stack );
+    else
+        status = plan_files ( & ( search->plan ), stack );
+
+    options |= selection;
+    search->plan.previous = NULL;
+    if ( status == -1 ) {
+        finish_search ( search );
+        return STATUS_ERRNO;
+    }
+
+    return STATUS_OK;
+}
+
+/* emit_search_output: pass the `len` bytes of `results` to the `emit` of the
+ * output of the run `shared`; see pool_job_t. */
+
+static int emit_search_output ( void * shared, const char * results,
+        size_t len )
+{
+    const struct search_output_t * output =
+        ( ( const struct search_run_t * ) shared )->output;
+
+    return output->emit ( output->data, results, len );
+}
+
+/* run_search: search the prepared `search` for the `ncount` `needles`, which
+ * have been compiled into the automaton `ac`, with the options of the calling
+ * thread, writing the results to the `output`. The results are printed
+ * in the order of the repositories and files, so the output is identical
+ * regardless of the number of jobs. The number of results found is placed in
+ * `results`; in the bounded result modes (see ARG_RESULT_MODES), the search
+ * stops as soon as their outcome is known. If the output is closed by its
+ * reader, the search stops, and STATUS_CLOSED is returned; on any other
+ * failure, STATUS_ERRNO. */
+
+static enum status_t run_search ( const struct search_t * search,
+        char ** needles, int ncount, const struct automaton_t * ac,
+        const struct search_output_t * output, size_t * results )
+{
+    struct search_run_t run = {
+        .plan = & ( search->plan ), .needles = needles, .ncount = ncount,
+        .ac = ac, .options = options, .format = option_format,
+        .max_count = option_max_count, .output = output
+    };
+    struct pool_job_t job = {
+        .count = search->plan.count, .sections = ncount,
+        .jobs = search->jobs, .fd = output->fd, .shared = &run,
+        .worker_init = &init_search_worker,
+        .worker_free = &free_search_worker, .run = &run_search_task,
+        .joins = &joins_search_task,
+        .emit = ( output->emit != NULL ) ? &emit_search_output : NULL
+    };
+    enum status_t status = STATUS_OK;
+
+    /* zeroed, as only the tasks taken by a worker are counted, and never
+     * empty, even for an empty plan */
+    *results = 0;
+    if ( ( run.results = calloc ( search->plan.count + 1,
+                    sizeof ( *run.results ) ) ) == NULL ) {
+        populate_info_buffer ( "Result counts" );
+        return STATUS_ERRNO;
+    }
+
+    if ( CHK_ARG ( options, ARG_MAX_COUNT ) != 0 )
+        /* the results must be counted in order to stop at exactly the
+         * right one, which only a single worker can do */
+        job.jobs = 1;
+
+    /* without a list, every task opens its own file, as it begins */
+    run.ahead = ( size_t ) job.jobs;
+    if ( search->plan.opens )
+        run.prefetch = calloc ( search->plan.count,
+                sizeof ( *run.prefetch ) );
+
+    /* the output written by this thread belongs to no repository */
+    stats_repo ( NULL );
+    if ( pool_run ( &job ) == -1 )
+        status = ( errno == EPIPE ) ? STATUS_CLOSED : STATUS_ERRNO;
+
+    stats_repo ( NULL );
+
+    for ( size_t i = 0; i < search->plan.count; i++ )
+        *results += run.results [ i ];
+
+    release_prefetch ( &run );
+    free ( run.results );
+    return status;
+}
+
+/* [exposed function] search_files: search the profiles / *.desc files of every
+ * repository on the `stack` to find any of the given needles, which have been
+ * compiled into the automaton `ac`; see `prepare_search` and `run_search`,
+ * which place the number of results found in `results`. The repositories are
+ * left on the stack. All errors are reduced to be of the type status_t,
+ * allowing for the safe use of provide_gen_error. All sub-functions populate
+ * the global information buffer when appropriate. */
+
+enum status_t search_files ( struct repo_stack_t * stack,
+        char ** needles, int ncount, const struct automaton_t * ac,
+        size_t * results )
+{
+    struct search_t search;
+    const struct search_output_t output = { .fd = STDOUT_FILENO };
+    enum status_t status = STATUS_OK;
+
+    *results = 0;
+    if ( ( status = prepare_search ( &search, stack, ac, NULL, 0 ) )
+            != STATUS_OK )
+        return status;
+
+    if ( ncount > 0 )
+        status = run_search ( &search, needles, ncount, ac, &output,
+                results );
+
+    finish_search ( &search );
+    return status;
+}
+
+/* end_query: terminate the results of the query `number` of a batch, of which
+ * there were `results`, so they can be told apart from those of the next query:
+ * with ARG_FORMAT=ndjson, by an object holding `number` and `results`; with
+ * ARG_COUNT or ARG_EXISTS, by `results` alone, on its own line; and otherwise,
+ * by an empty line, or, with ARG_FORMAT=null, a lone null byte (an empty record
+ * cannot be confused with a result, as the name of the repository comes first).
+ * The output is then flushed, so that the results of each query can be read
+ * before the next is written. Returns zero on success, or -1 on failure, in
+ * which case errno is set. */
+
+static int end_query ( unsigned long number, size_t results )
+{
+    int status = 0;
+
+    if ( option_format == FORMAT_NDJSON )
+        status = printf ( "{\"query\":%lu,\"results\":%zu}\n", number,
+                results );
+    else if ( CHK_ARG ( options, ( ARG_COUNT | ARG_EXISTS ) ) != 0 )
+        status = printf ( "%zu\n", results );
+    else
+        status = putchar ( ( option_format == FORMAT_NULL ) ? '\0' :
+                '\n' );
+
+    return ( status < 0 || fflush ( stdout ) == EOF ) ? -1 : 0;
+}
+
+/* [exposed function] search_batch: search the repositories on the `stack` for
+ * the queries of a batch, read from stdin (see ARG_BATCH and `query_read`). The
+ * repositories, their index, and their files are loaded once (see
+ * `prepare_search`), and each query, with its own options (see
+ * `process_query_args`), is searched in turn, its results being terminated by
+ * `end_query`. A query with invalid options is skipped, with a warning, as if
+ * it had no results. The number of results of every query, in all, is placed in
+ * `results`. Returns as `search_files`. */
+
+enum status_t search_batch ( struct repo_stack_t * stack,
+        size_t * results )
+{
+    struct search_t search;
+    const struct search_output_t output = { .fd = STDOUT_FILENO };
+    struct query_t query;
+    struct automaton_t ac;
+    const opts_t given = options;
+    enum status_t status = STATUS_OK;
+    size_t found = 0;
+    int idx = 0, read = 0;
+
+    *results = 0;
+    if ( ( status = prepare_search ( &search, stack, NULL,
+                    NULL, 0 ) ) != STATUS_OK )
+        return status;
+
+    query_init ( &query );
+    while ( status == STATUS_OK &&
+            ( read = query_read ( &query, stdin ) ) == 1 ) {
+        found = 0;
+
+        if ( process_query_args ( query.count, query.words, &idx,
+                    ARG_QUERY_OPTIONS ) == 0
+                && idx < query.count ) {
+            if ( automaton_build ( &ac, & ( query.words [ idx ] ),
+                        query.count - idx, CHK_ARG ( options,
+                            ARG_SEARCH_NO_CASE ) != 0,
+                        option_engine ) == -1 ) {
+                populate_info_buffer ( "Needle automaton" );
+                status = STATUS_ERRNO;
+            } else {
+                status = run_search ( &search, & ( query.words [ idx ] ),
+                        query.count - idx, &ac, &output, &found );
+                automaton_free ( &ac );
+            }
+        }
+
+        options = given;
+        *results += found;
+
+        if ( status == STATUS_OK && end_query ( query.number, found )
+                == -1 ) {
+            populate_info_buffer ( "Standard output" );
+            status = ( errno == EPIPE ) ? STATUS_CLOSED : STATUS_ERRNO;
+        }
+    }
+
+    if ( read == -1 )
+        status = STATUS_ERRNO;
+
+    query_free ( &query );
+    finish_search ( &search );
+    return status;
+}
+
+/* socket_path: the path of the socket of the daemon; that of ARG_SOCKET, or
+ * otherwise `daemon_default_path`, which is placed in `path`. Returns NULL if
+ * the latter is too long, or its directory is not private to the user, in
+ * which case errno is set. */
+
+static const char * socket_path ( char path [ DAEMON_PATH_MAX ] )
+{
+    if ( option_socket != NULL )
+        return option_socket;
+
+    return ( daemon_default_path ( path ) == -1 ) ? NULL : path;
+}
+
+/* ARG_CLIENT_LOCAL: the options which only a search in this process honours, as
+ * they change the repositories, or are not searches; see `search_daemon`. */
+#define ARG_CLIENT_LOCAL ( ARG_LIST_REPOS | ARG_ATTEMPT_PORTDIR | \
+        ARG_BUILD_INDEX | ARG_BATCH )
+
+/* [exposed function] search_daemon: have the daemon search for the `ncount`
+ * `needles`, with the options of ARG_CLIENT_OPTIONS (see ARG_CLIENT), relaying
+ * the results to stdout, and placing their number in `results`. `served` is set
+ * if the daemon answered, in which case the status of its search is returned,
+ * as that of `search_files`. Otherwise, nothing has been written, and the
+ * caller should search for the needles itself: no daemon is running, the daemon
+ * rejected the query, or the query cannot be passed to it, as an option of
+ * ARG_CLIENT_LOCAL is set, or a needle is empty or contains QUERY_BLANKS. */
+
+enum status_t search_daemon ( char ** needles, int ncount,
+        size_t * results, int * served )
+{
+    char request [ BUFFER_SZ ], buffer [ DAEMON_PATH_MAX ];
+    const char * path = NULL;
+    enum daemon_reply_t reply = DAEMON_ABSENT;
+    size_t len = 0, needle_len = 0;
+
+    *served = 0;
+    *results = 0;
+    if ( CHK_ARG ( options, ARG_CLIENT_LOCAL ) != 0 ||
+            ( path = socket_path ( buffer ) ) == NULL ||
+            unparse_args ( request, sizeof ( request ) ) == -1 )
+        return STATUS_OK;
+
+    len = strlen ( request );
+    for ( int i = 0; i < ncount; i++ ) {
+        /* each needle is a word of the request */
+        needle_len = strlen ( needles [ i ] );
+        if ( needle_len == 0 || strpbrk ( needles [ i ], QUERY_BLANKS )
+                != NULL || len + needle_len + 2 > sizeof ( request ) )
+            return STATUS_OK;
+
+        request [ len++ ] = ' ';
+        memcpy ( & ( request [ len ] ), needles [ i ], needle_len );
+        len += needle_len;
+    }
+
+    request [ len++ ] = '\n';
+    fflush ( stdout );
+
+    if ( ( reply = daemon_request ( path, request, len, STDOUT_FILENO,
+                    results ) ) == DAEMON_ABSENT ||
+            reply == DAEMON_REJECTED )
+        return STATUS_OK;
+
+    *served = 1;
+    if ( reply == DAEMON_ERRNO )
+        return ( errno == EPIPE ) ? STATUS_CLOSED : STATUS_ERRNO;
+
+    return ( reply == DAEMON_FAILED ) ? STATUS_REMOTE : STATUS_OK;
+}
+
+/* portdir_makeconf: attempt to extract the value from the "PORTDIR" key-value
+ * pair in $PORTAGE_CONFIGROOT/make.conf. On success, this function returns
+ * STATUS_OK. The caller can determine whether a key has been found by testing
+ * the first character of `value` for a null-terminator. There is no requirement
+ * to confer with the error buffer here, as errors are non-fatal. */
+
+static enum status_t portdir_makeconf ( char base [ PATH_MAX ],
+        char value [ PATH_MAX ] )
+{
+    char buffer [ BUFFER_SZ ];
+    struct source_t src = SOURCE_INIT;
+    enum status_t status = STATUS_OK;
+    ssize_t len = 0;
+
+    if ( construct_path ( value, base, PORTAGE_MAKECONF ) == -1 ||
+            source_open ( &src, AT_FDCWD, value ) == -1 )
+        return STATUS_ERRNO;
+
+    value [ 0 ] = '\0';
+    len = source_read ( &src, buffer, PATH_MAX - 1 );
+    source_close ( &src );
+
+    if ( len == -1 )
+        return STATUS_ERRNO;
+
+    buffer [ len ] = '\0';
+
+    if ( ( status = get_keyval_value ( value, buffer, "PORTDIR" ) )
+            != STATUS_OK )
+        return ( status == STATUS_INILOC ) ? STATUS_OK : status;
+    else
+        /* Extraneous obliques make no difference when placed as prefixes
+         * and suffixes to a UNIX path. */
+        replace_char ( value, '"', '/' );
+
+    return STATUS_OK;
+}
+
+/* portdir_complain: issue an appropriate warning regarding the existence of
+ * PORTDIR; this can be disabled entirely using ARG_NO_COMPLAINING. If
+ * ARG_LIST_REPOS is also set, a further warning is issued stating that a
+ * session with PORTDIR renders a repository-listing useless. */
+
+static void portdir_complain ( )
+{
+    if ( CHK_ARG ( options, ARG_NO_COMPLAINING ) == 0 ) {
+        print_warning ( WARNING_PDEXT, &provide_gen_warning );
+        putchar ( '\n' );
+
+        if ( CHK_ARG ( options, ARG_LIST_REPOS ) != 0 ) {
+            print_warning ( WARNING_PDLST, &provide_gen_warning );
+            putchar ( '\n' );
+        }
+    }
+}
+
+/* portdir_attempt_envvar: attempt to retrieve the value of PORTDIR from the
+ * environment variable string with getenv(3). If, for any reason, this cannot
+ * be completed, -1 is returned; this is not necessarily a fatal error, and
+ * should not be treated as such. On success, the repository is pushed to the
+ * stack, and zero is returned. */
+
+static int portdir_attempt_envvar ( struct repo_stack_t * stack )
+{
+    char * value = getenv ( "PORTDIR" );
+
+    if ( value != NULL && strlen ( value ) < PATH_MAX &&
+            stack_push ( stack, DEFAULT_REPO_NAME, value ) == 0 ) {
+        portdir_complain ( );
+        return 0;
+    }
+
+    return -1;
+}
+
+/* portdir_attempt_file: this function exhibits very similar behaviour to
  * portdir_attempt_envvar, except it confers with a file instead of the
  * environment variables. Similar to portdir_attempt_envvar, this function can
- * dynamically allocate some memory on the stack (free with stack_cleanse), and
- * errors should not be treat as fatal. */
+ * push a repository to the stack (free with stack_cleanse), and errors should
+ * not be treat as fatal. */
 
 static int portdir_attempt_file ( struct repo_stack_t * stack,
         char base [ PATH_MAX ] )
 {
-    struct repo_t * tmp_repo = NULL;
+    char location [ PATH_MAX ];
 
-    if ( ( tmp_repo = malloc ( sizeof ( struct repo_t ) ) ) != NULL ) {
-        if ( portdir_makeconf ( base, tmp_repo->location )
-                != STATUS_OK ) {
-            free ( tmp_repo );
-            return -1;
-        }
-
-        if ( tmp_repo->location [ 0 ] != '\0' ) {
-            strcpy ( tmp_repo->name, DEFAULT_REPO_NAME );
-            stack_push ( stack, tmp_repo );
-            portdir_complain ( );
-
-            return 0;
-        } else
-            free ( tmp_repo );
+    if ( portdir_makeconf ( base, location ) == STATUS_OK &&
+            location [ 0 ] != '\0' &&
+            stack_push ( stack, DEFAULT_REPO_NAME, location ) == 0 ) {
+        portdir_complain ( );
+        return 0;
     }
 
     return -1;
 }
 
-/* get_repos: populate the stack with a list of repositories, returning
- * STATUS_OK on success; confer with get_base_dir, enumerate_repo_descriptions,
- * and their derivatives for more explicit information regrading the potential
- * errors. This function first attempts to find the deprecated PORTDIR value,
- * either as an environment value, or as a key-value pair in PORTAGE_MAKECONF.
- * If this is found, it is used in favour of repos.conf/, but a warning is
- * issued as a means of encouraging users to drop deprecated features. If, for
- * any reason, PORTDIR cannot be taken from one of the two sources, the standard
- * repos.conf/ mechanism is used.
- *
- * If this function is successful, it dynamically allocates some memory for each
- * of the encountered repositories and pushes them to the `stack`, which can be
- * recursively cleaned/freed with stack_cleanse. If it fails at any stage, the
- * caller needn't free the stack. If the PORTDIR mechanism is used, the stack
- * contains one item, as PORTDIR-era systems did not facilitate multiple Portage
- * repositories. */
-
-static enum status_t get_repos ( char base [ PATH_MAX ],
+/* [exposed function] get_repos: populate the stack with a list of repositories,
+ * returning STATUS_OK on success; confer with get_base_dir,
+ * enumerate_repo_descriptions, and their derivatives for more explicit
+ * information regrading the potential errors. This function first attempts to
+ * find the deprecated PORTDIR value, either as an environment value, or as a
+ * key-value pair in PORTAGE_MAKECONF. If this is found, it is used in favour of
+ * repos.conf/, but a warning is issued as a means of encouraging users to drop
+ * deprecated features. If, for any reason, PORTDIR cannot be taken from one of
+ * the two sources, the standard repos.conf/ mechanism is used. If this function
+ * is successful, it registers each of the encountered repositories on the
+ * `stack`, which can be released at once with stack_cleanse. If it fails at
+ * any stage, the caller needn't free the stack. If the PORTDIR mechanism is
+ * used, the stack contains one item, as PORTDIR-era systems did not facilitate
+ * multiple Portage repositories. The repository-description files are sought
+ * in the `configroot` directory, or, if it is NULL, in $PORTAGE_CONFIGROOT, or
+ * /etc/portage. */
+
+enum status_t get_repos ( char base [ PATH_MAX ], const char * configroot,
         struct repo_stack_t * stack )
 {
     enum status_t status = STATUS_OK;
-    char * base_ptr = NULL;
     stack_init ( stack );
 
+    if ( configroot == NULL &&
+            ( configroot = getenv ( CONFIGROOT_ENVNAME ) ) == NULL )
+        configroot = CONFIGROOT_DEFAULT;
+
     /* construct the base path */
-    if ( construct_path ( base, ( base_ptr = getenv ( CONFIGROOT_ENVNAME ) )
-                != NULL ? base_ptr : CONFIGROOT_DEFAULT,
-            CONFIGROOT_SUFFIX ) == -1 )
+    if ( construct_path ( base, configroot, CONFIGROOT_SUFFIX ) == -1 )
         return STATUS_ERRNO;
 
 
@@ -1271,79 +2356,702 @@ static enum status_t get_repos ( char base [ PATH_MAX ],
     return STATUS_OK;
 }
 
-/* prelim_checks: perform some preliminary checks, primarily revolving around
- * the argument-processing stage. This function returns zero on success, -1 on
- * hard-failure, and 1 on soft-failure (the program should probably terminate,
- * but not return a failing status code). `argc` and `argv` should be the raw
- * values provided by the environment, and `arg_idx` is the index, in `argv`, of
- * the first non-argument entry. */
+/* snapshot_t: the repositories of the daemon (see ARG_DAEMON), and the search
+ * prepared for them, as they were at one time. A snapshot is replaced whenever
+ * the files change (see `refresh_snapshot`), but a query keeps the snapshot in
+ * which it began until it ends, so `refs` counts the queries holding it, and
+ * the daemon itself while it is current; the last to release it frees it. */
+
+struct snapshot_t {
+    struct repo_stack_t stack;
+    struct search_t search;
+    unsigned long refs;
+};
+
+/* serve_t: the state shared by the threads of the daemon (see ARG_DAEMON): the
+ * `current` snapshot, the options given to the daemon, upon which those of
+ * each query are built, and the `base` directory of the repositories. `lock`
+ * guards `current` and the counts of every snapshot; it is only held to take or
+ * release a snapshot, never while it is searched or prepared. `watch` belongs
+ * to the thread following the changes of the files (see `follow_changes`). */
+
+struct serve_t {
+    pthread_mutex_t lock;
+    struct snapshot_t * current;
+    opts_t options;
+    char base [ PATH_MAX ];
+    struct watch_t watch;
+};
+
+/* acquire_snapshot: take the current snapshot of the daemon `serve`, which is
+ * held until it is released with `release_snapshot`. */
+
+static struct snapshot_t * acquire_snapshot ( struct serve_t * serve )
+{
+    struct snapshot_t * snap = NULL;
+
+    pthread_mutex_lock ( & ( serve->lock ) );
+    ( snap = serve->current )->refs++;
+    pthread_mutex_unlock ( & ( serve->lock ) );
+    return snap;
+}
+
+/* free_snapshot: release the search and the repositories of `snap`, and the
+ * snapshot itself. */
+
+static void free_snapshot ( struct snapshot_t * snap )
+{
+    finish_search ( & ( snap->search ) );
+    stack_cleanse ( & ( snap->stack ) );
+    free ( snap );
+}
+
+/* release_snapshot: release a hold on the snapshot `snap` of the daemon
+ * `serve`, freeing it if it was the last. */
+
+static void release_snapshot ( struct serve_t * serve,
+        struct snapshot_t * snap )
+{
+    unsigned long refs = 0;
+
+    pthread_mutex_lock ( & ( serve->lock ) );
+    refs = --snap->refs;
+    pthread_mutex_unlock ( & ( serve->lock ) );
+
+    if ( refs == 0 )
+        free_snapshot ( snap );
+}
+
+/* publish_snapshot: make `snap` the current snapshot of the daemon `serve`.
+ * The queries which are under way finish in the snapshot it replaces, and
+ * every later query is searched in `snap`. */
 
-static int prelim_checks ( int argc, char ** argv, int * arg_idx )
+static void publish_snapshot ( struct serve_t * serve,
+        struct snapshot_t * snap )
 {
-    if ( process_args ( argc, argv, arg_idx ) == -1 )
-        return -1; /* process_args invokes print_fatal */
+    struct snapshot_t * old = NULL;
 
-    if ( CHK_ARG ( options, ARG_SHOW_VERSION ) != 0 )
-        print_version_info ( );
+    pthread_mutex_lock ( & ( serve->lock ) );
+    old = serve->current;
+    serve->current = snap;
+    pthread_mutex_unlock ( & ( serve->lock ) );
+
+    if ( old != NULL )
+        release_snapshot ( serve, old );
+}
+
+/* make_snapshot: prepare a search of the repositories on the `stack`, which are
+ * taken by the new snapshot, whatever the outcome, leaving the stack empty. As
+ * a snapshot is kept by a daemon or a library context until it is replaced,
+ * the search is `lasting` (see `prepare_search`). The files which are
+ * unchanged are shared with the `previous` snapshot, if any, which must be held
+ * until this function returns. On success, STATUS_OK is returned, and `snap` is
+ * held once, for the daemon. On failure, the status of the failure is
+ * returned. */
+
+static enum status_t make_snapshot ( struct repo_stack_t * stack,
+        const struct snapshot_t * previous, struct snapshot_t ** snap )
+{
+    enum status_t status = STATUS_OK;
 
-    if ( CHK_ARG ( options, ARG_SHOW_HELP ) != 0 ) {
-        print_help_info ( argv [ 0 ] );
-        return 1; /* show help and quit */
+    if ( ( *snap = malloc ( sizeof ( **snap ) ) ) == NULL ) {
+        populate_info_buffer ( "Snapshot" );
+        stack_cleanse ( stack );
+        return STATUS_ERRNO;
     }
 
-    if ( argc - *arg_idx <= 0 ) {
-        populate_info_buffer ( NULL ); /* no queries; nothing to do */
-        print_warning ( WARNING_QNONE, &provide_gen_warning );
-        return 1;
+    ( *snap )->stack = *stack;
+    ( *snap )->refs = 1;
+    stack_init ( stack );
+
+    if ( ( status = prepare_search ( & ( ( *snap )->search ),
+                    & ( ( *snap )->stack ), NULL, ( previous != NULL ) ?
+                    & ( previous->search ) : NULL, 1 ) ) != STATUS_OK ) {
+        stack_cleanse ( & ( ( *snap )->stack ) );
+        free ( *snap );
     }
 
+    return status;
+}
+
+/* watch_repos: watch the directories of the repositories on the `stack` in
+ * which USE-description files may appear, or be removed: the location of each,
+ * its profiles/ directory, and profiles/desc/. Returns zero on success, or -1
+ * on failure, in which case errno and the information buffer are set. */
+
+static int watch_repos ( struct watch_t * watch, struct repo_stack_t * stack )
+{
+    struct repo_t * repo = NULL;
+    char path [ PATH_MAX ];
+
+    for ( unsigned long i = 0; ( repo = stack_repo ( stack, i ) ) != NULL;
+            i++ )
+        if ( watch_add ( watch, repo->location ) == -1 ||
+                construct_path ( path, repo->location, "/profiles" ) == -1
+                || watch_add ( watch, path ) == -1 ||
+                construct_path ( path, NULL, "/desc" ) == -1 ||
+                watch_add ( watch, path ) == -1 )
+            return -1;
+
     return 0;
 }
 
-/* main: entry point for owd-euses. See args.h for a list and description of the 
- * accepted arguments. EXIT_SUCCESS does not necessarily imply a complete
- * execution, but only indicates that no "hard" error was encountered.
- *
- * Syntax: [OPTION]... [SUBSTRING]... */
+/* refresh_snapshot: reload the repositories of the daemon `serve`, and publish
+ * a new snapshot of them (see `publish_snapshot`), in which only the files
+ * which have changed are read again (see `prepare_search`). The directories
+ * are watched with `next` before they are read, so a change made while they
+ * are is not missed, but seen by the next wait. On failure, the status of the
+ * failure is returned, `next` is released, and the current snapshot is kept;
+ * otherwise, STATUS_OK, and `next` should replace the watch of `serve`. */
 
-int main ( int argc, char ** argv )
+static enum status_t refresh_snapshot ( struct serve_t * serve,
+        struct watch_t * next )
 {
+    struct repo_stack_t stack;
+    struct snapshot_t * previous = NULL, * snap = NULL;
     char base [ PATH_MAX ];
-    struct repo_stack_t repo_stack;
     enum status_t status = STATUS_OK;
-    int arg_idx = 0, prelim_status = 0;
 
+    if ( watch_init ( next ) == -1 )
+        return STATUS_ERRNO;
+
+    if ( watch_add ( next, serve->base ) == -1 )
+        status = STATUS_ERRNO;
+    else if ( populate_info_buffer ( serve->base ),
+            ( status = get_repos ( base, NULL, &stack ) ) == STATUS_OK ) {
+        if ( watch_repos ( next, &stack ) == -1 ) {
+            stack_cleanse ( &stack );
+            status = STATUS_ERRNO;
+        } else {
+            previous = acquire_snapshot ( serve );
+            status = make_snapshot ( &stack, previous, &snap );
+            release_snapshot ( serve, previous );
+        }
+    }
+
+    if ( status != STATUS_OK ) {
+        watch_free ( next );
+        return status;
+    }
+
+    publish_snapshot ( serve, snap );
+    return STATUS_OK;
+}
+
+/* stop_following: warn that the repositories of the daemon `serve` are no
+ * longer followed, for the reason in errno and the information buffer, and
+ * release its watch; the current snapshot is kept for good. */
+
+static void stop_following ( struct serve_t * serve )
+{
+    print_warning ( WARNING_ERRNO, &provide_gen_warning );
+    populate_info_buffer ( NULL );
+    print_warning ( WARNING_FROZEN, &provide_gen_warning );
+    watch_free ( & ( serve->watch ) );
+}
+
+/* follow_changes: the routine of the thread of the daemon `serve` (passed as
+ * `arg`) which waits for the repositories to change, and refreshes the current
+ * snapshot whenever they do, until the daemon is stopped. A snapshot which
+ * cannot be refreshed is kept until the next change, with a warning; if the
+ * changes cannot be waited for, see `stop_following`. */
+
+static void * follow_changes ( void * arg )
+{
+    struct serve_t * serve = arg;
+    struct watch_t next;
+    enum status_t status = STATUS_OK;
+
+    /* the repositories are only listed as the daemon starts */
+    options = serve->options & ~ARG_LIST_REPOS;
+
+    while ( watch_wait ( & ( serve->watch ) ) == 0 )
+        if ( ( status = refresh_snapshot ( serve, &next ) ) != STATUS_OK )
+            print_warning ( status, &provide_gen_error );
+        else {
+            watch_free ( & ( serve->watch ) );
+            serve->watch = next;
+        }
+
+    stop_following ( serve );
+    return NULL;
+}
+
+/* serve_client: search for the query of the client connected to `fd`, writing
+ * its results, then its trailer, to the client; see daemon.h. The options of
+ * ARG_CLIENT_OPTIONS are those of the query, and the others those given to the
+ * daemon. Each client is served by a thread of its own, and the options of the
+ * query are those of that thread, so the other clients are unaffected. A query
+ * with invalid options is rejected, with a warning, and a failed search is
+ * reported to the client; both are logged to the stderr of the daemon. This
+ * function always returns zero, as the daemon carries on regardless; see
+ * `daemon_serve`. */
+
+static int serve_client ( void * shared, int fd )
+{
+    struct serve_t * serve = shared;
+    struct snapshot_t * snap = NULL;
+    const struct search_output_t output = { .fd = fd };
+    struct query_t query;
+    struct automaton_t ac;
+    enum daemon_reply_t reply = DAEMON_REJECTED;
+    enum status_t status = STATUS_OK;
+    FILE * fp = NULL;
+    size_t found = 0;
+    int idx = 0;
+
+    options = serve->options & ~ARG_CLIENT_OPTIONS;
+    option_format = FORMAT_TEXT;
+    option_max_count = 0;
+
+    if ( ( fp = fdopen ( fd, "r" ) ) == NULL ) {
+        close ( fd );
+        return 0;
+    }
+
+    query_init ( &query );
+    if ( query_read ( &query, fp ) == 1 && process_query_args ( query.count,
+                query.words, &idx, ARG_CLIENT_OPTIONS ) == 0 &&
+            idx < query.count ) {
+        if ( automaton_build ( &ac, & ( query.words [ idx ] ),
+                    query.count - idx, CHK_ARG ( options,
+                        ARG_SEARCH_NO_CASE ) != 0, option_engine ) == -1 ) {
+            populate_info_buffer ( "Needle automaton" );
+            status = STATUS_ERRNO;
+        } else {
+            snap = acquire_snapshot ( serve );
+            status = run_search ( & ( snap->search ),
+                    & ( query.words [ idx ] ), query.count - idx, &ac,
+                    &output, &found );
+            release_snapshot ( serve, snap );
+            automaton_free ( &ac );
+        }
+
+        reply = ( status == STATUS_OK ) ? DAEMON_OK : DAEMON_FAILED;
+    }
+
+    if ( status == STATUS_ERRNO )
+        print_warning ( status, &provide_gen_error );
+
+    if ( status != STATUS_CLOSED )
+        /* the client is still there */
+        daemon_reply ( fd, reply, found );
+
+    query_free ( &query );
+    fclose ( fp );
+    return 0;
+}
+
+/* [exposed function] serve_queries: search the repositories on the `stack`, the
+ * repository- description `base` directory of which has been read by
+ * `get_repos`, for the queries of the clients of the daemon, until it is
+ * stopped (see ARG_DAEMON, and daemon.h). The repositories, their index, and
+ * every one of their files are loaded once, into a snapshot (see `snapshot_t`),
+ * which is then only read, so the queries of the clients are searched at once,
+ * each by a pool of its own, without a lock between them. The repositories are
+ * taken from the `stack`, which is left empty. The directories of the
+ * repositories are watched, and the snapshot is replaced whenever they change;
+ * if they cannot be watched, the daemon serves the first snapshot alone, with a
+ * warning. This function only returns on failure, as `search_files`. */
+
+enum status_t serve_queries ( struct repo_stack_t * stack,
+        const char base [ PATH_MAX ] )
+{
+    /* static, as the clients and the watch thread are left to the exit of
+     * the process, and may still use it */
+    static struct serve_t serve = { .current = NULL, .watch = { .fd = -1 } };
+    struct snapshot_t * snap = NULL;
+    pthread_t follower;
+    char buffer [ DAEMON_PATH_MAX ];
+    const char * path = NULL;
+    enum status_t status = STATUS_OK;
+
+    if ( ( path = socket_path ( buffer ) ) == NULL ) {
+        populate_info_buffer ( "Socket path" );
+        return STATUS_ERRNO;
+    }
+
+    serve.options = options;
+    strcpy ( serve.base, base );
+
+    /* watched before the files are loaded; see `refresh_snapshot` */
+    if ( watch_init ( & ( serve.watch ) ) == -1 ||
+            watch_add ( & ( serve.watch ), base ) == -1 ||
+            watch_repos ( & ( serve.watch ), stack ) == -1 )
+        stop_following ( &serve );
+
+    if ( ( status = make_snapshot ( stack, NULL, &snap ) ) != STATUS_OK ) {
+        watch_free ( & ( serve.watch ) );
+        return status;
+    }
+
+    pthread_mutex_init ( & ( serve.lock ), NULL );
+    publish_snapshot ( &serve, snap );
+
+    if ( serve.watch.fd != -1 && ( errno = pthread_create ( &follower, NULL,
+                    &follow_changes, &serve ) ) != 0 ) {
+        populate_info_buffer ( "Watch thread" );
+        stop_following ( &serve );
+    }
+
+    daemon_serve ( path, &serve_client, &serve );
+    return STATUS_ERRNO;
+}
+
+/* euses_t: a context of the library; see libeuses.h. Its repositories, and the
+ * search prepared for them, are held in a snapshot, `snap`, as those of the
+ * daemon are, so that a context which is loaded again shares the files which
+ * are unchanged (see `make_snapshot`). `needles` are copies of those compiled
+ * into `ac`, if `compiled` is set. `options` are those of the context, which
+ * are given to the calling thread for the duration of each call (see
+ * `enter_context`). `deliver`, `data`, `delivered`, and `stopped` belong to
+ * the search under way; see `deliver_results`. */
+
+struct euses_t {
+    struct snapshot_t * snap;
+    struct automaton_t ac;
+    char ** needles;
+    int ncount, compiled, stopped;
+    opts_t options;
+    int ( * deliver ) ( const struct euses_result_t *, void * );
+    void * data;
+    size_t delivered;
+    char error [ ERROR_MAX * 2 ];
+};
+
+/* thread_options_t: the per-thread options of a thread calling the library,
+ * which are restored as the call returns; see `enter_context`. */
+
+struct thread_options_t {
+    opts_t options;
+    enum format_t format;
+    unsigned long max_count;
+};
+
+/* enter_context: replace the per-thread options of the calling thread with
+ * those of the context `ctx`, keeping the former in `saved`, as every part of
+ * a search reads the options of the thread running it. The results of the
+ * library are always printed with ARG_FORMAT=null, to be parsed by
+ * `deliver_results`. See `leave_context`. */
+
+static void enter_context ( const struct euses_t * ctx,
+        struct thread_options_t * saved )
+{
+    saved->options = options;
+    saved->format = option_format;
+    saved->max_count = option_max_count;
+
+    options = ctx->options;
+    option_format = FORMAT_NULL;
+    option_max_count = 0;
     info_buffer [ 0 ] = '\0';
+}
+
+/* leave_context: restore the per-thread options `saved` by `enter_context`. */
+
+static void leave_context ( const struct thread_options_t * saved )
+{
+    options = saved->options;
+    option_format = saved->format;
+    option_max_count = saved->max_count;
+}
+
+/* context_failure: describe the failure `status` of a call on `ctx`, with the
+ * information buffer, for `euses_error`. errno is left as it was if `status`
+ * is STATUS_ERRNO, or otherwise set to EINVAL, as every other status is that
+ * of an invalid repository configuration. Returns -1. */
+
+static int context_failure ( struct euses_t * ctx, enum status_t status )
+{
+    const int error = ( status == STATUS_ERRNO ) ? errno : EINVAL;
+
+    snprintf ( ctx->error, sizeof ( ctx->error ), "%s%s%s", info_buffer,
+            ( info_buffer [ 0 ] != '\0' ) ? ": " : "",
+            provide_gen_error ( status ) );
+    errno = error;
+    return -1;
+}
+
+/* context_invalid: as `context_failure`, for a call on `ctx` with invalid
+ * arguments, which are described by `reason`. */
+
+static int context_invalid ( struct euses_t * ctx, const char * reason )
+{
+    snprintf ( ctx->error, sizeof ( ctx->error ), "%s", reason );
+    errno = EINVAL;
+    return -1;
+}
+
+/* [exposed function] euses_new: return a new context, which has neither been
+ * loaded nor compiled, or NULL on failure, in which case errno is set. */
+
+struct euses_t * euses_new ( void )
+{
+    return calloc ( 1, sizeof ( struct euses_t ) );
+}
+
+/* free_needles: release the `count` copies of the needles in `needles`. */
+
+static void free_needles ( char ** needles, int count )
+{
+    for ( int i = 0; needles != NULL && i < count; i++ )
+        free ( needles [ i ] );
+
+    free ( needles );
+}
+
+/* [exposed function] euses_free: release the context `ctx`, if it is not NULL,
+ * with its repositories and needles. */
+
+void euses_free ( struct euses_t * ctx )
+{
+    if ( ctx == NULL )
+        return;
+
+    if ( ctx->snap != NULL )
+        free_snapshot ( ctx->snap );
+
+    if ( ctx->compiled )
+        automaton_free ( & ( ctx->ac ) );
+
+    free_needles ( ctx->needles, ctx->ncount );
+    free ( ctx );
+}
+
+/* compile_needles: replace the needles of `ctx` with copies of the `count`
+ * `needles`, compiling them with the options of the calling thread (see
+ * `enter_context`); `needles` may be those of `ctx` itself. An empty set of
+ * needles is not compiled, as it finds nothing. On failure, the needles of
+ * `ctx` are kept, and STATUS_ERRNO is returned. */
 
-    if ( ( prelim_status = prelim_checks ( argc, argv, &arg_idx ) ) == -1 )
-        return EXIT_FAILURE;
-    else if ( status == 1 )
-        return EXIT_SUCCESS;
+static enum status_t compile_needles ( struct euses_t * ctx,
+        char * const * needles, int count )
+{
+    struct automaton_t ac;
+    char ** copies = NULL;
+
+    populate_info_buffer ( "Needles" );
+    if ( count > 0 && ( copies = calloc ( count, sizeof ( *copies ) ) )
+            == NULL )
+        return STATUS_ERRNO;
+
+    for ( int i = 0; i < count; i++ )
+        if ( ( copies [ i ] = strdup ( needles [ i ] ) ) == NULL ) {
+            free_needles ( copies, i );
+            return STATUS_ERRNO;
+        }
+
+    populate_info_buffer ( "Needle automaton" );
+    if ( count > 0 && automaton_build ( &ac, copies, count, CHK_ARG ( options,
+                    ARG_SEARCH_NO_CASE ) != 0, option_engine ) == -1 ) {
+        free_needles ( copies, count );
+        return STATUS_ERRNO;
+    }
+
+    if ( ctx->compiled )
+        automaton_free ( & ( ctx->ac ) );
+
+    free_needles ( ctx->needles, ctx->ncount );
+    ctx->needles = copies;
+    ctx->ncount = count;
+    ctx->compiled = ( count > 0 );
+    if ( ctx->compiled )
+        ctx->ac = ac;
+
+    return STATUS_OK;
+}
+
+/* [exposed function] euses_load: load the repositories described in the
+ * `configroot` directory (see `get_repos`), with the `flags` (see
+ * euses_flag_t), and prepare every one of their files to be searched by
+ * `euses_search`, as a batch does (see `prepare_search`). A context which was
+ * loaded before shares the files which are unchanged with its new load, and
+ * keeps its former load if the new one fails. Needles already compiled with
+ * other flags are compiled again. */
+
+int euses_load ( struct euses_t * ctx, const char * configroot,
+        unsigned int flags )
+{
+    static const struct {
+        unsigned int flag;
+        opts_t option;
+    } flag_options [ ] = {
+        { EUSES_STRICT, ARG_SEARCH_STRICT },
+        { EUSES_NO_CASE, ARG_SEARCH_NO_CASE },
+        { EUSES_PACKAGE, ARG_PKG_FILES_ONLY },
+        { EUSES_GLOBAL, ARG_GLOBAL_ONLY },
+        { EUSES_NO_INDEX, ARG_NO_INDEX },
+        { EUSES_PORTDIR, ARG_ATTEMPT_PORTDIR }
+    };
+    struct thread_options_t saved;
+    struct repo_stack_t stack;
+    struct snapshot_t * snap = NULL;
+    const opts_t given = ctx->options;
+    unsigned int known = 0;
+    char base [ PATH_MAX ];
+    enum status_t status = STATUS_OK;
+
+    /* the library has no terminal to warn on */
+    ctx->options = ARG_NO_MIDBUF_WARN | ARG_NO_COMPLAINING;
+    for ( size_t i = 0; i < sizeof ( flag_options ) /
+            sizeof ( flag_options [ 0 ] ); i++ ) {
+        known |= flag_options [ i ].flag;
+        if ( ( flags & flag_options [ i ].flag ) != 0 )
+            ctx->options |= flag_options [ i ].option;
+    }
 
-    /* push the repositories onto the stack */
-    if ( ( status = get_repos ( base, &repo_stack ) ) != STATUS_OK ) {
-        print_fatal ( "Could not use the repository-description " \
-                "base directory.", status, &provide_gen_error );
-        return EXIT_FAILURE;
+    if ( ( flags & ~known ) != 0 || ( flags & ( EUSES_PACKAGE |
+                    EUSES_GLOBAL ) ) == ( EUSES_PACKAGE | EUSES_GLOBAL ) ) {
+        ctx->options = given;
+        return context_invalid ( ctx, "Unknown or conflicting flags" );
     }
 
-    if ( repo_stack.size == 0 ) {
-        populate_info_buffer ( NULL );
-        print_warning ( WARNING_RNONE, &provide_gen_warning );
-        stack_cleanse ( &repo_stack );
-        return EXIT_SUCCESS;
+    enter_context ( ctx, &saved );
+    if ( ( status = get_repos ( base, configroot, &stack ) ) == STATUS_OK )
+        status = make_snapshot ( &stack, ctx->snap, &snap );
+
+    if ( status == STATUS_OK && ctx->ncount > 0 && CHK_ARG ( ( given ^
+                    ctx->options ), ARG_SEARCH_NO_CASE ) != 0 &&
+            ( status = compile_needles ( ctx, ctx->needles, ctx->ncount ) )
+            != STATUS_OK )
+        free_snapshot ( snap );
+
+    if ( status != STATUS_OK ) {
+        ctx->options = given;
+        leave_context ( &saved );
+        return context_failure ( ctx, status );
     }
 
-    /* buffer and search the repository USE-description files */
-    if ( ( status = search_files ( &repo_stack, & ( argv [ arg_idx ] ), argc
-                    - arg_idx ) ) != STATUS_OK ) {
-        print_fatal ( "Could not load the USE-description files.",
-                status, &provide_gen_error );
-        stack_cleanse ( &repo_stack );
-        return EXIT_FAILURE;
+    if ( ctx->snap != NULL )
+        free_snapshot ( ctx->snap );
+
+    ctx->snap = snap;
+    leave_context ( &saved );
+    return 0;
+}
+
+/* [exposed function] euses_compile: compile the `count` `needles` for every
+ * later search of `ctx`, replacing those compiled before. The needles are
+ * copied, so need not outlive the call. A needle may not contain a line feed,
+ * as the files are searched in chunks of whole lines; see `splittable`. */
+
+int euses_compile ( struct euses_t * ctx, const char * const * needles,
+        int count )
+{
+    struct thread_options_t saved;
+    enum status_t status = STATUS_OK;
+
+    if ( count < 0 || ( count > 0 && needles == NULL ) )
+        return context_invalid ( ctx, "Invalid needle count" );
+
+    for ( int i = 0; i < count; i++ )
+        if ( needles [ i ] == NULL || strchr ( needles [ i ], '\n' )
+                != NULL )
+            return context_invalid ( ctx,
+                    "A needle is NULL or contains a line feed" );
+
+    enter_context ( ctx, &saved );
+    status = compile_needles ( ctx, ( char * const * ) needles, count );
+    leave_context ( &saved );
+
+    return ( status == STATUS_OK ) ? 0 : context_failure ( ctx, status );
+}
+
+/* deliver_results: give each of the results of the `len` bytes of `results`,
+ * printed by a search of the context `data` with ARG_FORMAT=null, to the
+ * callback of the search, in the calling thread; see `euses_search`. Each
+ * piece of the output holds whole results (see pool_job_t), each of which is
+ * FIELD_COUNT null-terminated fields, an empty package being that of a global
+ * flag. Returns zero on success, or -1 if the callback stopped the search, in
+ * which case `stopped` is set, and errno is set to ECANCELED. */
+
+static int deliver_results ( void * data, const char * results, size_t len )
+{
+    struct euses_t * ctx = data;
+    const char * end = results + len, * fields [ FIELD_COUNT ];
+    const char * field_end = NULL;
+    struct euses_result_t result;
+
+    while ( results < end ) {
+        for ( int i = 0; i < FIELD_COUNT; i++ ) {
+            if ( ( field_end = memchr ( results, '\0', end - results ) )
+                    == NULL ) {
+                errno = EPROTO;
+                return -1;
+            }
+
+            fields [ i ] = results;
+            results = field_end + 1;
+        }
+
+        result.repo = fields [ FIELD_REPO ];
+        result.location = fields [ FIELD_LOCATION ];
+        result.package = ( fields [ FIELD_PACKAGE ] [ 0 ] != '\0' ) ?
+            fields [ FIELD_PACKAGE ] : NULL;
+        result.flag = fields [ FIELD_FLAG ];
+        result.description = fields [ FIELD_DESC ];
+        result.needle = fields [ FIELD_NEEDLE ];
+        result.file = fields [ FIELD_FILE ];
+
+        ctx->delivered++;
+        if ( ctx->deliver ( &result, ctx->data ) != 0 ) {
+            ctx->stopped = 1;
+            errno = ECANCELED;
+            return -1;
+        }
     }
 
-    stack_cleanse ( &repo_stack );
-    return EXIT_SUCCESS;
+    return 0;
+}
+
+/* [exposed function] euses_search: search the repositories loaded into `ctx`
+ * for its compiled needles, giving each result, in the order of the
+ * repositories, files, and needles, to `deliver`, with `data`. If `deliver`
+ * returns non-zero, the search stops, and 1 is returned. The number of results
+ * given to `deliver` is placed in `results`, if it is not NULL. */
+
+int euses_search ( struct euses_t * ctx,
+        int ( * deliver ) ( const struct euses_result_t *, void * ),
+        void * data, size_t * results )
+{
+    const struct search_output_t output = { .fd = -1,
+        .emit = &deliver_results, .data = ctx };
+    struct thread_options_t saved;
+    enum status_t status = STATUS_OK;
+    size_t found = 0;
+
+    if ( results != NULL )
+        *results = 0;
+
+    if ( ctx->snap == NULL )
+        return context_invalid ( ctx, "The context has not been loaded" );
+
+    if ( !ctx->compiled )
+        return 0; /* no needles; nothing to find */
+
+    ctx->deliver = deliver;
+    ctx->data = data;
+    ctx->delivered = 0;
+    ctx->stopped = 0;
+
+    enter_context ( ctx, &saved );
+    status = run_search ( & ( ctx->snap->search ), ctx->needles, ctx->ncount,
+            & ( ctx->ac ), &output, &found );
+    leave_context ( &saved );
+
+    if ( results != NULL )
+        *results = ctx->delivered;
+
+    if ( ctx->stopped )
+        return 1;
+
+    return ( status == STATUS_OK ) ? 0 : context_failure ( ctx, status );
 }
 
+/* [exposed function] euses_error: return a description of the last failure of
+ * a call on `ctx`, or an empty string if none has failed. */
+
+const char * euses_error ( const struct euses_t * ctx )
+{
+    return ctx->error;
+}
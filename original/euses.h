@@ -5,6 +5,7 @@
 #define EUSES_H
 
 #include <limits.h>
+#include <stdio.h>
 
 #define PROGRAM_NAME     "owd-euses-placemewnt"
 #define PROGRAM_AUTHOR       "Oliver Dixon"
@@ -15,12 +16,50 @@
 #define PROGRAM_LICENCE_NAME "MIT Licence"
 #define PROGRAM_LICENCE_URL  "https://mit-license.org/"
 
+/* repo_t: a repository, as registered on a repo_stack_t, which holds its
+ * `location` and `name`. */
+
 struct repo_t {
-    char location [ PATH_MAX ], name [ NAME_MAX + 1 ];
-    struct repo_t * next;
+    const char * location, * name;
+};
+
+enum status_t {
+    STATUS_ERRNO  =  1, /* c.f. perror or strerror on errno */
+    STATUS_OK     =  0, /* everything is OK */
+    STATUS_NOREPO = -1, /* no repository-description files were found */
+    STATUS_NOGENR = -2, /* no gentoo.conf repository-description file */
+    STATUS_ININME = -3, /* the ini file did not contain "[name]" */
+    STATUS_INILOC = -4, /* the location attribute doesn't exist */
+    STATUS_INILCS = -5, /* the location value exceeded PATH_MAX - 1 */
+    STATUS_INIEMP = -6, /* the repository-description file was empty */
+    STATUS_CLOSED = -7, /* the reader of the output has gone (EPIPE) */
+    STATUS_REMOTE = -8  /* the search failed in the daemon; see ARG_CLIENT */
 };
 
+enum warning_t {
+    WARNING_ERRNO =  1, /* c.f. errno */
+    WARNING_OK    =  0, /* everything is OK */
+    WARNING_RNONE = -1, /* no repositories; nothing to do */
+    WARNING_QNONE = -2, /* no queries; nothing to do */
+    WARNING_TRUNC = -3, /* an entry exceeded the streamed buffer */
+    WARNING_PDEXT = -4, /* PORTDIR was detected */
+    WARNING_PDLST = -5, /* ARG_LIST_REPOS was set with PORTDIR */
+    WARNING_FROZEN = -6 /* the daemon no longer follows the repositories */
+};
+
+struct repo_stack_t;
+struct automaton_t;
+
 int construct_path ( char *, const char *, const char * );
+const char * provide_gen_error ( int );
+const char * provide_gen_warning ( int );
+enum status_t get_repos ( char [ PATH_MAX ], const char *,
+        struct repo_stack_t * );
+enum status_t search_files ( struct repo_stack_t *, char **, int,
+        const struct automaton_t *, size_t * );
+enum status_t search_batch ( struct repo_stack_t *, size_t * );
+enum status_t search_daemon ( char **, int, size_t *, int * );
+enum status_t serve_queries ( struct repo_stack_t *, const char [ PATH_MAX ] );
 
 #endif /* EUSES_H */
 
@@ -1,83 +1,287 @@
 /* owd-euses: globbing functions
  * Oliver Dixon. */
 
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 #include "euses.h"
 #include "globbing.h"
 #include "args.h"
 #include "converse.h"
 
+#define DIRENT_BUF_SZ ( 32768 ) /* The getdents64(2) buffer size */
+#define DIR_FLAGS ( O_RDONLY | O_DIRECTORY | O_CLOEXEC )
+
 enum pattern_types_t {
-    PATTERN_STD = 0,
-    PATTERN_PKG = 1,
-    PATTERN_GLB = 2
+    PATTERN_STD = 0, /* "*.desc" */
+    PATTERN_PKG = 1, /* "*.local*.desc"; ARG_PKG_FILES_ONLY */
+    PATTERN_GLB = 2  /* "*[!.local].desc"; ARG_GLOBAL_ONLY */
 };
 
-const char * glob_patterns [ 3 ] [ 2 ] = {
-    /* Globbing patterns relative to the repository base locations. */
-    { "/profiles/*\\.desc", "/profiles/desc/*\\.desc" },
+/* The directories collated, relative to the repository base locations; the
+ * second is also opened relative to the first. */
+static const char * glob_dirs [ 2 ] = { "/profiles/", "/profiles/desc/" };
 
-    /* Patterns for ARG_PKG_FILES_ONLY */
-    { "/profiles/*\\.local*\\.desc", "/profiles/desc/*\\.local*\\.desc" },
+/* linux_dirent64: a directory entry as returned by getdents64(2), which the C
+ * library only declares for _GNU_SOURCE. */
 
-    /* Patterns for ARG_GLOBAL_ONLY */
-    { "/profiles/*[!\\.local]\\.desc",
-        "/profiles/desc/*[!\\.local]\\.desc" }
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name [ ];
 };
 
-/* select_glob_patterns: set the `patterns` to the appropriate globbing
- * patterns, determined by the command-line arguments. `patterns [ 0 ]` is set
- * to the root pattern, and `patterns [ 1 ]` is set to the desc/ variant. */
+/* name_list_t: the null-terminated names collated from the directories, one
+ * after the other, before their paths are made. */
 
-static void select_glob_patterns ( char * patterns [ 2 ] )
-{
-    enum pattern_types_t idx = PATTERN_STD;
+struct name_list_t {
+    char * names;
+    size_t len, capacity;
+};
 
+/* select_glob_patterns: return the patterns selected by the command-line
+ * arguments. */
+
+static enum pattern_types_t select_glob_patterns ( )
+{
     if ( CHK_ARG ( options, ARG_PKG_FILES_ONLY ) != 0 )
-        idx = PATTERN_PKG;
+        return PATTERN_PKG;
     else if ( CHK_ARG ( options, ARG_GLOBAL_ONLY ) != 0 )
-        idx = PATTERN_GLB;
+        return PATTERN_GLB;
 
-    patterns [ 0 ] = ( char * ) glob_patterns [ idx ] [ 0 ];
-    patterns [ 1 ] = ( char * ) glob_patterns [ idx ] [ 1 ];
+    return PATTERN_STD;
 }
 
-/* [exposed function] populate_glob: collate all entries matching repo_base +
- * GLOB_PATTERN_ {ROOT,DESC} in the glob_buf using glob(3).  This function
- * returns -1 on failure---in which case errno and the information buffer are
- * set appropriately, and zero on success.  It is the responsibility of the
- * caller to use globfree(3) for cleaning up the static allocations of glob. */
+/* name_matches: return non-zero if the file `name` matches the patterns of
+ * `idx`, exactly as glob(3) would match it. A leading period is never matched
+ * by a wildcard, so hidden files (and the "." and ".." entries) are excluded.
+ * The set of PATTERN_GLB is that of the characters ".loca", rather than the
+ * string, so the last character before ".desc" must be none of them. */
 
-int populate_glob ( char repo_base [ NAME_MAX + 1 ], glob_t * glob_buf )
+static int name_matches ( const char * name, enum pattern_types_t idx )
 {
-    int status = 0;
-    unsigned int base_len = strlen ( repo_base );
-    char * patterns [ 2 ];
+    const size_t len = strlen ( name );
+    const char * local = NULL;
 
-    glob_buf->gl_pathc = 0;
-    select_glob_patterns ( patterns );
+    if ( name [ 0 ] == '.' || len < 6 || strcmp ( & ( name [ len - 5 ] ),
+                ".desc" ) != 0 )
+        return 0;
 
-    if ( construct_path ( repo_base, NULL, patterns [ 0 ] ) == -1 )
-        return -1;
+    switch ( idx ) {
+        case PATTERN_PKG:
+            /* the first ".local" is the only one which may fit */
+            return ( local = strstr ( name, ".local" ) ) != NULL &&
+                ( size_t ) ( local - name ) + 6 <= len - 5;
+        case PATTERN_GLB:
+            return strchr ( ".loca", name [ len - 6 ] ) == NULL;
+        default:
+            return 1;
+    }
+}
+
+/* read_names: append the name of every entry of the directory open at `dir`
+ * matching the patterns of `idx` to `list`, adding their number to `count`. A
+ * directory which cannot be read is taken as having no further entries, as
+ * glob(3) would. Returns zero on success, or -1 on failure, in which case errno
+ * and the information buffer are set appropriately. */
+
+static int read_names ( int dir, enum pattern_types_t idx,
+        struct name_list_t * list, size_t * count )
+{
+    _Alignas ( struct linux_dirent64 ) char buffer [ DIRENT_BUF_SZ ];
+    const struct linux_dirent64 * ent = NULL;
+    char * names = NULL;
+    size_t len = 0, capacity = 0;
+    long got = 0;
+
+    while ( ( got = syscall ( SYS_getdents64, dir, buffer,
+                    sizeof ( buffer ) ) ) > 0 )
+        for ( long pos = 0; pos < got; pos += ent->d_reclen ) {
+            ent = ( const struct linux_dirent64 * ) & ( buffer [ pos ] );
+
+            if ( !name_matches ( ent->d_name, idx ) )
+                continue;
+
+            len = strlen ( ent->d_name ) + 1;
+            if ( list->len + len > list->capacity ) {
+                capacity = ( list->capacity == 0 ) ? 4096 :
+                    list->capacity * 2;
+                if ( capacity < list->len + len )
+                    capacity = list->len + len;
+
+                if ( ( names = realloc ( list->names, capacity ) ) == NULL ) {
+                    populate_info_buffer ( "Name list" );
+                    return -1;
+                }
+
+                list->names = names;
+                list->capacity = capacity;
+            }
 
-    if ( ( status = glob ( repo_base, 0, NULL, glob_buf ) ) == GLOB_NOSPACE
-            || status == GLOB_ABORTED ) {
-        populate_info_buffer ( repo_base );
+            memcpy ( & ( list->names [ list->len ] ), ent->d_name, len );
+            list->len += len;
+            ( *count )++;
+        }
+
+    return 0;
+}
+
+/* compare_entries: order two glob_entry_t by name, as glob(3) would in the C
+ * locale; see qsort(3). */
+
+static int compare_entries ( const void * a, const void * b )
+{
+    return strcmp ( ( ( const struct glob_entry_t * ) a )->name,
+            ( ( const struct glob_entry_t * ) b )->name );
+}
+
+/* make_entries: make the entries of `gl` from the `list` of names read from its
+ * directories, `counts [ i ]` from that with the path `prefix [ i ]`, sorting
+ * those of each directory. Returns as `read_names`. */
+
+static int make_entries ( struct glob_list_t * gl,
+        const struct name_list_t * list, char prefix [ 2 ] [ PATH_MAX ],
+        const size_t counts [ 2 ] )
+{
+    const char * name = list->names;
+    const size_t count = counts [ 0 ] + counts [ 1 ];
+    size_t size = list->len, plen = 0, at = 0, e = 0;
+
+    if ( count == 0 )
+        return 0;
+
+    for ( int i = 0; i < 2; i++ )
+        size += counts [ i ] * strlen ( prefix [ i ] );
+
+    if ( ( gl->entries = malloc ( sizeof ( *gl->entries ) * count ) )
+            == NULL || ( gl->paths = malloc ( size ) ) == NULL ) {
+        populate_info_buffer ( "Glob list" );
         return -1;
     }
 
-    repo_base [ base_len ] = '\0';
-    if ( construct_path ( repo_base, NULL, patterns [ 1 ] ) == -1 )
-        return -1;
+    gl->count = count;
 
-    if ( ( status = glob ( repo_base, GLOB_APPEND, NULL, glob_buf ) )
-            == GLOB_NOSPACE || status == GLOB_ABORTED ) {
-        populate_info_buffer ( repo_base );
-        return -1;
+    for ( int i = 0; i < 2; i++ ) {
+        plen = strlen ( prefix [ i ] );
+
+        for ( size_t n = 0; n < counts [ i ]; n++, e++ ) {
+            gl->entries [ e ].path = & ( gl->paths [ at ] );
+            gl->entries [ e ].name = & ( gl->paths [ at + plen ] );
+            gl->entries [ e ].dir = gl->dirs [ i ];
+
+            memcpy ( & ( gl->paths [ at ] ), prefix [ i ], plen );
+            at += plen;
+            strcpy ( & ( gl->paths [ at ] ), name );
+            at += strlen ( name ) + 1;
+            name += strlen ( name ) + 1;
+        }
+
+        qsort ( & ( gl->entries [ e - counts [ i ] ] ), counts [ i ],
+                sizeof ( *gl->entries ), &compare_entries );
     }
 
-    repo_base [ base_len ] = '\0';
     return 0;
 }
 
+/* glob_with_patterns: collate every entry of the directories of `glob_dirs`
+ * under `repo_base` matching the patterns of `idx` in `gl`; see
+ * `populate_glob`. The directories are read with getdents64(2), and the
+ * entries matched by their names, so nothing is allocated per entry, nor any
+ * path resolved but those of the directories. */
+
+static int glob_with_patterns ( const char * repo_base,
+        struct glob_list_t * gl, enum pattern_types_t idx )
+{
+    char prefix [ 2 ] [ PATH_MAX ];
+    struct name_list_t list = { .names = NULL, .len = 0, .capacity = 0 };
+    size_t counts [ 2 ] = { 0, 0 };
+    int status = 0;
+
+    *gl = ( struct glob_list_t ) GLOB_LIST_INIT;
+
+    for ( int i = 0; i < 2; i++ ) {
+        if ( construct_path ( prefix [ i ], repo_base, glob_dirs [ i ] )
+                == -1 ) {
+            free ( list.names );
+            return -1;
+        }
+
+        gl->dirs [ i ] = ( i == 1 && gl->dirs [ 0 ] != -1 ) ?
+            openat ( gl->dirs [ 0 ], "desc", DIR_FLAGS ) :
+            open ( prefix [ i ], DIR_FLAGS );
+
+        if ( gl->dirs [ i ] != -1 && read_names ( gl->dirs [ i ], idx,
+                    &list, & ( counts [ i ] ) ) == -1 ) {
+            free ( list.names );
+            return -1;
+        }
+    }
+
+    status = make_entries ( gl, &list, prefix, counts );
+    free ( list.names );
+
+    for ( int i = 0; i < 2; i++ )
+        if ( counts [ i ] == 0 && gl->dirs [ i ] != -1 ) {
+            /* nothing will be opened from it */
+            close ( gl->dirs [ i ] );
+            gl->dirs [ i ] = -1;
+        }
+
+    return status;
+}
+
+/* [exposed function] populate_glob: collate every USE-description file of the
+ * repository at `repo_base` selected by the command-line arguments in `gl`.
+ * Missing or unreadable directories are taken as empty. This function returns
+ * -1 on failure---in which case errno and the information buffer are set
+ * appropriately, and zero on success. It is the responsibility of the caller
+ * to release `gl` with `glob_free`, even on failure. */
+
+int populate_glob ( const char * repo_base, struct glob_list_t * gl )
+{
+    return glob_with_patterns ( repo_base, gl, select_glob_patterns ( ) );
+}
+
+/* [exposed function] populate_glob_all: identical to `populate_glob`, except
+ * the command-line arguments are disregarded, and every USE-description file is
+ * collated. */
+
+int populate_glob_all ( const char * repo_base, struct glob_list_t * gl )
+{
+    return glob_with_patterns ( repo_base, gl, PATTERN_STD );
+}
+
+/* [exposed function] glob_free: release the entries of `gl`, and close its
+ * directories. */
+
+void glob_free ( struct glob_list_t * gl )
+{
+    for ( int i = 0; i < 2; i++ )
+        if ( gl->dirs [ i ] != -1 )
+            close ( gl->dirs [ i ] );
+
+    free ( gl->entries );
+    free ( gl->paths );
+    *gl = ( struct glob_list_t ) GLOB_LIST_INIT;
+}
+
+/* [exposed function] glob_selects: given the `path` of a file collated by
+ * `populate_glob_all`, this function returns non-zero if `populate_glob` would
+ * also have collated it, according to the command-line arguments, and zero
+ * otherwise. Both match the name of the file alike, so the selection is
+ * identical. */
+
+int glob_selects ( const char * path )
+{
+    const char * name = strrchr ( path, '/' );
+
+    return name_matches ( ( name == NULL ) ? path : name + 1,
+            select_glob_patterns ( ) );
+}
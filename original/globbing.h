@@ -4,10 +4,38 @@
 #ifndef GLOBBING_H
 #define GLOBBING_H
 
-#include <glob.h>
+#include <stddef.h>
 #include <linux/limits.h>
 
-int populate_glob ( char [ NAME_MAX + 1 ], glob_t * );
+/* glob_entry_t: a USE-description file collated by `populate_glob`: its whole
+ * `path`, and its `name` within the directory open at `dir`, by which it may be
+ * opened with openat(2), rather than resolving the whole path again. */
 
-#endif /* GLOBBING_H */
+struct glob_entry_t {
+    char * path;
+    const char * name;
+    int dir;
+};
+
+/* glob_list_t: the files collated for a single repository, in the order in
+ * which glob(3) would have given them: those of profiles/, then those of
+ * profiles/desc/, each sorted by name. `dirs` holds the descriptors of the two
+ * directories, or -1 for either which could not be opened; they are kept open
+ * with the list, for the use of `entries`, until `glob_free` is called. */
+
+struct glob_list_t {
+    struct glob_entry_t * entries;
+    size_t count;
+    char * paths; /* the paths of `entries`, in a single allocation */
+    int dirs [ 2 ];
+};
 
+#define GLOB_LIST_INIT { .entries = NULL, .count = 0, .paths = NULL, \
+    .dirs = { -1, -1 } }
+
+int populate_glob ( const char *, struct glob_list_t * );
+int populate_glob_all ( const char *, struct glob_list_t * );
+void glob_free ( struct glob_list_t * );
+int glob_selects ( const char * );
+
+#endif /* GLOBBING_H */
@@ -0,0 +1,679 @@
+/* owd-euses: persistent USE-description index; see index.h.
+ * Oliver Dixon. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index.h"
+#include "converse.h"
+#include "globbing.h"
+#include "source.h"
+
+#define INDEX_BYTE_ORDER ( 0x01020304 ) /* detects a foreign byte order */
+#define INDEX_SUFFIX     "/owd-euses/index"
+#define INDEX_TMP_SUFFIX ".XXXXXX"
+#define CACHE_FALLBACK   "/.cache"
+#define LINE_COMMENT     ( '#' )
+
+/* index_builder_t: the growing parts of an index under construction, and the
+ * `previous` index, if any, the entries of which may be reused; `cursor` is
+ * the file of the latter after that last found (see `find_previous`). */
+
+struct index_builder_t {
+    struct index_repo_t * repos;
+    struct index_file_t * files;
+    char * blob;
+    size_t repo_count, file_count, file_capacity, blob_size, blob_capacity;
+    const struct index_t * previous;
+    uint64_t cursor;
+};
+
+/* [exposed function] index_stamp: fill `stamp` from the result of a stat(2)
+ * call. */
+
+void index_stamp ( const struct stat * st, struct index_stamp_t * stamp )
+{
+    memset ( stamp, 0, sizeof ( *stamp ) );
+    stamp->sec = st->st_mtim.tv_sec;
+    stamp->nsec = st->st_mtim.tv_nsec;
+    stamp->size = st->st_size;
+    stamp->ino = st->st_ino;
+}
+
+/* stamp_path: stamp the file or directory at `path`; one which does not exist
+ * is stamped with zeroes. Returns zero on success, or -1 if stat(2) failed for
+ * any other reason. */
+
+static int stamp_path ( const char * path, struct index_stamp_t * stamp )
+{
+    struct stat st;
+
+    if ( stat ( path, &st ) == -1 ) {
+        memset ( stamp, 0, sizeof ( *stamp ) );
+        return ( errno == ENOENT || errno == ENOTDIR ) ? 0 : -1;
+    }
+
+    index_stamp ( &st, stamp );
+    return 0;
+}
+
+/* stamp_repo_dirs: stamp the two directories of the repository at `location`
+ * in which USE-description files may appear. Adding, removing, or renaming a
+ * file changes the stamp of its directory. Returns zero on success, or -1 on
+ * failure (see `stamp_path`). */
+
+static int stamp_repo_dirs ( const char * location,
+        struct index_stamp_t dirs [ 2 ] )
+{
+    char path [ PATH_MAX ];
+
+    return ( construct_path ( path, location, "/profiles" ) == -1 ||
+            stamp_path ( path, & ( dirs [ 0 ] ) ) == -1 ||
+            construct_path ( path, NULL, "/desc" ) == -1 ||
+            stamp_path ( path, & ( dirs [ 1 ] ) ) == -1 ) ? -1 : 0;
+}
+
+/* [exposed function] index_stamps_differ: compare two stamps, returning
+ * non-zero if they differ. */
+
+int index_stamps_differ ( const struct index_stamp_t * a,
+        const struct index_stamp_t * b )
+{
+    return a->sec != b->sec || a->nsec != b->nsec || a->size != b->size
+        || a->ino != b->ino;
+}
+
+/* [exposed function] index_default_path: write the path of the index file into
+ * `path`: "owd-euses/index" in $XDG_CACHE_HOME, or in $HOME/.cache if the
+ * former is not set. Returns zero on success, or -1 if neither variable is set,
+ * or the path would be too long, in which case errno is set appropriately. */
+
+int index_default_path ( char path [ PATH_MAX ] )
+{
+    const char * base = getenv ( "XDG_CACHE_HOME" );
+
+    if ( base != NULL && base [ 0 ] == '/' )
+        return construct_path ( path, base, INDEX_SUFFIX );
+
+    if ( ( base = getenv ( "HOME" ) ) == NULL || base [ 0 ] != '/' ) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return ( construct_path ( path, base, CACHE_FALLBACK ) == -1 ||
+            construct_path ( path, NULL, INDEX_SUFFIX ) == -1 ) ? -1 : 0;
+}
+
+/* valid_string: return non-zero if the `len` bytes at `offset` in the blob of
+ * `ix`, of `size` bytes, are a string, followed by its null-terminator. */
+
+static int valid_string ( const struct index_t * ix, uint64_t size,
+        uint64_t offset, uint64_t len )
+{
+    return offset < size && len < size - offset && memchr ( & ( ix->blob
+                [ offset ] ), '\0', len ) == NULL &&
+        ix->blob [ offset + len ] == '\0';
+}
+
+/* validate_layout: verify that the mapped index `ix` of `size` bytes is of the
+ * current version, and that every offset within it is addressable, populating
+ * the pointers of `ix`. Returns zero if the layout is sound, or -1 otherwise.
+ */
+
+static int validate_layout ( struct index_t * ix, size_t size )
+{
+    const struct index_header_t * hd = ( const void * ) ix->map;
+    uint64_t expected_file = 0;
+
+    if ( size < sizeof ( *hd ) || hd->repo_count > size ||
+            hd->file_count > size || memcmp ( hd->magic, INDEX_MAGIC,
+                sizeof ( hd->magic ) ) != 0 || hd->version != INDEX_VERSION
+            || hd->byte_order != INDEX_BYTE_ORDER
+            || hd->blob_offset != sizeof ( *hd ) + hd->repo_count *
+            sizeof ( struct index_repo_t ) + hd->file_count *
+            sizeof ( struct index_file_t )
+            || hd->blob_offset + hd->blob_size != size )
+        return -1;
+
+    ix->header = hd;
+    ix->repos = ( const void * ) & ( ix->map [ sizeof ( *hd ) ] );
+    ix->files = ( const void * ) & ( ix->repos [ hd->repo_count ] );
+    ix->blob = & ( ix->map [ hd->blob_offset ] );
+
+    for ( uint64_t i = 0; i < hd->repo_count; i++ ) {
+        const struct index_repo_t * ir = & ( ix->repos [ i ] );
+
+        if ( ir->first_file != expected_file || !valid_string ( ix,
+                    hd->blob_size, ir->location, ir->location_len ) ||
+                !valid_string ( ix, hd->blob_size, ir->name, ir->name_len ) )
+            return -1;
+
+        expected_file += ir->file_count;
+    }
+
+    if ( expected_file != hd->file_count )
+        return -1;
+
+    for ( uint64_t i = 0; i < hd->file_count; i++ ) {
+        const struct index_file_t * file = & ( ix->files [ i ] );
+
+        if ( file->path >= hd->blob_size || memchr ( & ( ix->blob
+                            [ file->path ] ), '\0', hd->blob_size -
+                        file->path ) == NULL || file->text >=
+                hd->blob_size || file->text_len >= hd->blob_size -
+                file->text || ix->blob [ file->text +
+                file->text_len ] != '\0' )
+            return -1;
+    }
+
+    return 0;
+}
+
+/* validate_stamps: verify that the repositories of the index `ix` are those of
+ * the `stack`, in the same order, and that none of their USE-description files
+ * or directories has changed since the index was built. Only stat(2) is used;
+ * no file is opened. Returns zero if the index is current, or -1 otherwise. */
+
+static int validate_stamps ( const struct index_t * ix,
+        struct repo_stack_t * stack )
+{
+    struct index_stamp_t stamp [ 2 ];
+
+    if ( ix->header->repo_count != stack->size )
+        return -1;
+
+    for ( uint64_t i = 0; i < ix->header->repo_count; i++ ) {
+        const struct index_repo_t * ir = & ( ix->repos [ i ] );
+        const struct repo_t * repo = stack_repo ( stack, i );
+
+        if ( strcmp ( & ( ix->blob [ ir->location ] ), repo->location ) != 0
+                || strcmp ( & ( ix->blob [ ir->name ] ), repo->name ) != 0 ||
+                stamp_repo_dirs ( repo->location, stamp ) == -1 ||
+                index_stamps_differ ( & ( stamp [ 0 ] ),
+                    & ( ir->dirs [ 0 ] ) ) || index_stamps_differ (
+                    & ( stamp [ 1 ] ), & ( ir->dirs [ 1 ] ) ) )
+            return -1;
+    }
+
+    for ( uint64_t i = 0; i < ix->header->file_count; i++ )
+        if ( stamp_path ( & ( ix->blob [ ix->files [ i ].path ] ),
+                    & ( stamp [ 0 ] ) ) == -1 || index_stamps_differ (
+                    & ( stamp [ 0 ] ), & ( ix->files [ i ].stamp ) ) )
+            return -1;
+
+    return 0;
+}
+
+/* [exposed function] index_load: map the index file at `path`, and check that
+ * it is current for the repositories on the `stack`. On success, INDEX_OK is
+ * returned. If the index does not exist, is of another version, is malformed,
+ * or is outdated, INDEX_STALE is returned, and the index should be rebuilt with
+ * `index_build`. An index which is merely outdated is left mapped, so that the
+ * entries of its unchanged files may be reused by the rebuild. In every case,
+ * `ix` should be released with `index_unload`. */
+
+enum index_status_t index_load ( struct index_t * ix, const char * path,
+        struct repo_stack_t * stack )
+{
+    struct stat st;
+    int fd = open ( path, O_RDONLY | O_CLOEXEC );
+
+    ix->map = NULL;
+
+    if ( fd == -1 )
+        return INDEX_STALE;
+
+    if ( fstat ( fd, &st ) == -1 || !S_ISREG ( st.st_mode ) ||
+            ( size_t ) st.st_size < sizeof ( struct index_header_t ) ) {
+        close ( fd );
+        return INDEX_STALE;
+    }
+
+    /* The searcher only reads the text, however it is chunked; see
+     * `automaton_scan`. */
+    if ( ( ix->map = mmap ( NULL, st.st_size, PROT_READ,
+                    MAP_PRIVATE | MAP_POPULATE, fd, 0 ) ) == MAP_FAILED ) {
+        ix->map = NULL;
+        close ( fd );
+        return INDEX_STALE;
+    }
+
+    close ( fd );
+    ix->map_len = st.st_size;
+
+    if ( validate_layout ( ix, ix->map_len ) == -1 ) {
+        index_unload ( ix );
+        return INDEX_STALE;
+    }
+
+    return ( validate_stamps ( ix, stack ) == -1 ) ? INDEX_STALE : INDEX_OK;
+}
+
+/* [exposed function] index_unload: release the mapping made by `index_load`, if
+ * any. */
+
+void index_unload ( struct index_t * ix )
+{
+    if ( ix->map != NULL ) {
+        munmap ( ix->map, ix->map_len );
+        ix->map = NULL;
+        ix->map_len = 0;
+    }
+}
+
+/* blob_reserve: ensure the blob of `ib` has room for `extra` more bytes.
+ * Returns zero on success, or -1 if the blob could not grow. */
+
+static int blob_reserve ( struct index_builder_t * ib, size_t extra )
+{
+    size_t capacity = ( ib->blob_capacity == 0 ) ? BUFSIZ :
+        ib->blob_capacity;
+    char * blob = NULL;
+
+    if ( ib->blob_size + extra <= ib->blob_capacity )
+        return 0;
+
+    while ( ib->blob_size + extra > capacity )
+        capacity *= 2;
+
+    if ( ( blob = realloc ( ib->blob, capacity ) ) == NULL )
+        return -1;
+
+    ib->blob = blob;
+    ib->blob_capacity = capacity;
+    return 0;
+}
+
+/* append_string: append the null-terminated `str` to the blob of `ib`, placing
+ * its offset in `offset`, and its length in `len`. Returns zero on success, or
+ * -1 if the blob could not grow. */
+
+static int append_string ( struct index_builder_t * ib, const char * str,
+        uint64_t * offset, uint64_t * len )
+{
+    const size_t size = strlen ( str ) + 1;
+
+    if ( blob_reserve ( ib, size ) == -1 )
+        return -1;
+
+    *offset = ib->blob_size;
+    *len = size - 1;
+    memcpy ( & ( ib->blob [ ib->blob_size ] ), str, size );
+    ib->blob_size += size;
+    return 0;
+}
+
+/* append_entries: append the entries of `text`, of `len` bytes, to the blob:
+ * every line except comments and blank lines, which are never reported. The
+ * last entry is completed by a line feed if necessary, and the whole is
+ * null-terminated. The blob must have room for `len + 2` bytes. */
+
+static void append_entries ( struct index_builder_t * ib, const char * text,
+        size_t len )
+{
+    const char * line = text, * end = text + len, * feed = NULL;
+
+    for ( ; line < end; line = feed + 1 ) {
+        size_t line_len = 0;
+
+        if ( ( feed = memchr ( line, '\n', end - line ) ) == NULL )
+            feed = end;
+
+        if ( ( line_len = feed - line ) == 0 || *line == LINE_COMMENT )
+            continue;
+
+        memcpy ( & ( ib->blob [ ib->blob_size ] ), line, line_len );
+        ib->blob_size += line_len;
+        ib->blob [ ib->blob_size++ ] = '\n';
+    }
+
+    ib->blob [ ib->blob_size++ ] = '\0';
+}
+
+/* read_whole_file: read the whole of the open source `src`, of the size it had
+ * when it was opened (or more, if it has since grown), into a new heap buffer,
+ * placing its length in `len`. Returns the buffer, which the caller must free,
+ * or NULL on failure, in which case errno is set appropriately. */
+
+static char * read_whole_file ( struct source_t * src, size_t * len )
+{
+    size_t capacity = ( size_t ) src->st.st_size + 1;
+    char * text = malloc ( capacity ), * grown = NULL;
+    ssize_t bytes = 0;
+
+    *len = 0;
+
+    while ( text != NULL ) {
+        if ( ( bytes = source_read ( src, & ( text [ *len ] ),
+                        capacity - *len ) ) == -1 ) {
+            free ( text );
+            return NULL;
+        }
+
+        if ( ( *len += bytes ) < capacity )
+            break;
+
+        /* the file has grown since it was stamped */
+        if ( ( grown = realloc ( text, capacity *= 2 ) ) == NULL )
+            free ( text );
+
+        text = grown;
+    }
+
+    return text;
+}
+
+/* find_previous: return the file at `path` in the previous index of `ib`, if
+ * it has one, or NULL. The files are sought from the cursor onwards, wrapping
+ * around, as they are usually indexed in the same order as before, so each is
+ * found at once. */
+
+static const struct index_file_t * find_previous (
+        struct index_builder_t * ib, const char * path )
+{
+    const struct index_t * ix = ib->previous;
+    uint64_t count = 0, f = 0;
+
+    if ( ix == NULL || ix->map == NULL )
+        return NULL;
+
+    count = ix->header->file_count;
+    for ( uint64_t i = 0; i < count; i++ ) {
+        f = ( ib->cursor + i ) % count;
+
+        if ( strcmp ( & ( ix->blob [ ix->files [ f ].path ] ), path ) == 0 ) {
+            ib->cursor = f + 1;
+            return & ( ix->files [ f ] );
+        }
+    }
+
+    return NULL;
+}
+
+/* reuse_file: if the file at `path`, the stat(2) result of which is `st`, is in
+ * the previous index of `ib`, with the same stamp, copy its entries from there,
+ * rather than reading the file again; `file` has its stamp. Returns 1 if the
+ * entries were reused, zero if the file must be read, or -1 on failure, in
+ * which case errno is set. */
+
+static int reuse_file ( struct index_builder_t * ib, const char * path,
+        struct index_file_t * file )
+{
+    const struct index_file_t * old = find_previous ( ib, path );
+    size_t path_len = strlen ( path ) + 1;
+
+    if ( old == NULL || index_stamps_differ ( & ( old->stamp ),
+                & ( file->stamp ) ) )
+        return 0;
+
+    if ( blob_reserve ( ib, path_len + old->text_len + 1 ) == -1 )
+        return -1;
+
+    file->path = ib->blob_size;
+    memcpy ( & ( ib->blob [ ib->blob_size ] ), path, path_len );
+    ib->blob_size += path_len;
+
+    file->text = ib->blob_size;
+    file->text_len = old->text_len;
+    memcpy ( & ( ib->blob [ ib->blob_size ] ), & ( ib->previous->blob
+                [ old->text ] ), old->text_len + 1 );
+    ib->blob_size += old->text_len + 1;
+    return 1;
+}
+
+/* index_file: append the file of `ent` to the index under construction, with
+ * its stamp, path, and entries. The file is stamped before it is read, so a
+ * concurrent change causes the index to be judged outdated by the next query.
+ * The entries of a file which is unchanged since the previous index was built
+ * are reused; see `reuse_file`. Returns zero on success, or -1 on failure, in
+ * which case errno and the information buffer are set appropriately. */
+
+static int index_file ( struct index_builder_t * ib,
+        const struct glob_entry_t * ent )
+{
+    const char * path = ent->path;
+    struct index_file_t * file = NULL;
+    struct source_t src = SOURCE_INIT;
+    struct stat st;
+    size_t path_len = strlen ( path ) + 1, len = 0;
+    char * text = NULL;
+    int reused = 0;
+
+    if ( ib->file_count == ib->file_capacity ) {
+        size_t capacity = ( ib->file_capacity == 0 ) ? 64 :
+            ib->file_capacity * 2;
+
+        if ( ( file = realloc ( ib->files, sizeof ( *file ) * capacity ) )
+                == NULL ) {
+            populate_info_buffer ( path );
+            return -1;
+        }
+
+        ib->files = file;
+        ib->file_capacity = capacity;
+    }
+
+    if ( ib->previous != NULL && fstatat ( ent->dir, ent->name, &st, 0 )
+            == 0 ) {
+        file = & ( ib->files [ ib->file_count ] );
+        index_stamp ( &st, & ( file->stamp ) );
+
+        if ( ( reused = reuse_file ( ib, path, file ) ) == -1 ) {
+            populate_info_buffer ( path );
+            return -1;
+        }
+
+        if ( reused ) {
+            ib->file_count++;
+            return 0;
+        }
+    }
+
+    if ( source_open ( &src, ent->dir, ent->name ) == -1 ||
+            ( text = read_whole_file ( &src, &len ) ) == NULL ) {
+        populate_info_buffer ( path );
+        source_close ( &src );
+        return -1;
+    }
+
+    source_close ( &src );
+
+    if ( blob_reserve ( ib, path_len + len + 2 ) == -1 ) {
+        populate_info_buffer ( path );
+        free ( text );
+        return -1;
+    }
+
+    file = & ( ib->files [ ib->file_count++ ] );
+    index_stamp ( & ( src.st ), & ( file->stamp ) );
+
+    file->path = ib->blob_size;
+    memcpy ( & ( ib->blob [ ib->blob_size ] ), path, path_len );
+    ib->blob_size += path_len;
+
+    file->text = ib->blob_size;
+    append_entries ( ib, text, len );
+    file->text_len = ib->blob_size - file->text - 1;
+
+    free ( text );
+    return 0;
+}
+
+/* index_repo: append the repository `repo`, and every USE-description file
+ * within it, to the index under construction, regardless of the file-selection
+ * arguments, which are instead applied when the index is searched. Returns zero
+ * on success, or -1 on failure, in which case errno and the information buffer
+ * are set appropriately. */
+
+static int index_repo ( struct index_builder_t * ib, struct repo_t * repo,
+        struct index_repo_t * ir )
+{
+    struct glob_list_t gl = GLOB_LIST_INIT;
+    char location [ PATH_MAX ];
+
+    memset ( ir, 0, sizeof ( *ir ) );
+    strcpy ( location, repo->location );
+    ir->first_file = ib->file_count;
+
+    if ( append_string ( ib, repo->location, & ( ir->location ),
+                & ( ir->location_len ) ) == -1 || append_string ( ib,
+                repo->name, & ( ir->name ), & ( ir->name_len ) ) == -1 ) {
+        populate_info_buffer ( repo->location );
+        return -1;
+    }
+
+    /* The directories are stamped before they are read; see `index_file`. */
+    if ( stamp_repo_dirs ( repo->location, ir->dirs ) == -1 ) {
+        populate_info_buffer ( repo->location );
+        return -1;
+    }
+
+    if ( populate_glob_all ( location, &gl ) == -1 ) {
+        glob_free ( &gl );
+        return -1;
+    }
+
+    for ( size_t i = 0; i < gl.count; i++ )
+        if ( index_file ( ib, & ( gl.entries [ i ] ) ) == -1 ) {
+            glob_free ( &gl );
+            return -1;
+        }
+
+    ir->file_count = ib->file_count - ir->first_file;
+    glob_free ( &gl );
+    return 0;
+}
+
+/* make_parent_dirs: create the missing parent directories of `path`, as
+ * `mkdir -p` would. Returns zero on success, or -1 on failure, in which case
+ * errno is set appropriately. */
+
+static int make_parent_dirs ( const char * path )
+{
+    char dir [ PATH_MAX ];
+
+    strcpy ( dir, path );
+
+    for ( char * slash = strchr ( & ( dir [ 1 ] ), '/' ); slash != NULL;
+            slash = strchr ( slash + 1, '/' ) ) {
+        *slash = '\0';
+
+        if ( mkdir ( dir, 0755 ) == -1 && errno != EEXIST )
+            return -1;
+
+        *slash = '/';
+    }
+
+    return 0;
+}
+
+/* write_index: write the index under construction to the open stream `fp`.
+ * Returns zero on success, or -1 on failure, in which case errno is set. */
+
+static int write_index ( const struct index_builder_t * ib, FILE * fp )
+{
+    struct index_header_t hd;
+
+    memset ( &hd, 0, sizeof ( hd ) );
+    memcpy ( hd.magic, INDEX_MAGIC, sizeof ( hd.magic ) );
+    hd.version = INDEX_VERSION;
+    hd.byte_order = INDEX_BYTE_ORDER;
+    hd.repo_count = ib->repo_count;
+    hd.file_count = ib->file_count;
+    hd.blob_offset = sizeof ( hd ) + ib->repo_count *
+        sizeof ( *ib->repos ) + ib->file_count * sizeof ( *ib->files );
+    hd.blob_size = ib->blob_size;
+
+    return ( fwrite ( &hd, sizeof ( hd ), 1, fp ) != 1 ||
+            fwrite ( ib->repos, sizeof ( *ib->repos ), ib->repo_count, fp )
+            != ib->repo_count || fwrite ( ib->files, sizeof ( *ib->files ),
+                ib->file_count, fp ) != ib->file_count ||
+            fwrite ( ib->blob, 1, ib->blob_size, fp ) != ib->blob_size ) ?
+        -1 : 0;
+}
+
+/* store_index: write the index under construction to `path`, by way of a
+ * temporary file renamed over it, so a concurrent query never maps a partial
+ * index. Returns zero on success, or -1 on failure, in which case errno and
+ * the information buffer are set appropriately. */
+
+static int store_index ( const struct index_builder_t * ib, const char * path )
+{
+    char tmp_path [ PATH_MAX ];
+    FILE * fp = NULL;
+    int fd = -1;
+
+    if ( construct_path ( tmp_path, path, INDEX_TMP_SUFFIX ) == -1 )
+        return -1;
+
+    if ( make_parent_dirs ( path ) == -1 ||
+            ( fd = mkstemp ( tmp_path ) ) == -1 ) {
+        populate_info_buffer ( path );
+        return -1;
+    }
+
+    if ( ( fp = fdopen ( fd, "w" ) ) == NULL ) {
+        populate_info_buffer ( tmp_path );
+        close ( fd );
+        unlink ( tmp_path );
+        return -1;
+    }
+
+    if ( write_index ( ib, fp ) == -1 || fclose ( fp ) == EOF ||
+            rename ( tmp_path, path ) == -1 ) {
+        populate_info_buffer ( path );
+        unlink ( tmp_path );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] index_build: read every USE-description file of the
+ * repositories on the `stack`, and store their entries in the index file at
+ * `path`, creating its directory if necessary. If `previous` is not NULL, it
+ * is an index loaded by `index_load`, even if outdated, and a file the stamp of
+ * which is unchanged since then is not read again: its entries are copied from
+ * `previous` instead, so a rebuild only reads the files which have changed. On
+ * success, INDEX_OK is returned. On failure, INDEX_ERRNO is returned, and errno
+ * and the information buffer are set appropriately; any previous index is left
+ * intact, and `previous` remains mapped, whichever the outcome. */
+
+enum index_status_t index_build ( const char * path,
+        struct repo_stack_t * stack, const struct index_t * previous )
+{
+    struct index_builder_t ib;
+    struct repo_t * repo = NULL;
+    enum index_status_t status = INDEX_OK;
+
+    memset ( &ib, 0, sizeof ( ib ) );
+    ib.previous = previous;
+
+    if ( ( ib.repos = calloc ( stack->size + 1, sizeof ( *ib.repos ) ) )
+            == NULL ) {
+        populate_info_buffer ( path );
+        return INDEX_ERRNO;
+    }
+
+    for ( unsigned long i = 0; ( repo = stack_repo ( stack, i ) ) != NULL;
+            i++ )
+        if ( index_repo ( &ib, repo, & ( ib.repos [ ib.repo_count++ ] ) )
+                == -1 ) {
+            status = INDEX_ERRNO;
+            break;
+        }
+
+    if ( status == INDEX_OK && store_index ( &ib, path ) == -1 )
+        status = INDEX_ERRNO;
+
+    free ( ib.repos );
+    free ( ib.files );
+    free ( ib.blob );
+    return status;
+}
@@ -0,0 +1,82 @@
+/* owd-euses: persistent USE-description index signatures
+ * Oliver Dixon. */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "euses.h"
+#include "stack.h"
+
+#define INDEX_MAGIC   "owdeuses" /* exactly eight characters; no terminator */
+#define INDEX_VERSION ( 2 )
+
+enum index_status_t {
+    INDEX_STALE =  1, /* the index is absent, outdated, or unrecognised */
+    INDEX_OK    =  0, /* the index is usable */
+    INDEX_ERRNO = -1  /* the index could not be written; c.f. errno */
+};
+
+/* index_stamp_t: the details of a file or directory which change whenever it
+ * does, as given by stat(2). A directory which does not exist is stamped with
+ * zeroes throughout. */
+
+struct index_stamp_t {
+    int64_t sec, nsec; /* modification time */
+    uint64_t size, ino;
+};
+
+/* The index file is laid out as follows, with every offset relative to the
+ * start of the string blob, so the whole file can be mapped and used in place:
+ *
+ *  - index_header_t;
+ *  - index_repo_t [ repo_count ], in the order in which they are searched;
+ *  - index_file_t [ file_count ], grouped by repository;
+ *  - the string blob: the locations and names of the repositories, and the
+ *    paths of the files, each null-terminated, and the entries of each file,
+ *    being its lines less comments and blank lines, each set terminated by a
+ *    line feed and a null-terminator. */
+
+struct index_header_t {
+    char magic [ 8 ];
+    uint32_t version, byte_order;
+    uint64_t repo_count, file_count, blob_offset, blob_size;
+};
+
+struct index_repo_t {
+    uint64_t location, location_len, name, name_len; /* offsets; lengths */
+    struct index_stamp_t dirs [ 2 ]; /* profiles/ and profiles/desc/ */
+    uint64_t first_file, file_count;
+};
+
+struct index_file_t {
+    struct index_stamp_t stamp;
+    uint64_t path, text, text_len; /* offsets into the blob; length */
+};
+
+/* index_t: a loaded index, mapped privately, so the searcher may place
+ * temporary null-terminators in the text without reaching the file. */
+
+struct index_t {
+    char * map;
+    size_t map_len;
+    const struct index_header_t * header;
+    const struct index_repo_t * repos;
+    const struct index_file_t * files;
+    char * blob;
+};
+
+int index_default_path ( char [ PATH_MAX ] );
+void index_stamp ( const struct stat *, struct index_stamp_t * );
+int index_stamps_differ ( const struct index_stamp_t *,
+        const struct index_stamp_t * );
+enum index_status_t index_load ( struct index_t *, const char *,
+        struct repo_stack_t * );
+void index_unload ( struct index_t * );
+enum index_status_t index_build ( const char *, struct repo_stack_t *,
+        const struct index_t * );
+
+#endif /* INDEX_H */
@@ -0,0 +1,370 @@
+/* owd-euses: single-needle substring kernel; see kernel.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined ( __GNUC__ ) && ( defined ( __x86_64__ ) || defined ( __i386__ ) )
+/* The vector kernels are compiled for their own instruction sets with target
+ * attributes, so the program as a whole need not be, and one is chosen at
+ * run-time by `kernel_select`. */
+#define KERNEL_X86
+#include <immintrin.h>
+#endif /* __GNUC__ && x86 */
+
+#include "kernel.h"
+
+typedef const char * ( * kernel_t ) ( const char *, size_t,
+        const struct needle_t * );
+
+/* fold: return the ASCII lower-case form of `c`, leaving every other byte
+ * unchanged, as tolower(3) does in the "C" locale. */
+
+static inline unsigned char fold ( unsigned char c )
+{
+    return ( ( unsigned int ) ( c - 'A' ) < 26 ) ? c | 0x20 : c;
+}
+
+/* equal_span: return non-zero if the `n` bytes at `hay` equal those at
+ * `needle`, which is already folded if `no_case` is set. */
+
+static inline int equal_span ( const char * hay, const char * needle,
+        size_t n, int no_case )
+{
+    if ( !no_case )
+        return memcmp ( hay, needle, n ) == 0;
+
+    for ( size_t i = 0; i < n; i++ )
+        if ( fold ( hay [ i ] ) != ( unsigned char ) needle [ i ] )
+            return 0;
+
+    return 1;
+}
+
+/* byte_at: return the byte of `hay` at `i`, folded if `no_case` is set. */
+
+static inline unsigned char byte_at ( const unsigned char * hay, size_t i,
+        int no_case )
+{
+    return ( no_case ) ? fold ( hay [ i ] ) : hay [ i ];
+}
+
+/* maximal_suffix: return the start of the maximal suffix of the `len` bytes of
+ * `text`, by the byte order if `reverse` is unset, or by its reverse otherwise,
+ * leaving the period of that suffix in `period`. */
+
+static size_t maximal_suffix ( const unsigned char * text, size_t len,
+        int reverse, size_t * period )
+{
+    /* suffix: start of the best suffix so far, less one (wrapping) */
+    size_t suffix = ( size_t ) -1, j = 0, k = 1, p = 1;
+
+    while ( j + k < len ) {
+        const unsigned char a = text [ j + k ], b = text [ suffix + k ];
+
+        if ( a == b ) {
+            if ( k == p ) {
+                j += p;
+                k = 1;
+            } else
+                k++;
+        } else if ( ( a < b ) != ( reverse != 0 ) ) {
+            j += k;
+            k = 1;
+            p = j - suffix;
+        } else {
+            suffix = j++;
+            k = p = 1;
+        }
+    }
+
+    *period = p;
+    return suffix + 1;
+}
+
+/* [exposed function] needle_compile: prepare the `needle` for `kernel_find`,
+ * folding it if `no_case` is set; see needle_t. Returns zero on success, or -1
+ * if the copy could not be allocated, in which case errno is set by malloc. */
+
+int needle_compile ( struct needle_t * nd, const char * needle, int no_case )
+{
+    size_t period_rev = 0, crit_rev = 0;
+    const unsigned char * text = NULL;
+
+    nd->len = strlen ( needle );
+    nd->no_case = no_case;
+    nd->crit = nd->period = 0;
+    nd->periodic = 0;
+
+    if ( ( nd->text = malloc ( nd->len + 1 ) ) == NULL )
+        return -1;
+
+    for ( size_t i = 0; i <= nd->len; i++ )
+        nd->text [ i ] = ( no_case ) ? fold ( needle [ i ] ) : needle [ i ];
+
+    for ( int c = 0; c < 256; c++ )
+        nd->shift [ c ] = nd->len;
+
+    text = ( const unsigned char * ) nd->text;
+    for ( size_t i = 0; i < nd->len; i++ )
+        nd->shift [ text [ i ] ] = nd->len - 1 - i;
+
+    if ( nd->len == 0 )
+        /* Empty needles are never searched. */
+        return 0;
+
+    /* The critical factorisation is the later of the maximal suffixes under
+     * the two orders of the bytes. */
+    nd->crit = maximal_suffix ( text, nd->len, 0, & ( nd->period ) );
+    crit_rev = maximal_suffix ( text, nd->len, 1, &period_rev );
+    if ( crit_rev > nd->crit ) {
+        nd->crit = crit_rev;
+        nd->period = period_rev;
+    }
+
+    nd->periodic = ( nd->crit + nd->period <= nd->len && memcmp ( text,
+                text + nd->period, nd->crit ) == 0 );
+    if ( !nd->periodic )
+        nd->period = ( ( nd->crit > nd->len - nd->crit ) ? nd->crit :
+                nd->len - nd->crit ) + 1;
+
+    return 0;
+}
+
+/* [exposed function] needle_free: release the copy in a compiled needle. */
+
+void needle_free ( struct needle_t * nd )
+{
+    free ( nd->text );
+    nd->text = NULL;
+}
+
+/* find_scalar: the portable kernel, and the tail of the vector kernels: the
+ * Two-Way algorithm, which never compares a byte of the haystack more than
+ * twice, combined with the skip of `shift` on the last byte of each window.
+ * Where the needle is periodic, `memory` records how much of its prefix is
+ * already known to match after a shift by the period. */
+
+static const char * find_scalar ( const char * hay, size_t len,
+        const struct needle_t * nd )
+{
+    const unsigned char * h = ( const unsigned char * ) hay,
+          * n = ( const unsigned char * ) nd->text;
+    const size_t last = nd->len - 1;
+    size_t j = 0, i = 0, shift = 0, memory = 0;
+
+    while ( len >= nd->len && j <= len - nd->len ) {
+        if ( ( shift = nd->shift [ byte_at ( h, j + last, nd->no_case ) ] )
+                > 0 ) {
+            if ( memory != 0 && shift < nd->period )
+                shift = nd->len - nd->period;
+
+            memory = 0;
+            j += shift;
+            continue;
+        }
+
+        /* The last byte matches: compare the right part of the needle, and
+         * then, if it matches, the left part, backwards. */
+        for ( i = ( nd->crit > memory ) ? nd->crit : memory; i < last &&
+                n [ i ] == byte_at ( h, j + i, nd->no_case ); i++ )
+            ;
+
+        if ( i < last ) {
+            j += i - nd->crit + 1;
+            memory = 0;
+            continue;
+        }
+
+        for ( i = nd->crit; i > memory && n [ i - 1 ] == byte_at ( h,
+                    j + i - 1, nd->no_case ); i-- )
+            ;
+
+        if ( i <= memory )
+            return hay + j;
+
+        j += nd->period;
+        memory = ( nd->periodic ) ? nd->len - nd->period : 0;
+    }
+
+    return NULL;
+}
+
+#ifdef KERNEL_X86
+/* fold_sse2, fold_avx2: fold every ASCII upper-case letter in a register. The
+ * letters are shifted to the bottom of the signed range, so that a single
+ * signed comparison identifies them. */
+
+__attribute__ ( ( target ( "sse2" ) ) )
+static inline __m128i fold_sse2 ( __m128i x )
+{
+    const __m128i upper = _mm_cmplt_epi8 ( _mm_add_epi8 ( x,
+                _mm_set1_epi8 ( 128 - 'A' ) ), _mm_set1_epi8 ( -128 + 26 ) );
+
+    return _mm_or_si128 ( x, _mm_and_si128 ( upper,
+                _mm_set1_epi8 ( 0x20 ) ) );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+static inline __m256i fold_avx2 ( __m256i x )
+{
+    const __m256i upper = _mm256_cmpgt_epi8 ( _mm256_set1_epi8 ( -128 + 26 ),
+            _mm256_add_epi8 ( x, _mm256_set1_epi8 ( 128 - 'A' ) ) );
+
+    return _mm256_or_si256 ( x, _mm256_and_si256 ( upper,
+                _mm256_set1_epi8 ( 0x20 ) ) );
+}
+
+/* block_sse2, block_avx2: return the mask of the positions in the block at
+ * `hay` at which a match of the needle of `nlen` bytes may begin: those at
+ * which the first byte of the needle is found, and its last byte is found
+ * `nlen` - 1 bytes further on. */
+
+__attribute__ ( ( target ( "sse2" ) ) )
+static inline unsigned int block_sse2 ( const char * hay, size_t nlen,
+        __m128i first, __m128i last, int no_case )
+{
+    __m128i a = _mm_loadu_si128 ( ( const __m128i * ) hay ),
+            b = _mm_loadu_si128 ( ( const __m128i * ) & ( hay [ nlen - 1 ] ) );
+
+    if ( no_case ) {
+        a = fold_sse2 ( a );
+        b = fold_sse2 ( b );
+    }
+
+    return _mm_movemask_epi8 ( _mm_and_si128 ( _mm_cmpeq_epi8 ( a, first ),
+                _mm_cmpeq_epi8 ( b, last ) ) );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+static inline unsigned int block_avx2 ( const char * hay, size_t nlen,
+        __m256i first, __m256i last, int no_case )
+{
+    __m256i a = _mm256_loadu_si256 ( ( const __m256i * ) hay ),
+            b = _mm256_loadu_si256 ( ( const __m256i * )
+                    & ( hay [ nlen - 1 ] ) );
+
+    if ( no_case ) {
+        a = fold_avx2 ( a );
+        b = fold_avx2 ( b );
+    }
+
+    return _mm256_movemask_epi8 ( _mm256_and_si256 ( _mm256_cmpeq_epi8 ( a,
+                    first ), _mm256_cmpeq_epi8 ( b, last ) ) );
+}
+
+/* verify_candidates: return the first position of the `mask` of candidates in
+ * the block at `hay` at which the whole needle matches, or NULL. */
+
+static inline const char * verify_candidates ( const char * hay,
+        unsigned long long mask, const struct needle_t * nd )
+{
+    for ( ; mask != 0; mask &= mask - 1 ) {
+        const char * at = & ( hay [ __builtin_ctzll ( mask ) ] );
+
+        if ( nd->len <= 2 || equal_span ( at + 1, nd->text + 1,
+                    nd->len - 2, nd->no_case ) )
+            return at;
+    }
+
+    return NULL;
+}
+
+/* find_sse2, find_avx2: the vector kernels. For every position in a block, the
+ * first byte of the needle is compared with the haystack at that position, and
+ * the last byte with the haystack at the position plus the length of the
+ * needle, less one; only the positions at which both agree (rare for the text
+ * of description files) are compared in full. Two blocks are taken at a time,
+ * which measurably helps the loop keep up with the loads. The blocks are loaded
+ * unaligned, and never beyond the span; the remainder is left to
+ * `find_scalar`. */
+
+__attribute__ ( ( target ( "sse2" ) ) )
+static const char * find_sse2 ( const char * hay, size_t len,
+        const struct needle_t * nd )
+{
+    const size_t nlen = nd->len, step = 2 * sizeof ( __m128i );
+    const __m128i first = _mm_set1_epi8 ( nd->text [ 0 ] ),
+          last = _mm_set1_epi8 ( nd->text [ nlen - 1 ] );
+    const char * match = NULL;
+    size_t i = 0;
+
+    for ( ; len >= nlen && i + nlen - 1 + step <= len; i += step ) {
+        unsigned long long mask = block_sse2 ( & ( hay [ i ] ), nlen, first,
+                last, nd->no_case ) | ( ( unsigned long long ) block_sse2 (
+                    & ( hay [ i + sizeof ( __m128i ) ] ), nlen, first,
+                    last, nd->no_case ) << sizeof ( __m128i ) );
+
+        if ( mask != 0 && ( match = verify_candidates ( & ( hay [ i ] ),
+                        mask, nd ) ) != NULL )
+            return match;
+    }
+
+    return find_scalar ( & ( hay [ i ] ), len - i, nd );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+static const char * find_avx2 ( const char * hay, size_t len,
+        const struct needle_t * nd )
+{
+    const size_t nlen = nd->len, step = 2 * sizeof ( __m256i );
+    const __m256i first = _mm256_set1_epi8 ( nd->text [ 0 ] ),
+          last = _mm256_set1_epi8 ( nd->text [ nlen - 1 ] );
+    const char * match = NULL;
+    size_t i = 0;
+
+    for ( ; len >= nlen && i + nlen - 1 + step <= len; i += step ) {
+        unsigned long long mask = block_avx2 ( & ( hay [ i ] ), nlen, first,
+                last, nd->no_case ) | ( ( unsigned long long ) block_avx2 (
+                    & ( hay [ i + sizeof ( __m256i ) ] ), nlen, first,
+                    last, nd->no_case ) << sizeof ( __m256i ) );
+
+        if ( mask != 0 && ( match = verify_candidates ( & ( hay [ i ] ),
+                        mask, nd ) ) != NULL )
+            return match;
+    }
+
+    return find_scalar ( & ( hay [ i ] ), len - i, nd );
+}
+#endif /* KERNEL_X86 */
+
+static kernel_t kernel = &find_scalar;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/* choose_kernel: choose the widest kernel supported by the processor, as
+ * reported by CPUID; see `kernel_select`. */
+
+static void choose_kernel ( void )
+{
+#ifdef KERNEL_X86
+    __builtin_cpu_init ( );
+
+    if ( __builtin_cpu_supports ( "avx2" ) )
+        kernel = &find_avx2;
+    else if ( __builtin_cpu_supports ( "sse2" ) )
+        kernel = &find_sse2;
+#endif /* KERNEL_X86 */
+}
+
+/* [exposed function] kernel_select: choose the kernel, once, before any search
+ * is started (see `choose_kernel`). It may be called by any number of threads,
+ * even while others are searching, as the kernel is only chosen by the first
+ * call, which the others await. */
+
+void kernel_select ( )
+{
+    pthread_once ( &kernel_once, &choose_kernel );
+}
+
+/* [exposed function] kernel_find: return the first occurrence of the compiled
+ * needle `nd` (which must not be empty) in the span of `len` bytes at `hay`, or
+ * NULL if there is none. The span need not be null-terminated, and is never
+ * read beyond. If the needle was compiled to ignore case, ASCII letters in the
+ * span are folded before being compared. */
+
+const char * kernel_find ( const char * hay, size_t len,
+        const struct needle_t * nd )
+{
+    return kernel ( hay, len, nd );
+}
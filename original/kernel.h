@@ -0,0 +1,33 @@
+/* owd-euses: single-needle substring-kernel signatures
+ * Oliver Dixon. */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stddef.h>
+
+/* needle_t: a needle compiled once, when the queries are read, so that nothing
+ * about it is recomputed by the kernels for each buffer searched:
+ *
+ *  - `text`: a copy of the needle, folded to lower-case if `no_case` is set;
+ *  - `crit`, `period`: the critical factorisation of the needle, as used by
+ *    the Two-Way algorithm, and the period of the needle if `periodic` is set
+ *    (or the shift after a full mismatch, otherwise);
+ *  - `shift`: for every byte, the distance from its last occurrence in the
+ *    needle to the end of the needle, or the length of the needle if it does
+ *    not occur; the window is skipped forward by this much whenever its last
+ *    byte does not match. */
+
+struct needle_t {
+    char * text;
+    size_t len, crit, period;
+    int periodic, no_case;
+    size_t shift [ 256 ];
+};
+
+int needle_compile ( struct needle_t *, const char *, int );
+void needle_free ( struct needle_t * );
+void kernel_select ( void );
+const char * kernel_find ( const char *, size_t, const struct needle_t * );
+
+#endif /* KERNEL_H */
@@ -0,0 +1,74 @@
+/* owd-euses: library signatures, for searching the USE-flag descriptions from
+ * other programs; link with libeuses.a and -pthread.
+ * Oliver Dixon. */
+
+#ifndef LIBEUSES_H
+#define LIBEUSES_H
+
+#include <stddef.h>
+
+/* euses_flag_t: the options of a context, given to `euses_load`; each is that
+ * of the command-line option in brackets. */
+
+enum euses_flag_t {
+    EUSES_STRICT   =  1, /* [-s] only search the flag field */
+    EUSES_NO_CASE  =  2, /* [-c] search without regard to case */
+    EUSES_PACKAGE  =  4, /* [-k] only search the package (".local") files */
+    EUSES_GLOBAL   =  8, /* [-g] only search the global files */
+    EUSES_NO_INDEX = 16, /* [-X] search the files, rather than the index */
+    EUSES_PORTDIR  = 32  /* [-d] try PORTDIR before repos.conf/ */
+};
+
+/* euses_result_t: a single result, as printed by --format. Every field is
+ * null-terminated, and only valid until the callback which is given it
+ * returns. `package` is NULL for a global flag. */
+
+struct euses_result_t {
+    const char * repo, * location, * package, * flag, * description,
+          * needle, * file;
+};
+
+/* euses_t: a search context: the repositories, their index, and their files,
+ * loaded once by `euses_load`, and the needles compiled by `euses_compile`, to
+ * be searched any number of times by `euses_search`. A context holds all of
+ * the state of its searches, so different contexts may be used at once by
+ * different threads; a single context must only be used by one thread at a
+ * time. Each search is run by as many workers as there are processors, but its
+ * callback is only called by the thread calling `euses_search`. */
+
+struct euses_t;
+
+/* Every function returning an int returns zero on success, or -1 on failure,
+ * in which case `euses_error` describes the failure, and errno is set.
+ *
+ *  - euses_new: a new context, to be loaded and compiled, or NULL on failure;
+ *  - euses_free: release a context, if it is not NULL;
+ *  - euses_load (ctx, configroot, flags): load the repositories described in
+ *    the `configroot` directory (such as "/"), with the euses_flag_t `flags`;
+ *  - euses_compile (ctx, needles, count): compile the `count` needles, which
+ *    are copied, for every later search; none may contain a line feed;
+ *  - euses_search (ctx, deliver, data, results): search for the compiled
+ *    needles, calling `deliver` with each result and `data`, in order. If
+ *    `deliver` returns non-zero, the search stops, and 1 is returned rather
+ *    than zero or -1. The number of results given to `deliver`, including
+ *    the one which stopped the search, is placed in `*results` if `results`
+ *    is not NULL, whatever is returned. A context which has been loaded but
+ *    not compiled finds nothing;
+ *  - euses_error: a description of the last failure on a context, or an empty
+ *    string if none has failed. */
+
+/* Only these are exported by libeuses.a; everything else is built hidden. */
+#pragma GCC visibility push ( default )
+
+struct euses_t * euses_new ( void );
+void euses_free ( struct euses_t * );
+int euses_load ( struct euses_t *, const char *, unsigned int );
+int euses_compile ( struct euses_t *, const char * const *, int );
+int euses_search ( struct euses_t *,
+        int ( * ) ( const struct euses_result_t *, void * ), void *,
+        size_t * );
+const char * euses_error ( const struct euses_t * );
+
+#pragma GCC visibility pop
+
+#endif /* LIBEUSES_H */
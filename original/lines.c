@@ -0,0 +1,202 @@
+/* owd-euses: per-buffer line index; see lines.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define SCAN_BLOCK ( sizeof ( __m128i ) )
+#else
+#define SCAN_BLOCK ( 1 )
+#endif /* __SSE2__ */
+
+#include "lines.h"
+
+/* [exposed function] line_index_init: prepare an empty index, with room for
+ * `capacity` line feeds. Returns zero on success, or -1 on failure, in which
+ * case errno is set by malloc. */
+
+int line_index_init ( struct line_index_t * li, size_t capacity )
+{
+    li->count = 0;
+    li->capacity = ( capacity < SCAN_BLOCK ) ? SCAN_BLOCK : capacity;
+    li->generation = 1; /* no record is of generation zero */
+    li->records = NULL;
+
+    if ( ( li->newlines = malloc ( sizeof ( size_t ) * li->capacity ) )
+            == NULL || ( li->records = calloc ( li->capacity + 1,
+                    sizeof ( struct record_t ) ) ) == NULL ) {
+        free ( li->newlines );
+        li->newlines = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] line_index_free: release the storage of an index. */
+
+void line_index_free ( struct line_index_t * li )
+{
+    free ( li->newlines );
+    free ( li->records );
+    li->newlines = NULL;
+    li->records = NULL;
+    li->count = li->capacity = 0;
+}
+
+/* [exposed function] line_index_reset: empty the index, ready for a new buffer,
+ * retaining its storage. Every record is made stale by moving on to the next
+ * generation, rather than by clearing them. */
+
+void line_index_reset ( struct line_index_t * li )
+{
+    li->count = 0;
+
+    if ( ++li->generation == 0 ) {
+        /* wrapped around: the stale records may now look current */
+        memset ( li->records, 0, sizeof ( struct record_t ) *
+                ( li->capacity + 1 ) );
+        li->generation = 1;
+    }
+}
+
+/* reserve_newlines: ensure there is room for at least `extra` more line feeds
+ * in the index. Returns zero on success, or -1 if the index could not grow. */
+
+static int reserve_newlines ( struct line_index_t * li, size_t extra )
+{
+    size_t * newlines = NULL, capacity = li->capacity;
+    struct record_t * records = NULL;
+
+    if ( li->count + extra <= capacity )
+        return 0;
+
+    while ( li->count + extra > capacity )
+        capacity *= 2;
+
+    if ( ( newlines = realloc ( li->newlines, sizeof ( size_t ) * capacity ) )
+            == NULL )
+        return -1;
+
+    li->newlines = newlines;
+    if ( ( records = realloc ( li->records, sizeof ( struct record_t ) *
+                    ( capacity + 1 ) ) ) == NULL )
+        return -1;
+
+    memset ( & ( records [ li->capacity + 1 ] ), 0, sizeof ( *records ) *
+            ( capacity - li->capacity ) );
+    li->records = records;
+    li->capacity = capacity;
+    return 0;
+}
+
+/* [exposed function] line_index_extend: append the offsets of the line feeds in
+ * buffer [ from ] to buffer [ to - 1 ] to the index. The new region must follow
+ * every region previously added. Where SSE2 is available, sixteen bytes are
+ * compared at a time, which is considerably faster than repeated memchr(3)
+ * calls for the short lines of USE-description files. Returns zero on success,
+ * or -1 if the index could not grow, in which case errno is set by realloc. */
+
+int line_index_extend ( struct line_index_t * li, const char * buffer,
+        size_t from, size_t to )
+{
+    size_t pos = from;
+
+#ifdef __SSE2__
+    const __m128i feeds = _mm_set1_epi8 ( '\n' );
+
+    for ( ; pos + SCAN_BLOCK <= to; pos += SCAN_BLOCK ) {
+        unsigned int mask = _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( feeds,
+                    _mm_loadu_si128 ( ( const __m128i * ) &
+                        ( buffer [ pos ] ) ) ) );
+
+        if ( mask == 0 )
+            continue;
+
+        if ( reserve_newlines ( li, SCAN_BLOCK ) == -1 )
+            return -1;
+
+        do {
+            li->newlines [ li->count++ ] = pos + __builtin_ctz ( mask );
+            mask &= mask - 1;
+        } while ( mask != 0 );
+    }
+#endif /* __SSE2__ */
+
+    for ( const char * feed = NULL; pos < to; pos = feed - buffer + 1 ) {
+        if ( ( feed = memchr ( & ( buffer [ pos ] ), '\n', to - pos ) )
+                == NULL )
+            break;
+
+        if ( reserve_newlines ( li, 1 ) == -1 )
+            return -1;
+
+        li->newlines [ li->count++ ] = feed - buffer;
+    }
+
+    return 0;
+}
+
+/* [exposed function] line_index_find: return the position in the index of the
+ * first line feed at or after `offset`, or the number of line feeds in the
+ * index if there is none. The line containing `offset` therefore begins
+ * immediately after the line feed preceding the returned position (if any), and
+ * ends at the line feed at the returned position (if any). */
+
+size_t line_index_find ( const struct line_index_t * li, size_t offset )
+{
+    size_t low = 0, high = li->count;
+
+    while ( low < high ) {
+        size_t mid = low + ( high - low ) / 2;
+
+        if ( li->newlines [ mid ] < offset )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/* parse_record: find the field separators of the entry beginning at `line`,
+ * which ends at the first '\n' or null-terminator, in a single pass. As before
+ * records were kept, the package-flag separator is only that of the first ':',
+ * and only if it precedes the flag-description separator. */
+
+static void parse_record ( struct record_t * record, const char * line )
+{
+    ptrdiff_t colon = -1;
+
+    record->pkgflag = record->flagdesc = -1;
+    for ( const char * c = line; *c != '\0' && *c != '\n'; c++ )
+        if ( *c == ':' && colon == -1 )
+            colon = c - line;
+        else if ( *c == ' ' && c [ 1 ] == '-' && c [ 2 ] == ' ' ) {
+            record->flagdesc = c - line;
+            record->pkgflag = colon;
+            break;
+        }
+}
+
+/* [exposed function] line_index_record: return the record of the line ending at
+ * the line feed at position `feed` in the index (or the line after the last
+ * line feed, if `feed` is the number of line feeds), within `buffer`, from
+ * which the index was built. A line is parsed only the first time its record is
+ * requested after the index was last reset, however many needles match it. */
+
+const struct record_t * line_index_record ( struct line_index_t * li,
+        size_t feed, const char * buffer )
+{
+    struct record_t * record = & ( li->records [ feed ] );
+
+    if ( record->generation != li->generation ) {
+        parse_record ( record, ( feed == 0 ) ? buffer :
+                & ( buffer [ li->newlines [ feed - 1 ] + 1 ] ) );
+        record->generation = li->generation;
+    }
+
+    return record;
+}
@@ -0,0 +1,41 @@
+/* owd-euses: per-buffer line-index signatures
+ * Oliver Dixon. */
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <stddef.h>
+
+/* record_t: the fields of a single entry, "[category/package:]flag - desc", as
+ * offsets from the start of its line: `pkgflag` is that of the ':' separating
+ * the package from the flag, or -1 for a global flag, and `flagdesc` is that of
+ * the " - " separating the flag from its description, or -1 if the entry is
+ * poorly formatted. `generation` is that of the index when it was parsed. */
+
+struct record_t {
+    ptrdiff_t pkgflag, flagdesc;
+    unsigned int generation;
+};
+
+/* line_index_t: the offsets of every '\n' in a buffer, in ascending order. The
+ * index is built once, as the buffer is filled, so the start and end of the
+ * line surrounding any offset can be found with a binary search, rather than
+ * by scanning the buffer backwards from every match. The record of each line is
+ * parsed when it is first requested, and is kept until the index is reset. */
+
+struct line_index_t {
+    size_t * newlines; /* offsets of the line feeds in the buffer */
+    size_t count, capacity;
+    struct record_t * records; /* per line, including any after the last feed */
+    unsigned int generation; /* records of any other generation are stale */
+};
+
+int line_index_init ( struct line_index_t *, size_t );
+void line_index_free ( struct line_index_t * );
+void line_index_reset ( struct line_index_t * );
+int line_index_extend ( struct line_index_t *, const char *, size_t, size_t );
+size_t line_index_find ( const struct line_index_t *, size_t );
+const struct record_t * line_index_record ( struct line_index_t *, size_t,
+        const char * );
+
+#endif /* LINES_H */
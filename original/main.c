@@ -0,0 +1,198 @@
+/* owd-euses: command-line driver; the search itself is in euses.c.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "euses.h"
+#include "args.h"
+#include "converse.h"
+#include "stack.h"
+#include "automaton.h"
+#include "stats.h"
+#include "trace.h"
+
+#define EXIT_ERROR ( 2 ) /* Hard-error exit status in the result modes */
+
+/* prelim_checks: perform some preliminary checks, primarily revolving around
+ * the argument-processing stage. This function returns zero on success, -1 on
+ * hard-failure, and 1 on soft-failure (the program should probably terminate,
+ * but not return a failing status code). `argc` and `argv` should be the raw
+ * values provided by the environment, and `arg_idx` is the index, in `argv`, of
+ * the first non-argument entry. */
+
+static int prelim_checks ( int argc, char ** argv, int * arg_idx )
+{
+    if ( process_args ( argc, argv, arg_idx ) == -1 )
+        return -1; /* process_args invokes print_fatal */
+
+    if ( CHK_ARG ( options, ARG_SHOW_VERSION ) != 0 )
+        print_version_info ( );
+
+    if ( CHK_ARG ( options, ARG_SHOW_HELP ) != 0 ) {
+        print_help_info ( argv [ 0 ] );
+        return 1; /* show help and quit */
+    }
+
+    if ( argc - *arg_idx <= 0 && CHK_ARG ( options, ( ARG_BUILD_INDEX |
+                    ARG_BATCH | ARG_DAEMON ) ) == 0 ) {
+        /* no queries; nothing to do (unless building the index, or
+         * reading the queries from stdin or clients) */
+        populate_info_buffer ( NULL );
+        print_warning ( WARNING_QNONE, &provide_gen_warning );
+        return 1;
+    }
+
+    return 0;
+}
+
+/* failure_status: the exit status for a "hard" error. In the result modes (see
+ * ARG_RESULT_MODES), EXIT_FAILURE means that nothing was found, so errors are
+ * distinguished, as with grep(1). */
+
+static int failure_status ( void )
+{
+    return ( CHK_ARG ( options, ARG_RESULT_MODES ) != 0 ) ? EXIT_ERROR :
+        EXIT_FAILURE;
+}
+
+/* exit_status: report the `status` of the search, which found `results`, with
+ * ARG_COUNT, printing their number, and return the exit status of owd-euses;
+ * see `main`. */
+
+static int exit_status ( enum status_t status, size_t results )
+{
+    if ( status != STATUS_OK ) {
+        if ( status != STATUS_CLOSED )
+            /* A closed pipe, such as that of head(1), is not worth a
+             * complaint; the search simply stops. */
+            print_fatal ( ( CHK_ARG ( options, ARG_DAEMON ) != 0 ) ?
+                    "Could not serve the queries of clients." :
+                    "Could not load the USE-description files.",
+                    status, &provide_gen_error );
+        return failure_status ( );
+    }
+
+    if ( CHK_ARG ( options, ARG_COUNT ) != 0 &&
+            CHK_ARG ( options, ARG_BATCH ) == 0 &&
+            printf ( "%zu\n", results ) < 0 )
+        /* the count of each query of a batch has been printed */
+        return failure_status ( );
+
+    if ( CHK_ARG ( options, ARG_RESULT_MODES ) != 0 && results == 0 )
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+/* main: entry point for owd-euses. See args.h for a list and description of the
+ * accepted arguments. EXIT_SUCCESS does not necessarily imply a complete
+ * execution, but only indicates that no "hard" error was encountered. In the
+ * result modes, EXIT_SUCCESS is only returned if a result was found (by any
+ * query, with ARG_BATCH).
+ *
+ * Syntax: [OPTION]... [SUBSTRING]... */
+
+int main ( int argc, char ** argv )
+{
+    char base [ PATH_MAX ];
+    struct repo_stack_t repo_stack;
+    struct automaton_t automaton;
+    enum status_t status = STATUS_OK;
+    enum stats_phase_t phase = PHASE_NONE;
+    unsigned long long start = 0;
+    int arg_idx = 0, prelim_status = 0, served = 0;
+    size_t results = 0;
+
+    info_buffer [ 0 ] = '\0';
+
+    if ( ( prelim_status = prelim_checks ( argc, argv, &arg_idx ) ) == -1 )
+        return failure_status ( );
+    else if ( prelim_status == 1 )
+        return EXIT_SUCCESS;
+
+    if ( CHK_ARG ( options, ARG_CLIENT ) != 0 ) {
+        /* the repositories are only loaded if the daemon cannot search */
+        status = search_daemon ( & ( argv [ arg_idx ] ), argc - arg_idx,
+                &results, &served );
+        if ( served )
+            return exit_status ( status, results );
+    }
+
+    if ( CHK_ARG ( options, ARG_STATS ) != 0 &&
+            CHK_ARG ( options, ARG_DAEMON ) == 0 )
+        /* a daemon is never over, so has no statistics to print */
+        stats_start ( );
+
+    if ( CHK_ARG ( options, ARG_TRACE ) != 0 &&
+            CHK_ARG ( options, ARG_DAEMON ) == 0 &&
+            trace_open ( option_trace ) == -1 ) {
+        print_fatal ( "Could not open the trace file.", STATUS_ERRNO,
+                &provide_gen_error );
+        return failure_status ( );
+    }
+
+    /* push the repositories onto the stack */
+    start = trace_now ( );
+    phase = stats_phase ( PHASE_REPOS );
+    status = get_repos ( base, NULL, &repo_stack );
+    stats_phase ( phase );
+    trace_span ( "repos", "get_repos", start, base, "repos",
+            ( status == STATUS_OK ) ? repo_stack.size : 0 );
+    if ( status != STATUS_OK ) {
+        print_fatal ( "Could not use the repository-description " \
+                "base directory.", status, &provide_gen_error );
+        return failure_status ( );
+    }
+
+    if ( repo_stack.size == 0 ) {
+        populate_info_buffer ( NULL );
+        print_warning ( WARNING_RNONE, &provide_gen_warning );
+        stack_cleanse ( &repo_stack );
+        return EXIT_SUCCESS;
+    }
+
+    if ( stats_register ( &repo_stack ) == -1 ) {
+        print_fatal ( "Could not gather the statistics.", STATUS_ERRNO,
+                &provide_gen_error );
+        stack_cleanse ( &repo_stack );
+        return failure_status ( );
+    }
+
+    if ( CHK_ARG ( options, ARG_DAEMON ) != 0 )
+        /* serves the clients until stopped, so only returns on failure */
+        status = serve_queries ( &repo_stack, base );
+    else if ( CHK_ARG ( options, ARG_BATCH ) != 0 )
+        /* the needles of each query are compiled as it is read */
+        status = search_batch ( &repo_stack, &results );
+    else {
+        /* compile the needles once for every buffer of every repository */
+        if ( automaton_build ( &automaton, & ( argv [ arg_idx ] ),
+                    argc - arg_idx, CHK_ARG ( options,
+                        ARG_SEARCH_NO_CASE ) != 0, option_engine ) == -1 ) {
+            populate_info_buffer ( "Needle automaton" );
+            print_fatal ( "Could not compile the queries.", STATUS_ERRNO,
+                    &provide_gen_error );
+            stack_cleanse ( &repo_stack );
+            return failure_status ( );
+        }
+
+        /* buffer and search the repository USE-description files */
+        status = search_files ( &repo_stack, & ( argv [ arg_idx ] ), argc
+                - arg_idx, &automaton, &results );
+        automaton_free ( &automaton );
+    }
+
+    if ( stats_enabled )
+        stats_print ( option_format == FORMAT_NDJSON );
+
+    stats_free ( );
+    if ( trace_enabled && trace_close ( ) == -1 ) {
+        populate_info_buffer ( option_trace );
+        print_warning ( WARNING_ERRNO, &provide_gen_warning );
+    }
+
+    stack_cleanse ( &repo_stack );
+    return exit_status ( status, results );
+}
+
@@ -0,0 +1,559 @@
+/* owd-euses: ordered worker pool; see pool.h.
+ * Oliver Dixon. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "converse.h"
+#include "pool.h"
+
+#define POOL_IOV ( 256 ) /* The most buffers written by a single writev(2). */
+
+/* pool_slot_t: the result of a single item. The output of each item is
+ * collected in memory, and written to `fd` by the calling thread strictly in
+ * the order of the items, so the output is identical to that of a sequential
+ * run, regardless of the order in which the items are completed. */
+
+struct pool_slot_t {
+    char * out; /* the output of the item, taken from `sink` */
+    size_t out_len;
+    struct sink_t sink; /* collects `out`, while the item is being processed */
+    size_t * marks, marked; /* the ends of the sections; see `pool_section` */
+    size_t sections;
+    int done, status; /* completion; result of `run` */
+    struct diagnostic_t failure; /* that of `run`, if it failed */
+    struct diagnostics_t warnings; /* those raised by `run`, deferred */
+};
+
+/* The slot of the item being processed by the current thread, if any. */
+static _Thread_local struct pool_slot_t * current_slot = NULL;
+
+/* pool_t: the state shared by the workers and the calling thread. `next` is
+ * the next item to be taken; items are taken in order, so every item before
+ * `next` is either completed or in progress. Once `stop` is set, no further
+ * items are taken. */
+
+struct pool_t {
+    const struct pool_job_t * job;
+    struct pool_slot_t * slots;
+    size_t next;
+    int stop;
+    struct diagnostic_t failure; /* that of a failed `worker_init` */
+    pthread_mutex_t lock;
+    pthread_cond_t done; /* signalled whenever a slot is completed */
+};
+
+/* [exposed function] pool_default_jobs: return the number of processors
+ * available, used when the number of jobs has not been given. */
+
+int pool_default_jobs ( )
+{
+    long cpus = sysconf ( _SC_NPROCESSORS_ONLN );
+
+    return ( cpus < 1 ) ? 1 : ( cpus > POOL_JOBS_MAX ) ? POOL_JOBS_MAX :
+        ( int ) cpus;
+}
+
+/* [exposed function] pool_section: end the current section of the output of
+ * the item being written to `out`; see pool_job_t. Once every section has been
+ * ended, the rest of the output belongs to the last. Outside of a worker, the
+ * output is written directly, so this function does nothing. */
+
+void pool_section ( const struct sink_t * out )
+{
+    struct pool_slot_t * slot = current_slot;
+
+    if ( slot == NULL || & ( slot->sink ) != out ||
+            slot->marked + 1 >= slot->sections )
+        return;
+
+    slot->marks [ slot->marked++ ] = out->len;
+}
+
+/* run_slot: process the item `item` in the calling worker, collecting its
+ * output, in memory, and result in the corresponding slot, with the warnings
+ * raised meanwhile, which are printed as its output is written (see
+ * `emit_slots`). */
+
+static void run_slot ( struct pool_t * pool, void * state, size_t item )
+{
+    struct pool_slot_t * slot = & ( pool->slots [ item ] );
+
+    sink_init ( & ( slot->sink ), -1 );
+    current_slot = slot;
+    diagnostics = & ( slot->warnings );
+    slot->status = pool->job->run ( state, pool->job->shared, item,
+            & ( slot->sink ) );
+    diagnostics = NULL;
+    current_slot = NULL;
+
+    if ( slot->sink.error != 0 && slot->status != -1 ) {
+        errno = slot->sink.error;
+        populate_info_buffer ( "Output stream" );
+        slot->status = -1;
+    }
+
+    slot->out = sink_release ( & ( slot->sink ), & ( slot->out_len ) );
+
+    if ( slot->status == -1 )
+        keep_diagnostic ( & ( slot->failure ) );
+}
+
+/* pool_worker: the body of every worker thread, taking and processing items in
+ * order until there are none left, or the pool is stopped. */
+
+static void * pool_worker ( void * arg )
+{
+    struct pool_t * pool = arg;
+    void * state = NULL;
+    size_t item = 0;
+
+    if ( pool->job->worker_init ( &state, pool->job->shared ) == -1 ) {
+        pthread_mutex_lock ( & ( pool->lock ) );
+        if ( !pool->stop ) {
+            pool->stop = 1;
+            keep_diagnostic ( & ( pool->failure ) );
+        }
+
+        pthread_cond_broadcast ( & ( pool->done ) );
+        pthread_mutex_unlock ( & ( pool->lock ) );
+        return NULL;
+    }
+
+    for ( ;; ) {
+        pthread_mutex_lock ( & ( pool->lock ) );
+        if ( pool->stop || pool->next >= pool->job->count ) {
+            pthread_mutex_unlock ( & ( pool->lock ) );
+            break;
+        }
+
+        item = pool->next++;
+        pthread_mutex_unlock ( & ( pool->lock ) );
+
+        run_slot ( pool, state, item );
+
+        pthread_mutex_lock ( & ( pool->lock ) );
+        pool->slots [ item ].done = 1;
+        if ( pool->slots [ item ].status != 0 )
+            /* the items already taken are completed, for their
+             * output precedes the failure (or end) */
+            pool->stop = 1;
+
+        pthread_cond_broadcast ( & ( pool->done ) );
+        pthread_mutex_unlock ( & ( pool->lock ) );
+    }
+
+    pool->job->worker_free ( state );
+    return NULL;
+}
+
+/* await_slot: wait for the item `item` to be completed. Returns zero once it
+ * is, or -1 if it never will be, having been left untaken when the pool was
+ * stopped by a worker which could not be prepared, in which case errno and the
+ * information buffer are restored from that worker. */
+
+static int await_slot ( struct pool_t * pool, size_t item )
+{
+    struct pool_slot_t * slot = & ( pool->slots [ item ] );
+
+    pthread_mutex_lock ( & ( pool->lock ) );
+    while ( !slot->done && ! ( pool->stop && item >= pool->next ) )
+        pthread_cond_wait ( & ( pool->done ), & ( pool->lock ) );
+
+    if ( !slot->done ) {
+        restore_diagnostic ( & ( pool->failure ) );
+        pthread_mutex_unlock ( & ( pool->lock ) );
+        return -1;
+    }
+
+    pthread_mutex_unlock ( & ( pool->lock ) );
+    return 0;
+}
+
+/* slot_ready: return non-zero if the item `item` has been completed, without
+ * waiting for it. */
+
+static int slot_ready ( struct pool_t * pool, size_t item )
+{
+    int done = 0;
+
+    pthread_mutex_lock ( & ( pool->lock ) );
+    done = pool->slots [ item ].done;
+    pthread_mutex_unlock ( & ( pool->lock ) );
+    return done;
+}
+
+/* section_end: return the offset in the output of `slot` at which the section
+ * `section` ends. */
+
+static inline size_t section_end ( const struct pool_slot_t * slot,
+        size_t section )
+{
+    return ( section < slot->marked ) ? slot->marks [ section ] :
+        slot->out_len;
+}
+
+/* pool_batch_t: the output of completed items, queued to be written to `fd`
+ * by a single writev(2), rather than a write per item. The output of the items
+ * from `unfreed` onwards may be referenced by the queue, so is kept until the
+ * queue has been written. */
+
+struct pool_batch_t {
+    struct iovec iov [ POOL_IOV ];
+    int count;
+    size_t unfreed;
+};
+
+/* write_output: write the `count` buffers of `iov` to the `fd` of the `job`,
+ * or pass them to its `emit`; see pool_job_t. Returns zero on success, or -1
+ * on failure, in which case errno and the information buffer are set. */
+
+static int write_output ( const struct pool_job_t * job, struct iovec * iov,
+        int count )
+{
+    for ( int i = 0; job->emit != NULL && i < count; i++ )
+        if ( job->emit ( job->shared, iov [ i ].iov_base,
+                    iov [ i ].iov_len ) == -1 ) {
+            populate_info_buffer ( "Output stream" );
+            return -1;
+        }
+
+    if ( job->emit == NULL && count > 0 && sink_writev ( job->fd, iov,
+                count ) == -1 ) {
+        populate_info_buffer ( "Output stream" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* flush_batch: write the queued output of the `batch` (see `write_output`),
+ * then release the output of every item before `upto`. Returns as
+ * `write_output`. */
+
+static int flush_batch ( struct pool_t * pool, struct pool_batch_t * batch,
+        size_t upto )
+{
+    if ( write_output ( pool->job, batch->iov, batch->count ) == -1 )
+        return -1;
+
+    batch->count = 0;
+    for ( ; batch->unfreed < upto; batch->unfreed++ ) {
+        free ( pool->slots [ batch->unfreed ].out );
+        pool->slots [ batch->unfreed ].out = NULL;
+    }
+
+    return 0;
+}
+
+/* queue_output: add the `len` bytes of `data`, from the output of an item of
+ * the group beginning with the item `first`, to the `batch`, writing the batch
+ * first if it is full. Returns as `flush_batch`. */
+
+static int queue_output ( struct pool_t * pool, struct pool_batch_t * batch,
+        const char * data, size_t len, size_t first )
+{
+    if ( len == 0 )
+        return 0;
+
+    if ( batch->count == POOL_IOV && flush_batch ( pool, batch, first )
+            == -1 )
+        return -1;
+
+    batch->iov [ batch->count ].iov_base = ( void * ) data;
+    batch->iov [ batch->count++ ].iov_len = len;
+    return 0;
+}
+
+/* queue_group: queue the output of the group of items from `first` to `last`
+ * (exclusive), section by section; see pool_job_t. Returns as `flush_batch`. */
+
+static int queue_group ( struct pool_t * pool, struct pool_batch_t * batch,
+        size_t first, size_t last )
+{
+    for ( size_t s = 0; s < pool->slots [ first ].sections; s++ )
+        for ( size_t i = first; i < last; i++ ) {
+            const struct pool_slot_t * slot = & ( pool->slots [ i ] );
+            size_t start = ( s == 0 ) ? 0 : section_end ( slot, s - 1 );
+
+            if ( queue_output ( pool, batch, & ( slot->out [ start ] ),
+                        section_end ( slot, s ) - start, first ) == -1 )
+                return -1;
+        }
+
+    return 0;
+}
+
+/* warn_items: print the warnings deferred by the items from `first` to `last`
+ * (exclusive), in order, writing the output queued in the `batch` beforehand,
+ * so that each warning follows the output of the item which raised it. Returns
+ * as `flush_batch`. */
+
+static int warn_items ( struct pool_t * pool, struct pool_batch_t * batch,
+        size_t first, size_t last )
+{
+    size_t i = first;
+
+    while ( i < last && pool->slots [ i ].warnings.count == 0 )
+        i++;
+
+    if ( i == last )
+        return 0;
+
+    if ( flush_batch ( pool, batch, last ) == -1 )
+        return -1;
+
+    for ( ; i < last; i++ )
+        flush_diagnostics ( & ( pool->slots [ i ].warnings ) );
+
+    return 0;
+}
+
+/* emit_slots: in the calling thread, write the output of every item to `fd`
+ * in order, as soon as each (or each group; see pool_job_t) is completed. The
+ * output of consecutive completed items is written together; see
+ * pool_batch_t. The warnings of each item are printed as its output is written;
+ * see `warn_items`. Returns zero if every item succeeded, or -1 once the first
+ * failure (in item order) is reached, or `fd` cannot be written, in which
+ * case errno and the information buffer are set, or restored from the failed
+ * item or worker. The output of a single item is written up to its failure,
+ * but that of a failed group is discarded, as its sections would be
+ * incomplete. */
+
+static int emit_slots ( struct pool_t * pool )
+{
+    const struct pool_job_t * job = pool->job;
+    struct pool_batch_t batch = { .count = 0 };
+
+    for ( size_t i = 0, last = 0; i < job->count; i = last ) {
+        struct pool_slot_t * failed = NULL;
+        int status = 0;
+
+        for ( last = i + 1; job->joins != NULL && last < job->count &&
+                job->joins ( job->shared, last ); last++ )
+            ;
+
+        for ( size_t j = i; j < last; j++ ) {
+            /* write the batch, rather than keep it waiting */
+            if ( batch.count > 0 && !slot_ready ( pool, j ) &&
+                    flush_batch ( pool, &batch, i ) == -1 )
+                return -1;
+
+            if ( await_slot ( pool, j ) == -1 )
+                return -1;
+
+            if ( failed == NULL && pool->slots [ j ].status == -1 )
+                failed = & ( pool->slots [ j ] );
+        }
+
+        if ( last == i + 1 )
+            status = queue_output ( pool, &batch, pool->slots [ i ].out,
+                    pool->slots [ i ].out_len, i );
+        else if ( failed == NULL )
+            status = queue_group ( pool, &batch, i, last );
+
+        if ( status == 0 )
+            status = warn_items ( pool, &batch, i, last );
+
+        if ( status == 0 && ( failed != NULL || last == job->count ||
+                    pool->slots [ i ].status == 1 ) )
+            status = flush_batch ( pool, &batch, last );
+
+        if ( status == -1 )
+            return -1;
+
+        if ( pool->slots [ i ].status == 1 )
+            /* no further items are needed; see pool_job_t */
+            return 0;
+
+        if ( failed != NULL ) {
+            restore_diagnostic ( & ( failed->failure ) );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* emit_sink: pass the contents of the sink `out`, growing in memory, to the
+ * `emit` of the `job`, and empty the sink. Returns as `write_output`. */
+
+static int emit_sink ( const struct pool_job_t * job, struct sink_t * out )
+{
+    struct iovec iov = { .iov_base = out->buffer, .iov_len = out->len };
+
+    if ( out->error != 0 ) {
+        errno = out->error;
+        populate_info_buffer ( "Output stream" );
+        return -1;
+    }
+
+    if ( write_output ( job, &iov, out->len > 0 ) == -1 )
+        return -1;
+
+    out->len = 0;
+    return 0;
+}
+
+/* write_item: write the output of the item just processed into `out` by
+ * `run_sequentially` (see `emit_sink`), unless it is left to fill the sink
+ * (writing to `fd`), followed by its `warnings`, so that they are printed in
+ * the same order as they are by a pool (see `warn_items`). Returns as
+ * `write_output`. */
+
+static int write_item ( const struct pool_job_t * job, struct sink_t * out,
+        struct diagnostics_t * warnings )
+{
+    if ( job->emit != NULL ) {
+        if ( emit_sink ( job, out ) == -1 )
+            return -1;
+    } else if ( warnings->count > 0 && sink_flush ( out ) == -1 ) {
+        errno = out->error;
+        populate_info_buffer ( "Output stream" );
+        return -1;
+    }
+
+    flush_diagnostics ( warnings );
+    return 0;
+}
+
+/* run_sequentially: process every item in the calling thread, writing the
+ * output to `fd` through a single sink, or passing that of each item to
+ * `emit`; see `pool_run`. Items must not be grouped. */
+
+static int run_sequentially ( const struct pool_job_t * job )
+{
+    struct diagnostics_t * outer = diagnostics,
+                         warnings = { .list = NULL, .count = 0 };
+    struct sink_t out;
+    void * state = NULL;
+    int status = 0;
+
+    if ( sink_init ( &out, ( job->emit != NULL ) ? -1 : job->fd ) == -1 ) {
+        populate_info_buffer ( "Output stream" );
+        return -1;
+    }
+
+    if ( job->worker_init ( &state, job->shared ) == -1 ) {
+        sink_free ( &out );
+        return -1;
+    }
+
+    diagnostics = &warnings;
+    for ( size_t i = 0; i < job->count && status == 0; i++ )
+        if ( ( status = job->run ( state, job->shared, i, &out ) ) != -1 &&
+                write_item ( job, &out, &warnings ) == -1 )
+            status = -1;
+
+    diagnostics = outer;
+    if ( status == 1 )
+        /* no further items are needed; see pool_job_t */
+        status = 0;
+
+    if ( job->emit == NULL && sink_flush ( &out ) == -1 && status == 0 ) {
+        errno = out.error;
+        populate_info_buffer ( "Output stream" );
+        status = -1;
+    }
+
+    /* those of a failed item follow what it wrote */
+    flush_diagnostics ( &warnings );
+    job->worker_free ( state );
+    sink_free ( &out );
+    return status;
+}
+
+/* has_groups: return non-zero if any item of the `job` joins the group of the
+ * item before it; see pool_job_t. */
+
+static int has_groups ( const struct pool_job_t * job )
+{
+    for ( size_t i = 1; job->joins != NULL && i < job->count; i++ )
+        if ( job->joins ( job->shared, i ) )
+            return 1;
+
+    return 0;
+}
+
+/* [exposed function] pool_run: process every item of the `job` using up to
+ * `job->jobs` worker threads, writing the output of the items to `job->fd` (or
+ * passing it to `job->emit`) in the order of the items. If only one job is
+ * requested (or there is only one item), and no items are grouped, the items
+ * are processed in the calling thread, and no threads are created. The output
+ * is written to the descriptor directly; if it is that of stdout, anything
+ * already buffered by stdio is written first. Returns zero on success, or -1 on
+ * the first failure in item order, in which case errno and the information
+ * buffer are set appropriately; the output of every preceding item is written
+ * regardless. */
+
+int pool_run ( const struct pool_job_t * job )
+{
+    struct pool_t pool = { .job = job };
+    pthread_t threads [ POOL_JOBS_MAX ];
+    size_t * marks = NULL;
+    const size_t sections = ( job->sections > 1 ) ? job->sections : 1;
+    int workers = ( job->jobs > POOL_JOBS_MAX ) ? POOL_JOBS_MAX : job->jobs,
+        started = 0, status = 0, error = 0;
+
+    if ( ( size_t ) workers > job->count )
+        workers = job->count;
+
+    if ( job->emit == NULL && job->fd == STDOUT_FILENO )
+        fflush ( stdout );
+
+    if ( workers <= 1 && !has_groups ( job ) )
+        return run_sequentially ( job );
+
+    if ( ( pool.slots = calloc ( job->count, sizeof ( *pool.slots ) ) )
+            == NULL || ( marks = malloc ( sizeof ( *marks ) * sections *
+                    job->count ) ) == NULL ) {
+        populate_info_buffer ( "Worker pool" );
+        free ( pool.slots );
+        return -1;
+    }
+
+    for ( size_t i = 0; i < job->count; i++ ) {
+        pool.slots [ i ].marks = & ( marks [ i * sections ] );
+        pool.slots [ i ].sections = sections;
+    }
+
+    pthread_mutex_init ( & ( pool.lock ), NULL );
+    pthread_cond_init ( & ( pool.done ), NULL );
+
+    for ( ; started < workers; started++ )
+        if ( ( errno = pthread_create ( & ( threads [ started ] ), NULL,
+                        &pool_worker, &pool ) ) != 0 )
+            break;
+
+    if ( started == 0 ) {
+        /* not a single thread could be created */
+        populate_info_buffer ( "Worker pool" );
+        status = -1;
+    } else if ( ( status = emit_slots ( &pool ) ) == -1 ) {
+        pthread_mutex_lock ( & ( pool.lock ) );
+        pool.stop = 1;
+        pthread_mutex_unlock ( & ( pool.lock ) );
+    }
+
+    error = errno;
+    for ( int i = 0; i < started; i++ )
+        pthread_join ( threads [ i ], NULL );
+
+    for ( size_t i = 0; i < job->count; i++ ) {
+        /* those of the items which were not written are discarded */
+        free ( pool.slots [ i ].out );
+        free_diagnostics ( & ( pool.slots [ i ].warnings ) );
+    }
+
+    pthread_cond_destroy ( & ( pool.done ) );
+    pthread_mutex_destroy ( & ( pool.lock ) );
+    free ( pool.slots );
+    free ( marks );
+    errno = error;
+    return status;
+}
@@ -0,0 +1,60 @@
+/* owd-euses: ordered worker-pool signatures
+ * Oliver Dixon. */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#include "sink.h"
+
+#define POOL_JOBS_MAX ( 256 )
+
+/* pool_job_t: a list of `count` independent items, to be processed by up to
+ * `jobs` worker threads, the output of which is written to the descriptor
+ * `fd`. Each worker prepares its own state with `worker_init` (returning zero
+ * on success, or -1 on failure with errno and the information buffer set),
+ * releases it with `worker_free`, and processes an item with
+ * `run`, which must write its output to the sink `out` rather than `fd`, and
+ * return zero on success, or -1 on failure with errno and the information
+ * buffer set. `run` may also return 1 on success if no further items are
+ * needed, such as once a result has been found when only its existence is of
+ * interest; no further items are taken, and the output of any item after it is
+ * discarded. Such items must not be grouped. The warnings raised by `run` in a
+ * worker are deferred (see diagnostics_t), and printed, by the thread running
+ * the job, as the output of the item is written, so they follow the order of
+ * the items, rather than that in which they were completed; those of an item
+ * the output of which is discarded are discarded with it.
+ * `shared` is passed to every callback, and must not be modified by them,
+ * other than in the part belonging to the item at hand.
+ *
+ * If `joins` is given, it returns non-zero for an item which continues the
+ * group of the item before it, such as the parts of a single piece of work
+ * which have been split up. The output of each item is then divided into (up
+ * to) `sections` by `pool_section`, and the output of a group is written
+ * section by section: the first section of every item of the group in order,
+ * then the second, and so on.
+ *
+ * If `emit` is given, the output is passed to it, in the same order, rather
+ * than written to `fd`. It is only called by the thread running the job, with
+ * `shared`, and returns zero on success, or -1 on failure, with errno set,
+ * which fails the job as a failed write would. Each piece it is given is the
+ * whole output of an item, or of a section of one. */
+
+struct pool_job_t {
+    size_t count, sections;
+    int jobs, fd;
+    void * shared;
+    int ( * worker_init ) ( void ** state, void * shared );
+    void ( * worker_free ) ( void * state );
+    int ( * run ) ( void * state, void * shared, size_t item,
+            struct sink_t * out );
+    int ( * joins ) ( void * shared, size_t item );
+    int ( * emit ) ( void * shared, const char * data, size_t len );
+};
+
+int pool_default_jobs ( void );
+void pool_section ( const struct sink_t * );
+int pool_run ( const struct pool_job_t * );
+
+#endif /* POOL_H */
@@ -0,0 +1,376 @@
+/* owd-euses: streamed and memory-mapped USE-description readers; see reader.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "euses.h"
+#include "converse.h"
+#include "reader.h"
+#include "stats.h"
+
+#define LBUF_SZ_MIN ( 512  ) /* Minimum primary buffer size. */
+
+#ifndef LBUF_SZ
+/* A user/distributor may want to change this. A line of a streamed file which
+ * the buffer cannot hold is searched a window at a time, but only its start is
+ * printed; see the QUIRKS section of the manual. */
+#define LBUF_SZ     ( 8192 ) /* Default primary buffer size. */
+#else
+#if LBUF_SZ < LBUF_SZ_MIN
+/* Anything lower than LBUF_SZ_MIN would cause the output to be about as
+ * readable as Finnegans Wake, as most entries would exceed the buffer. */
+#error "LBUF_SZ cannot be so minute."
+#endif /* LBUF_SZ < LBUF_SZ_MIN */
+#endif /* LBUF_SZ */
+
+/* The largest number of bytes read in a single fill, leaving room to complete
+ * the final line of a file with a line feed, and to null-terminate it. */
+#define LBUF_FILL ( LBUF_SZ - 2 )
+
+/* The most of the start of an over-long line kept in the buffer, to be printed
+ * once the rest of the line has been searched. */
+#define LBUF_HEAD ( LBUF_SZ / 4 )
+
+/* within_long_line: non-zero if the last window lies within an over-long line,
+ * which continues beyond it. */
+#define within_long_line( bi ) \
+    ( ( bi )->long_line == LONG_BEGIN || ( bi )->long_line == LONG_MIDDLE )
+
+/* carry_partial_line: move the unfinished line following the searched window
+ * to the start of the buffer, restoring the byte displaced by the window's
+ * null-terminator; or, if the window lay within an over-long line, move its
+ * last `bi->overlap` bytes to follow the kept start of the line, so that a
+ * match running from one window into the next is found in the next. The
+ * length of the carried bytes, and any start of a line kept before them, is
+ * left in `bi->idx`. */
+
+static void carry_partial_line ( struct buffer_info_t * bi )
+{
+    if ( within_long_line ( bi ) ) {
+        bi->line_offset += bi->len - bi->start - bi->overlap;
+        memmove ( & ( bi->buffer [ bi->head ] ), & ( bi->buffer [ bi->len -
+                    bi->overlap ] ), bi->overlap );
+        bi->start = bi->head;
+        bi->idx = bi->head + bi->overlap;
+        return;
+    }
+
+    bi->idx = bi->start = bi->head = 0;
+
+    if ( bi->end < bi->len ) {
+        bi->buffer [ bi->end ] = bi->held;
+        bi->idx = bi->len - bi->end;
+        memmove ( bi->buffer, & ( bi->buffer [ bi->end ] ), bi->idx );
+    }
+}
+
+/* begin_long_line: the buffer being filled by a single line, without a line
+ * feed, keep as much of its start as LBUF_HEAD (or less, if the needles are
+ * so long that the windows would otherwise not advance), and begin to search
+ * it a window at a time. */
+
+static void begin_long_line ( struct buffer_info_t * bi )
+{
+    if ( bi->overlap > LBUF_FILL - 2 )
+        bi->overlap = LBUF_FILL - 2;
+
+    bi->head = ( LBUF_HEAD < LBUF_FILL - bi->overlap - 1 ) ? LBUF_HEAD :
+        LBUF_FILL - bi->overlap - 1;
+    bi->line_offset = 0;
+    bi->long_line = LONG_BEGIN;
+}
+
+/* determine_buffer_nature: given a freshly filled buffer `bi->buffer`, this
+ * function determines the window of whole lines to be searched. If `bw`, the
+ * number of bytes read, falls short of the request, the file has ended (or
+ * failed), and BUFSTAT_LAST is returned with the final line completed by a line
+ * feed if necessary. Otherwise, the window ends after the last line feed in the
+ * buffer, and the partial line beyond it is held back for the next fill, which
+ * completes it; BUFSTAT_FULL is returned. No seeking is required. If a single
+ * line fills the whole buffer, the window is that part of the line, and the
+ * line is searched a window at a time, until its end; see long_line_t. If any
+ * error occurs, BUFSTAT_ERRNO is returned, and `errno` and the information
+ * buffer are populated appropriately.
+ *
+ * This function always closes the source (see `source_close`) should (a) the
+ * file have ended, or (b) an error occur. */
+
+static enum buffer_status_t determine_buffer_nature ( size_t bw,
+        struct buffer_info_t * bi )
+{
+    const int within = within_long_line ( bi );
+
+    if ( bw < LBUF_FILL - bi->idx ) {
+        /* the buffer has not been filled because the file has no more
+         * bytes */
+        source_close ( & ( bi->src ) );
+
+        if ( ( bi->len > bi->start ) ? bi->buffer [ bi->len - 1 ] != '\n' :
+                within ) {
+            /* complete the final line */
+            bi->buffer [ bi->len ] = '\n';
+            if ( line_index_extend ( & ( bi->lines ), & ( bi->buffer
+                            [ bi->start ] ), bi->len - bi->start,
+                        bi->len - bi->start + 1 ) == -1 ) {
+                populate_info_buffer ( bi->path );
+                return BUFSTAT_ERRNO;
+            }
+
+            bi->len++;
+        }
+
+        bi->long_line = within ? LONG_END : LONG_NONE;
+        bi->buffer [ bi->end = bi->len ] = '\0';
+        return BUFSTAT_LAST;
+    }
+
+    if ( bi->lines.count == 0 && bi->len == LBUF_FILL ) {
+        /* Not a single line feed: the window lies within one line. */
+        if ( within )
+            bi->long_line = LONG_MIDDLE;
+        else
+            begin_long_line ( bi );
+
+        bi->buffer [ bi->end = bi->len ] = '\0';
+        return BUFSTAT_FULL;
+    }
+
+    bi->long_line = within ? LONG_END : LONG_NONE;
+    bi->end = bi->start + bi->lines.newlines [ bi->lines.count - 1 ] + 1;
+    bi->held = bi->buffer [ bi->end ];
+    bi->buffer [ bi->end ] = '\0';
+    return BUFSTAT_FULL;
+}
+
+/* [exposed function] populate_buffer: assuming the buffer_info_t structure
+ * remains persistent and unmodified by the caller, this function loads the next
+ * part of the file provided by `bi->path` into the buffer of LBUF_SZ, after the
+ * unfinished line carried over from the previous call. The buffer then holds a
+ * null-terminated window of whole lines (see `determine_buffer_nature`), so a
+ * line, and any match within it, is never split between two buffers, and the
+ * memory used never grows. A line too long for the buffer is the exception:
+ * each window lies within it, and begins with the last `bi->overlap` bytes of
+ * the one before, so a match of a needle no longer than `bi->overlap + 1` is
+ * never split, and the start of the line is kept before the window, to be
+ * printed, truncated; see long_line_t. BUFSTAT_FULL is returned if there is
+ * more of the file to be read, in which case the next call should be made with
+ * the same path, and BUFSTAT_LAST is returned if the file has been exhausted.
+ * If the file cannot be opened or read, BUFSTAT_ERRNO is returned, and the
+ * caller must confer with errno. */
+
+enum buffer_status_t populate_buffer ( struct buffer_info_t * bi )
+{
+    ssize_t bw = 0;
+
+    if ( bi->src.fd == -1 && source_open ( & ( bi->src ), bi->dir,
+                bi->name ) == -1 ) {
+        /* the file cannot be opened */
+        populate_info_buffer ( bi->path );
+        return BUFSTAT_ERRNO;
+    }
+
+    if ( bi->src.offset == 0 ) {
+        /* a new file, which may have been opened already (see
+         * `map_file`) */
+        bi->idx = bi->start = bi->end = bi->len = bi->head = 0;
+        bi->long_line = LONG_NONE;
+    } else
+        carry_partial_line ( bi );
+
+    /* The carried bytes have no line feeds; index those of the new data
+     * once, for use by every needle, from the start of the window. */
+    line_index_reset ( & ( bi->lines ) );
+    if ( ( bw = source_read ( & ( bi->src ), & ( bi->buffer [ bi->idx ] ),
+                    LBUF_FILL - bi->idx ) ) != -1 )
+        bi->len = bi->idx + bw;
+
+    if ( bw == -1 || line_index_extend ( & ( bi->lines ), & ( bi->buffer
+                    [ bi->start ] ), bi->idx - bi->start, bi->len -
+                bi->start ) == -1 ) {
+        populate_info_buffer ( bi->path );
+        source_close ( & ( bi->src ) );
+        return BUFSTAT_ERRNO;
+    }
+
+    stats_count ( STAT_FILLS, 1 );
+    return determine_buffer_nature ( bw, bi );
+}
+
+/* [exposed function] init_buffer_instance: initialise a buffer_info_t structure
+ * with default values, allocating the large file buffer (LBUF_SZ) and its line
+ * index. This function returns -1 on error (errno is set appropriately by
+ * malloc), or zero on success. */
+
+int init_buffer_instance ( struct buffer_info_t * bi )
+{
+    if ( ( bi->buffer = malloc ( sizeof ( char ) * LBUF_SZ ) )
+            == NULL ) {
+        populate_info_buffer ( "Large file buffer" );
+        return -1;
+    }
+
+    if ( line_index_init ( & ( bi->lines ), LBUF_SZ / 32 ) == -1 ) {
+        populate_info_buffer ( "Line index" );
+        free ( bi->buffer );
+        return -1;
+    }
+
+    bi->src = ( struct source_t ) SOURCE_INIT;
+    bi->idx = bi->start = bi->end = bi->len = 0;
+    bi->head = bi->overlap = bi->line_offset = 0;
+    bi->long_line = LONG_NONE;
+    bi->held = '\0';
+    bi->long_hits = NULL;
+    bi->long_hits_len = 0;
+    bi->status = BUFSTAT_LAST;
+    bi->path = NULL;
+    bi->name = NULL;
+    bi->dir = AT_FDCWD;
+    bi->out = NULL;
+    bi->truncated = 0;
+    bi->results = 0;
+    bi->map = NULL;
+    bi->map_len = bi->map_size = 0;
+
+    return 0;
+}
+
+/* [exposed function] free_buffer_instance: release everything held by a
+ * buffer_info_t structure, including any open file or mapping. */
+
+void free_buffer_instance ( struct buffer_info_t * bi )
+{
+    source_close ( & ( bi->src ) );
+    unmap_file ( bi );
+    line_index_free ( & ( bi->lines ) );
+    free ( bi->long_hits );
+    free ( bi->buffer );
+    bi->buffer = NULL;
+    bi->long_hits = NULL;
+    bi->long_hits_len = 0;
+}
+
+/* place_file: place the whole of the file at `bi->path` (opened as `bi->name`
+ * relative to `bi->dir`, unless `bi->src` is open already) in memory, mapping
+ * it unless `copy` is set, in which case it is read; see `map_file` and
+ * `load_file`, which return as this function does. The source is closed,
+ * unless the file is to be streamed instead, for which it is left open. */
+
+static enum map_status_t place_file ( struct buffer_info_t * bi, int copy )
+{
+#ifdef NO_MMAP_READER
+    ( void ) bi;
+    ( void ) copy;
+    return MAPSTAT_FALLB;
+#else
+    const size_t page = sysconf ( _SC_PAGESIZE );
+    struct source_t * src = & ( bi->src );
+    char * region = NULL;
+    ssize_t size = 0;
+
+    if ( src->fd == -1 && source_open ( src, bi->dir, bi->name ) == -1 )
+        return MAPSTAT_FALLB;
+
+    if ( !S_ISREG ( src->st.st_mode ) )
+        return MAPSTAT_FALLB;
+
+    if ( src->st.st_size == 0 ) {
+        source_close ( src );
+        return MAPSTAT_EMPTY;
+    }
+
+    /* room for the contents, a line feed, and a null-terminator */
+    bi->map_len = ( ( size_t ) src->st.st_size + 2 + page - 1 ) / page *
+        page;
+
+    if ( ( region = mmap ( NULL, bi->map_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) == MAP_FAILED )
+        return MAPSTAT_FALLB;
+
+    if ( copy )
+        /* short if the file has shrunk since it was measured */
+        size = source_read ( src, region, src->st.st_size );
+    else
+        size = ( mmap ( region, src->st.st_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, src->fd, 0 )
+                == MAP_FAILED ) ? -1 : src->st.st_size;
+
+    if ( !copy && size > 0 )
+        /* a copy is counted as it is read */
+        stats_count ( STAT_BYTES, size );
+
+    if ( size == -1 ) {
+        munmap ( region, bi->map_len );
+        src->offset = 0; /* streamed from the start */
+        return MAPSTAT_FALLB;
+    }
+
+    source_close ( src );
+    if ( size == 0 ) {
+        munmap ( region, bi->map_len );
+        return MAPSTAT_EMPTY;
+    }
+
+    bi->map = region;
+    bi->map_size = size;
+
+    if ( region [ bi->map_size - 1 ] != '\n' )
+        /* complete the final line */
+        region [ bi->map_size++ ] = '\n';
+
+    region [ bi->map_size ] = '\0';
+    return MAPSTAT_OK;
+#endif /* NO_MMAP_READER */
+}
+
+/* [exposed function] map_file: map the whole of the file at `bi->path` into
+ * memory, so it can be searched in place as a single contiguous buffer, without
+ * copying it into the large file buffer. On success, MAPSTAT_OK is returned and
+ * `bi->map` holds the contents, followed by a line feed (if the file lacks one)
+ * and a null-terminator. The mapping is private, so these additions, and the
+ * temporary null-terminators placed by the searcher, never reach the file. The
+ * terminators lie beyond the end of the file, so a region of `bi->map_len`
+ * bytes is reserved anonymously first, and the file is mapped over its start;
+ * the remainder of the region reads as zeroes. If the file is empty,
+ * MAPSTAT_EMPTY is returned. If the file cannot be mapped for any reason,
+ * MAPSTAT_FALLB is returned, and the caller should use the streamed reader,
+ * which reports any genuine error with the file, and reads it from `bi->src`,
+ * if it was opened here. A file which has already been opened in `bi->src`,
+ * such as one prefetched, is mapped from it, rather than opened again.
+ *
+ * If NO_MMAP_READER is defined at compile-time, every file is streamed. */
+
+enum map_status_t map_file ( struct buffer_info_t * bi )
+{
+    return place_file ( bi, 0 );
+}
+
+/* [exposed function] load_file: identical to `map_file`, except the contents
+ * are read into the region, rather than mapped, so they are unaffected by any
+ * later change of the file, even one made in place, such as by a truncation. A
+ * file kept in memory for as long as a daemon runs is loaded with this function
+ * (see ARG_DAEMON). The copy is released with `unmap_file`, and `bi->src` with
+ * `source_close`, should the file not have been loaded. */
+
+enum map_status_t load_file ( struct buffer_info_t * bi )
+{
+    return place_file ( bi, 1 );
+}
+
+/* [exposed function] unmap_file: release the mapping made by `map_file` or
+ * `load_file`. */
+
+void unmap_file ( struct buffer_info_t * bi )
+{
+    if ( bi->map != NULL ) {
+        munmap ( bi->map, bi->map_len );
+        bi->map = NULL;
+        bi->map_len = bi->map_size = 0;
+    }
+}
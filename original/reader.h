@@ -0,0 +1,82 @@
+/* owd-euses: USE-description reader signatures
+ * Oliver Dixon. */
+
+#ifndef READER_H
+#define READER_H
+
+#include "lines.h"
+#include "sink.h"
+#include "source.h"
+
+enum buffer_status_t {
+    BUFSTAT_LAST  =  1, /* the buffer holds the remainder of the file */
+    BUFSTAT_FULL  =  0, /* the buffer holds whole lines; there is more */
+    BUFSTAT_ERRNO = -1  /* the file could not be opened or read; c.f. errno */
+};
+
+enum map_status_t {
+    MAPSTAT_EMPTY =  1, /* the file is empty; there is nothing to search */
+    MAPSTAT_OK    =  0, /* the file has been mapped in its entirety */
+    MAPSTAT_FALLB = -1  /* the file cannot be mapped; stream it instead */
+};
+
+/* long_line_t: the place of a streamed window in a line too long for the
+ * buffer, which is searched a window at a time; see `populate_buffer`. */
+
+enum long_line_t {
+    LONG_NONE   = 0, /* the window begins with a whole line */
+    LONG_BEGIN  = 1, /* the window is the start of a line continuing past it */
+    LONG_MIDDLE = 2, /* the window lies within that line, continuing past it */
+    LONG_END    = 3  /* the window begins with the rest of that line, up to
+                        its first line feed */
+};
+
+/* buffer_info_t should be kept persistent by the caller, for use by functions
+ * directly modifying the trans-directory and trans-file buffer. This is a
+ * spurious attempt to eliminate the need for static variables inside the
+ * buffered reader functions, thus ensuring thread-safety in all cases, should
+ * such a need arise. Multiple instances of a buffer-directory set can also be
+ * maintained simultaneously, regardless of the threading style. We don't need
+ * another strtok(_r) situation.
+ *
+ * When a file is streamed, `buffer [ start ]` to `buffer [ end - 1 ]` is the
+ * window of whole lines available to the searcher, and `buffer [ end ]` to
+ * `buffer [ len - 1 ]` is the unfinished line which is carried to the start of
+ * the buffer by the next fill. `start` is zero, unless the window lies within
+ * (or ends) a line too long for the buffer (see long_line_t), the first `head`
+ * bytes of which are kept before the window, to be printed once the line has
+ * been searched. */
+
+struct buffer_info_t {
+    struct source_t src; /* the file currently being read */
+    size_t idx; /* length of the carried partial line; DO NOT TOUCH */
+    size_t start, end, len; /* the window; end of the data; DO NOT TOUCH */
+    size_t head; /* length of the kept start of an over-long line */
+    size_t overlap; /* for the caller: the longest needle, less one */
+    size_t line_offset; /* offset of the window within an over-long line */
+    enum long_line_t long_line; /* the place of the window in such a line */
+    char held; /* the byte displaced by the window's null-terminator */
+    enum buffer_status_t status; /* for the caller: status of the reader */
+    char * buffer; /* buffer pointer, assumed to be of size LBUF_SZ */
+    char * path; /* path of `src` */
+    const char * name; /* `path`, relative to `dir`, by which it is opened */
+    int dir; /* a directory descriptor, or AT_FDCWD; see openat(2) */
+    struct sink_t * out; /* the sink to which the results are printed */
+    int truncated; /* truncation status */
+    size_t results; /* the results found with this instance, in all */
+    struct line_index_t lines; /* line feeds in the window, built as it fills */
+    struct record_t long_record; /* for the searcher: that of the long line */
+    unsigned char * long_hits; /* for the searcher: per needle, a long match */
+    int long_hits_len; /* the number of needles `long_hits` has room for */
+    char * map; /* the mapping of `path`, if it is being searched in place */
+    size_t map_len, map_size; /* reserved length; length of the contents */
+};
+
+int init_buffer_instance ( struct buffer_info_t * );
+void free_buffer_instance ( struct buffer_info_t * );
+enum buffer_status_t populate_buffer ( struct buffer_info_t * );
+enum map_status_t map_file ( struct buffer_info_t * );
+enum map_status_t load_file ( struct buffer_info_t * );
+void unmap_file ( struct buffer_info_t * );
+
+#endif /* READER_H */
@@ -0,0 +1,215 @@
+/* owd-euses: batched output sink; see sink.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "stats.h"
+
+#define SINK_SZ_MIN ( 4096 ) /* Initial size of a sink growing in memory. */
+
+/* [exposed function] sink_init: prepare an empty sink writing to `fd`, or
+ * growing in memory if `fd` is -1; see sink_t. Memory for the latter is only
+ * allocated once something is written, as most items have no results. Returns
+ * zero on success, or -1 on failure, in which case errno is set by malloc. */
+
+int sink_init ( struct sink_t * sink, int fd )
+{
+    sink->len = sink->capacity = 0;
+    sink->fd = fd;
+    sink->error = 0;
+    sink->buffer = NULL;
+
+    if ( fd == -1 )
+        return 0;
+
+    if ( ( sink->buffer = malloc ( SINK_SZ ) ) == NULL )
+        return -1;
+
+    sink->capacity = SINK_SZ;
+    return 0;
+}
+
+/* [exposed function] sink_free: release the buffer of a sink, without flushing
+ * it. */
+
+void sink_free ( struct sink_t * sink )
+{
+    free ( sink->buffer );
+    sink->buffer = NULL;
+    sink->len = sink->capacity = 0;
+}
+
+/* fail: record the failure of `sink`, the reason for which is in errno, so
+ * that everything further is discarded. Returns -1. */
+
+static int fail ( struct sink_t * sink )
+{
+    sink->error = errno;
+    return -1;
+}
+
+/* write_all: write the `len` bytes of `data` to `fd`, resuming after partial
+ * writes and interruptions. Returns zero on success, or -1 on failure, in
+ * which case errno is set by write. The time taken is that of PHASE_PRINT. */
+
+static int write_all ( int fd, const char * data, size_t len )
+{
+    const enum stats_phase_t phase = stats_phase ( PHASE_PRINT );
+    ssize_t written = 0;
+
+    while ( len > 0 ) {
+        if ( ( written = write ( fd, data, len ) ) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            break;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    stats_phase ( phase );
+    return ( len > 0 ) ? -1 : 0;
+}
+
+/* grow: enlarge the buffer of a sink growing in memory to hold at least
+ * `extra` more bytes. Returns zero on success, or -1 on failure. */
+
+static int grow ( struct sink_t * sink, size_t extra )
+{
+    size_t capacity = ( sink->capacity == 0 ) ? SINK_SZ_MIN :
+        sink->capacity;
+    char * buffer = NULL;
+
+    while ( sink->len + extra > capacity )
+        capacity *= 2;
+
+    if ( ( buffer = realloc ( sink->buffer, capacity ) ) == NULL )
+        return fail ( sink );
+
+    sink->buffer = buffer;
+    sink->capacity = capacity;
+    return 0;
+}
+
+/* [exposed function] sink_flush: write the contents of a sink to its file
+ * descriptor, if it has one. Returns zero on success, or -1 if this or any
+ * earlier write failed, in which case `sink->error` holds the errno. */
+
+int sink_flush ( struct sink_t * sink )
+{
+    if ( sink->error != 0 )
+        return -1;
+
+    if ( sink->fd == -1 || sink->len == 0 )
+        return 0;
+
+    if ( write_all ( sink->fd, sink->buffer, sink->len ) == -1 )
+        return fail ( sink );
+
+    sink->len = 0;
+    return 0;
+}
+
+/* [exposed function] sink_write: append the `len` bytes of `data` to a sink,
+ * flushing (or growing) it if it is full. Data larger than the buffer of a
+ * sink with a file descriptor is written directly, without being copied.
+ * Returns zero on success, or -1 if this or any earlier write failed (see
+ * `sink_flush`). */
+
+int sink_write ( struct sink_t * sink, const char * data, size_t len )
+{
+    if ( sink->error != 0 )
+        return -1;
+
+    if ( sink->len + len > sink->capacity ) {
+        if ( sink->fd == -1 ) {
+            if ( grow ( sink, len ) == -1 )
+                return -1;
+        } else {
+            if ( sink_flush ( sink ) == -1 )
+                return -1;
+
+            if ( len >= sink->capacity )
+                return ( write_all ( sink->fd, data, len ) == -1 ) ?
+                    fail ( sink ) : 0;
+        }
+    }
+
+    memcpy ( & ( sink->buffer [ sink->len ] ), data, len );
+    sink->len += len;
+    return 0;
+}
+
+/* [exposed function] sink_puts: append the null-terminated `str` to a sink,
+ * without a line feed. Returns as `sink_write`. */
+
+int sink_puts ( struct sink_t * sink, const char * str )
+{
+    return sink_write ( sink, str, strlen ( str ) );
+}
+
+/* [exposed function] sink_putc: append the single character `c` to a sink.
+ * Returns as `sink_write`. */
+
+int sink_putc ( struct sink_t * sink, char c )
+{
+    if ( sink->len < sink->capacity && sink->error == 0 ) {
+        sink->buffer [ sink->len++ ] = c;
+        return 0;
+    }
+
+    return sink_write ( sink, &c, 1 );
+}
+
+/* [exposed function] sink_release: take the contents of a sink growing in
+ * memory, placing their length in `len`; the caller must free the returned
+ * buffer, which is NULL if nothing was written. The sink is left empty. */
+
+char * sink_release ( struct sink_t * sink, size_t * len )
+{
+    char * buffer = sink->buffer;
+
+    *len = sink->len;
+    sink->buffer = NULL;
+    sink->len = sink->capacity = 0;
+    return buffer;
+}
+
+/* [exposed function] sink_writev: write the `count` buffers of `iov` to `fd`
+ * with as few writev(2) calls as possible, resuming after partial writes and
+ * interruptions; `iov` is modified as it is consumed. Returns zero on success,
+ * or -1 on failure, in which case errno is set by writev. The time taken is
+ * that of PHASE_PRINT. */
+
+int sink_writev ( int fd, struct iovec * iov, int count )
+{
+    const enum stats_phase_t phase = stats_phase ( PHASE_PRINT );
+    ssize_t written = 0;
+
+    while ( count > 0 ) {
+        if ( ( written = writev ( fd, iov, count ) ) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            break;
+        }
+
+        for ( ; count > 0 && ( size_t ) written >= iov->iov_len; iov++,
+                count-- )
+            written -= iov->iov_len;
+
+        if ( count > 0 ) {
+            iov->iov_base = ( char * ) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    stats_phase ( phase );
+    return ( count > 0 ) ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+/* owd-euses: batched output-sink signatures
+ * Oliver Dixon. */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifndef SINK_SZ
+/* The size of the buffer of a sink writing to a file descriptor; the results
+ * are written in batches of this size. */
+#define SINK_SZ ( 65536 )
+#endif /* SINK_SZ */
+
+/* sink_t: an output buffer, into which every fragment of a result (prefixes,
+ * colour escapes, and fields) is copied, so the result costs no more than a
+ * few memcpy(3) calls, rather than a locked stdio call per fragment. A sink
+ * with a file descriptor `fd` writes its contents with write(2) whenever it
+ * fills, and when flushed; a sink without one (`fd` of -1) grows instead, and
+ * its contents are taken by its owner with `sink_release`. Once a write has
+ * failed, `error` holds its errno, and everything further is discarded. A sink
+ * belongs to a single thread. */
+
+struct sink_t {
+    char * buffer;
+    size_t len, capacity;
+    int fd; /* the descriptor to be written, or -1 to grow in memory */
+    int error; /* errno of the first failure, or zero */
+};
+
+int sink_init ( struct sink_t *, int );
+void sink_free ( struct sink_t * );
+int sink_write ( struct sink_t *, const char *, size_t );
+int sink_puts ( struct sink_t *, const char * );
+int sink_putc ( struct sink_t *, char );
+int sink_flush ( struct sink_t * );
+char * sink_release ( struct sink_t *, size_t * );
+int sink_writev ( int, struct iovec *, int );
+
+/* sink_literal: append the string literal `lit`, such as a colour escape, the
+ * length of which is known at compile-time. */
+#define sink_literal( sink, lit ) \
+    sink_write ( ( sink ), ( lit ), sizeof ( lit ) - 1 )
+
+#endif /* SINK_H */
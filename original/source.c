@@ -0,0 +1,86 @@
+/* owd-euses: descriptor-based input sources; see source.h.
+ * Oliver Dixon. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "source.h"
+#include "stats.h"
+
+/* [exposed function] source_open: open the file `name`, relative to the
+ * directory open at `dir` (or AT_FDCWD; see openat(2)), as `src`. Returns zero
+ * on success, or -1 on failure, in which case errno is set, and `src` is
+ * closed. */
+
+int source_open ( struct source_t * src, int dir, const char * name )
+{
+    int error = 0;
+
+    src->offset = 0;
+    if ( ( src->fd = openat ( dir, name, O_RDONLY | O_CLOEXEC ) ) == -1 )
+        return -1;
+
+    if ( fstat ( src->fd, & ( src->st ) ) == -1 ) {
+        error = errno;
+        source_close ( src );
+        errno = error;
+        return -1;
+    }
+
+    stats_count ( STAT_OPENS, 1 );
+
+    /* merely advice; the read is no worse for its failure */
+    posix_fadvise ( src->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    return 0;
+}
+
+/* [exposed function] source_read: read up to `len` bytes of `src` into
+ * `buffer`, resuming after partial reads and interruptions, until `len` bytes
+ * have been read or the file has ended. Returns the number of bytes read, which
+ * is less than `len` only at the end of the file, or -1 on failure, in which
+ * case errno is set. */
+
+ssize_t source_read ( struct source_t * src, char * buffer, size_t len )
+{
+    size_t done = 0;
+    ssize_t got = 0;
+
+    while ( done < len ) {
+        if ( ( got = pread ( src->fd, & ( buffer [ done ] ), len - done,
+                        src->offset ) ) == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return -1;
+        }
+
+        if ( got == 0 )
+            break;
+
+        done += got;
+        src->offset += got;
+    }
+
+    stats_count ( STAT_BYTES, done );
+    return done;
+}
+
+/* [exposed function] source_prefetch: advise the kernel that the whole of
+ * `src` will be needed soon, so it is read in the background, while the caller
+ * does something else, rather than by the first `source_read`. */
+
+void source_prefetch ( const struct source_t * src )
+{
+    posix_fadvise ( src->fd, 0, 0, POSIX_FADV_WILLNEED );
+}
+
+/* [exposed function] source_close: close `src`, if it is open. */
+
+void source_close ( struct source_t * src )
+{
+    if ( src->fd != -1 ) {
+        close ( src->fd );
+        src->fd = -1;
+    }
+}
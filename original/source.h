@@ -0,0 +1,31 @@
+/* owd-euses: descriptor-based input-source signatures
+ * Oliver Dixon. */
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* source_t: a file open for reading by its descriptor alone, the counterpart
+ * of `sink_t`. It is opened with openat(2), measured once with fstat(2) into
+ * `st`, and read with pread(2) from `offset` onwards, so it costs one open, one
+ * fstat, its reads, and one close: nothing is seeked, nor copied through a
+ * stdio buffer. The kernel is advised that the file is read sequentially. A
+ * closed source has an `fd` of -1. */
+
+struct source_t {
+    int fd;
+    struct stat st; /* as measured when it was opened */
+    off_t offset; /* of the next read */
+};
+
+#define SOURCE_INIT { .fd = -1, .offset = 0 }
+
+int source_open ( struct source_t *, int, const char * );
+ssize_t source_read ( struct source_t *, char *, size_t );
+void source_prefetch ( const struct source_t * );
+void source_close ( struct source_t * );
+
+#endif /* SOURCE_H */
@@ -1,61 +1,118 @@
-/* owd-euses: stack implementation; see stack.h
+/* owd-euses: repository registry; see stack.h
  * Oliver Dixon. */
 
 #include <stdlib.h>
-#include <stdio.h>
+#include <string.h>
 
 #include "euses.h"
 #include "stack.h"
 
-/* stack_peek: peeks at the leading node of the stack. */
+#define STACK_BLOCK_SZ ( 4096 ) /* The usual size of a block of the arena. */
 
-struct repo_t * stack_peek ( struct repo_stack_t * stack )
-{
-    return stack->lead;
-}
+/* repo_block_t: a block of the arena of a registry, from which its repositories
+ * and their strings are allocated, and `used` bytes of which are taken; see
+ * repo_stack_t. A repository larger than STACK_BLOCK_SZ has a block of its own.
+ * The blocks are linked, the newest first. */
 
-/* stack_pop: removes the leading node from the stack and returns it. NULL is
- * returned in the event of an underflow. */
+struct repo_block_t {
+    struct repo_block_t * next;
+    size_t used, size;
+    _Alignas ( struct repo_t ) char data [ ];
+};
 
-struct repo_t * stack_pop ( struct repo_stack_t * stack )
-{
-    struct repo_t * node = NULL;
+/* stack_alloc: allocate `len` bytes, aligned for a repo_t, from the arena of
+ * the `stack`. Returns NULL on failure, in which case errno is set by
+ * malloc. */
 
-    if ( stack->size == 0 )
-        return NULL; /* underflow */
+static void * stack_alloc ( struct repo_stack_t * stack, size_t len )
+{
+    const size_t align = _Alignof ( struct repo_t );
+    struct repo_block_t * block = stack->blocks;
+    size_t size = 0;
+
+    len = ( len + align - 1 ) / align * align;
+    if ( block == NULL || block->size - block->used < len ) {
+        size = ( len > STACK_BLOCK_SZ ) ? len : STACK_BLOCK_SZ;
+        if ( ( block = malloc ( sizeof ( *block ) + size ) ) == NULL )
+            return NULL;
+
+        block->next = stack->blocks;
+        block->used = 0;
+        block->size = size;
+        stack->blocks = block;
+    }
+
+    block->used += len;
+    return & ( block->data [ block->used - len ] );
+}
 
-    node = stack->lead;
-    stack->lead = node->next;
-    stack->size--;
+/* [exposed function] stack_repo: return the repository at `idx` of the stack,
+ * zero being the last pushed, or NULL if there is no such repository. */
 
-    return node;
+struct repo_t * stack_repo ( const struct repo_stack_t * stack,
+        unsigned long idx )
+{
+    return ( idx < stack->size ) ? stack->repos [ stack->size - 1 - idx ] :
+        NULL;
 }
 
-/* stack_push: pushes the node to the stack. */
+/* [exposed function] stack_push: register a repository, copying its `name` and
+ * `location` into the arena, and push it onto the stack. Returns zero on
+ * success, or -1 on failure, in which case errno is set by malloc, and the
+ * stack is unchanged. */
 
-void stack_push ( struct repo_stack_t * stack, struct repo_t * node )
+int stack_push ( struct repo_stack_t * stack, const char * name,
+        const char * location )
 {
-    node->next = stack->lead;
-    stack->lead = node;
-    stack->size++;
+    const size_t name_len = strlen ( name ) + 1,
+          location_len = strlen ( location ) + 1;
+    unsigned long capacity = ( stack->capacity == 0 ) ? 8 :
+        stack->capacity * 2;
+    struct repo_t ** repos = NULL, * repo = NULL;
+    char * strings = NULL;
+
+    if ( stack->size == stack->capacity ) {
+        if ( ( repos = realloc ( stack->repos, capacity *
+                        sizeof ( *repos ) ) ) == NULL )
+            return -1;
+
+        stack->repos = repos;
+        stack->capacity = capacity;
+    }
+
+    if ( ( repo = stack_alloc ( stack, sizeof ( *repo ) + name_len +
+                    location_len ) ) == NULL )
+        return -1;
+
+    strings = ( char * ) ( repo + 1 );
+    repo->name = memcpy ( strings, name, name_len );
+    repo->location = memcpy ( & ( strings [ name_len ] ), location,
+            location_len );
+    stack->repos [ stack->size++ ] = repo;
+    return 0;
 }
 
-/* stack_init: initialises a stack. */
+/* [exposed function] stack_init: initialises an empty stack. */
 
 void stack_init ( struct repo_stack_t * stack )
 {
-    stack->lead = NULL;
-    stack->size = 0;
+    stack->repos = NULL;
+    stack->size = stack->capacity = 0;
+    stack->blocks = NULL;
 }
 
-/* stack_cleanse: recursively free all nodes on a stack, making the safe
- * presumption that they reside on the heap. */
+/* [exposed function] stack_cleanse: release every repository of the stack, and
+ * their strings, at once, leaving the stack empty. */
 
 void stack_cleanse ( struct repo_stack_t * stack )
 {
-    unsigned int size = stack->size;
+    struct repo_block_t * block = stack->blocks, * next = NULL;
 
-    for ( unsigned int i = 0; i < size; i++ )
-        free ( stack_pop ( stack ) );
-}
+    for ( ; block != NULL; block = next ) {
+        next = block->next;
+        free ( block );
+    }
 
+    free ( stack->repos );
+    stack_init ( stack );
+}
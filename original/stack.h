@@ -1,20 +1,30 @@
-/* owd-euses: stack function and data signatures */
+/* owd-euses: repository-registry function and data signatures */
 
 #ifndef STACK_H
 #define STACK_H
 
 #include "euses.h"
 
+struct repo_block_t;
+
+/* repo_stack_t: the registry of the repositories, as a stack: the repository
+ * pushed last is the first, at index zero, so the repositories are searched in
+ * the reverse of the order in which they were found, as they always have been.
+ * Each repository, with its name and location, is allocated from the arena
+ * `blocks`, taking no more than the lengths of its strings, and stays where it
+ * is until the registry is cleansed, when the arena is released at once;
+ * `repos` is the array of the repositories, by which any can be reached by its
+ * index, such as by a worker. */
+
 struct repo_stack_t {
-    struct repo_t * lead;
-    unsigned long size;
+    struct repo_t ** repos;
+    unsigned long size, capacity;
+    struct repo_block_t * blocks;
 };
 
-struct repo_t * stack_peek ( struct repo_stack_t * );
-struct repo_t * stack_pop ( struct repo_stack_t * );
-void stack_push ( struct repo_stack_t *, struct repo_t * );
+struct repo_t * stack_repo ( const struct repo_stack_t *, unsigned long );
+int stack_push ( struct repo_stack_t *, const char *, const char * );
 void stack_init ( struct repo_stack_t * );
 void stack_cleanse ( struct repo_stack_t * );
 
 #endif /* STACK_H */
-
@@ -0,0 +1,278 @@
+/* owd-euses: performance statistics, gathered per repository and phase, and
+ * printed once the search is over; see ARG_STATS.
+ * Oliver Dixon. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "converse.h"
+#include "stats.h"
+
+/* stats_bucket_t: the time spent in each phase, and the counters, of the
+ * repository `repo`, or of none, if `repo` is NULL; added to by any thread. */
+
+struct stats_bucket_t {
+    const struct repo_t * repo;
+    atomic_ullong wall [ PHASE_COUNT ], cpu [ PHASE_COUNT ];
+    atomic_ulong counters [ STAT_COUNT ];
+};
+
+/* stats_thread_t: the state of a thread: the bucket to which it attributes its
+ * time and counters (that of no repository, if NULL), the phase it is in, and
+ * its clocks as it entered the phase, in nanoseconds. */
+
+struct stats_thread_t {
+    struct stats_bucket_t * bucket;
+    enum stats_phase_t phase;
+    unsigned long long wall, cpu;
+};
+
+int stats_enabled = 0;
+
+static struct stats_bucket_t other; /* attributed to no repository */
+static struct stats_bucket_t * buckets = NULL; /* one per repository */
+static unsigned long bucket_count = 0;
+static unsigned long long started = 0; /* the wall clock at `stats_start` */
+
+static _Thread_local struct stats_thread_t current = {
+    .bucket = NULL, .phase = PHASE_NONE
+};
+
+/* The names of the phases and the counters, in the orders of stats_phase_t
+ * and stats_counter_t, as they appear in JSON; an underscore is printed as a
+ * space in text. */
+static const char * const phases [ ] = {
+    "repos", "glob", "read", "search", "print"
+}, * const counters [ ] = {
+    "files_opened", "bytes_read", "buffer_fills", "read_ahead", "matches",
+    "lines_emitted"
+};
+
+/* clock_ns: the time of the `clock`, in nanoseconds. */
+
+static unsigned long long clock_ns ( clockid_t clock )
+{
+    struct timespec ts = { 0, 0 };
+
+    clock_gettime ( clock, &ts );
+    return ( unsigned long long ) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* credit: add the time since the calling thread entered its phase, the clocks
+ * now reading `wall` and `cpu`, to its bucket, and restart its clocks. */
+
+static void credit ( unsigned long long wall, unsigned long long cpu )
+{
+    struct stats_bucket_t * bucket = ( current.bucket != NULL ) ?
+        current.bucket : &other;
+
+    if ( current.phase != PHASE_NONE ) {
+        atomic_fetch_add_explicit ( & ( bucket->wall [ current.phase ] ),
+                wall - current.wall, memory_order_relaxed );
+        atomic_fetch_add_explicit ( & ( bucket->cpu [ current.phase ] ),
+                cpu - current.cpu, memory_order_relaxed );
+    }
+
+    current.wall = wall;
+    current.cpu = cpu;
+}
+
+/* [exposed function] stats_start: begin gathering the statistics, from which
+ * point the elapsed time is measured. Only the thread calling it may be
+ * running. */
+
+void stats_start ( void )
+{
+    started = clock_ns ( CLOCK_MONOTONIC );
+    stats_enabled = 1;
+}
+
+/* [exposed function] stats_register: give each repository on the `stack` its
+ * own statistics, which are otherwise attributed to no repository; the
+ * repositories must outlive them (see `stats_free`). Only the thread calling it
+ * may be gathering them. Returns zero on success, or -1 on failure, in which
+ * case errno and the information buffer are set. */
+
+int stats_register ( const struct repo_stack_t * stack )
+{
+    if ( !stats_enabled || stack->size == 0 )
+        return 0;
+
+    if ( ( buckets = calloc ( stack->size, sizeof ( *buckets ) ) ) == NULL ) {
+        populate_info_buffer ( "Statistics" );
+        return -1;
+    }
+
+    bucket_count = stack->size;
+    for ( unsigned long i = 0; i < bucket_count; i++ )
+        buckets [ i ].repo = stack_repo ( stack, i );
+
+    return 0;
+}
+
+/* [exposed function] stats_enter: see `stats_phase`. The time of the phase
+ * being left is added to the bucket of the thread. */
+
+enum stats_phase_t stats_enter ( enum stats_phase_t phase )
+{
+    const enum stats_phase_t left = current.phase;
+
+    credit ( clock_ns ( CLOCK_MONOTONIC ),
+            clock_ns ( CLOCK_THREAD_CPUTIME_ID ) );
+    current.phase = phase;
+    return left;
+}
+
+/* [exposed function] stats_add: see `stats_count`. */
+
+void stats_add ( enum stats_counter_t counter, unsigned long n )
+{
+    struct stats_bucket_t * bucket = ( current.bucket != NULL ) ?
+        current.bucket : &other;
+
+    atomic_fetch_add_explicit ( & ( bucket->counters [ counter ] ), n,
+            memory_order_relaxed );
+}
+
+/* [exposed function] stats_attribute: see `stats_repo`. The time of the current
+ * phase so far is added to the bucket the thread is leaving. There are few
+ * repositories, so the bucket of `repo` is simply sought. */
+
+void stats_attribute ( const struct repo_t * repo )
+{
+    struct stats_bucket_t * bucket = NULL;
+
+    for ( unsigned long i = 0; repo != NULL && i < bucket_count; i++ )
+        if ( buckets [ i ].repo == repo )
+            bucket = & ( buckets [ i ] );
+
+    if ( bucket == current.bucket )
+        return;
+
+    if ( current.phase != PHASE_NONE )
+        credit ( clock_ns ( CLOCK_MONOTONIC ),
+                clock_ns ( CLOCK_THREAD_CPUTIME_ID ) );
+
+    current.bucket = bucket;
+}
+
+/* add_bucket: add the times and counters of `bucket` to those of `sum`, which
+ * is only read by the calling thread. */
+
+static void add_bucket ( struct stats_bucket_t * sum,
+        const struct stats_bucket_t * bucket )
+{
+    for ( int p = 0; p < PHASE_COUNT; p++ ) {
+        sum->wall [ p ] += bucket->wall [ p ];
+        sum->cpu [ p ] += bucket->cpu [ p ];
+    }
+
+    for ( int c = 0; c < STAT_COUNT; c++ )
+        sum->counters [ c ] += bucket->counters [ c ];
+}
+
+/* print_bucket: print the times and counters of the `bucket`, as `label`, to
+ * stderr: as the members of a JSON object if `json` is set, or otherwise as a
+ * table. */
+
+static void print_bucket ( const struct stats_bucket_t * bucket,
+        const char * label, int json )
+{
+    if ( !json ) {
+        fprintf ( stderr, "%s:\n    %-14s %12s %12s\n", label, "phase",
+                "wall ms", "CPU ms" );
+        for ( int p = 0; p < PHASE_COUNT; p++ )
+            fprintf ( stderr, "    %-14s %12.3f %12.3f\n", phases [ p ],
+                    bucket->wall [ p ] / 1e6, bucket->cpu [ p ] / 1e6 );
+
+        for ( int c = 0; c < STAT_COUNT; c++ ) {
+            char name [ 16 ];
+
+            for ( int i = 0; ( name [ i ] = counters [ c ] [ i ] ) != '\0';
+                    i++ )
+                if ( name [ i ] == '_' )
+                    name [ i ] = ' ';
+
+            fprintf ( stderr, "    %-14s %12lu\n", name,
+                    ( unsigned long ) bucket->counters [ c ] );
+        }
+
+        return;
+    }
+
+    fputs ( "\"phases\":{", stderr );
+    for ( int p = 0; p < PHASE_COUNT; p++ )
+        fprintf ( stderr, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                ( p > 0 ) ? "," : "", phases [ p ], bucket->wall [ p ] / 1e6,
+                bucket->cpu [ p ] / 1e6 );
+
+    fputs ( "},\"counters\":{", stderr );
+    for ( int c = 0; c < STAT_COUNT; c++ )
+        fprintf ( stderr, "%s\"%s\":%lu", ( c > 0 ) ? "," : "",
+                counters [ c ], ( unsigned long ) bucket->counters [ c ] );
+
+    fputc ( '}', stderr );
+}
+
+/* [exposed function] stats_print: print the statistics to stderr: those of each
+ * repository, of no repository (such as locating the repositories, and writing
+ * the results), and their total, followed by the time elapsed since
+ * `stats_start`, and the CPU time of the process. The times of phases run by
+ * several threads at once are summed, so may exceed the time elapsed. They are
+ * printed as a single JSON object on its own line if `json` is set, and as a
+ * table otherwise. */
+
+void stats_print ( int json )
+{
+    struct stats_bucket_t total = { .repo = NULL };
+    const double wall = ( clock_ns ( CLOCK_MONOTONIC ) - started ) / 1e6,
+          cpu = clock_ns ( CLOCK_PROCESS_CPUTIME_ID ) / 1e6;
+
+    add_bucket ( &total, &other );
+    for ( unsigned long i = 0; i < bucket_count; i++ )
+        add_bucket ( &total, & ( buckets [ i ] ) );
+
+    fputs ( json ? "{\"repos\":[" : "Statistics:\n", stderr );
+    for ( unsigned long i = 0; i < bucket_count; i++ ) {
+        if ( json ) {
+            fputs ( ( i > 0 ) ? ",{\"name\":" : "{\"name\":", stderr );
+            print_json_string ( stderr, buckets [ i ].repo->name );
+            fputs ( ",\"location\":", stderr );
+            print_json_string ( stderr, buckets [ i ].repo->location );
+            fputc ( ',', stderr );
+        }
+
+        print_bucket ( & ( buckets [ i ] ), buckets [ i ].repo->name, json );
+        if ( json )
+            fputc ( '}', stderr );
+    }
+
+    if ( json ) {
+        fputs ( "],\"other\":{", stderr );
+        print_bucket ( &other, NULL, json );
+        fputs ( "},\"total\":{", stderr );
+        print_bucket ( &total, NULL, json );
+        fprintf ( stderr, "},\"elapsed\":{\"wall_ms\":%.3f,\"cpu_ms\":"
+                "%.3f}}\n", wall, cpu );
+    } else {
+        print_bucket ( &other, "(no repository)", json );
+        print_bucket ( &total, "(total)", json );
+        fprintf ( stderr, "elapsed: %.3f ms wall, %.3f ms CPU\n", wall,
+                cpu );
+    }
+
+    fflush ( stderr );
+}
+
+/* [exposed function] stats_free: stop gathering the statistics, and release
+ * those of the repositories. Only the thread calling it may be running. */
+
+void stats_free ( void )
+{
+    stats_enabled = 0;
+    free ( buckets );
+    buckets = NULL;
+    bucket_count = 0;
+}
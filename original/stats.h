@@ -0,0 +1,61 @@
+/* owd-euses: performance-statistics signatures (see ARG_STATS)
+ * Oliver Dixon. */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "stack.h"
+
+/* stats_phase_t: the phases of a search, the wall and CPU time of each being
+ * measured by the thread running it. PHASE_NONE is the time between phases,
+ * such as that of an idle worker, which is not measured. */
+
+enum stats_phase_t {
+    PHASE_REPOS  = 0, /* locating the repositories; see `get_repos` */
+    PHASE_GLOB   = 1, /* collating the files; see `populate_glob` */
+    PHASE_READ   = 2, /* opening, mapping, loading, and reading the files */
+    PHASE_SEARCH = 3, /* scanning the text, and matching the lines */
+    PHASE_PRINT  = 4, /* formatting and writing the results */
+    PHASE_COUNT  = 5,
+    PHASE_NONE   = PHASE_COUNT
+};
+
+/* stats_counter_t: the events counted per repository. */
+
+enum stats_counter_t {
+    STAT_OPENS     = 0, /* files opened */
+    STAT_BYTES     = 1, /* bytes read or mapped */
+    STAT_FILLS     = 2, /* fills of a streamed buffer; see `populate_buffer` */
+    STAT_READAHEAD = 3, /* files opened ahead of their search; see prefetch_t */
+    STAT_MATCHES   = 4, /* occurrences of the needles found by the scan */
+    STAT_LINES     = 5, /* results printed */
+    STAT_COUNT     = 6
+};
+
+/* Set once the statistics are being gathered (see `stats_start`); until then,
+ * each of the following macros costs no more than a test of it. */
+extern int stats_enabled;
+
+/* stats_phase: enter the `phase` on the calling thread, returning the phase it
+ * leaves, to be entered again once `phase` is over. */
+#define stats_phase( phase ) \
+    ( stats_enabled ? stats_enter ( phase ) : PHASE_NONE )
+
+/* stats_count: add `n` to the `counter` of the repository of the thread. */
+#define stats_count( counter, n ) \
+    do { if ( stats_enabled ) stats_add ( ( counter ), ( n ) ); } while ( 0 )
+
+/* stats_repo: attribute all that the thread does next to the repository `repo`,
+ * or to none, if `repo` is NULL. */
+#define stats_repo( repo ) \
+    do { if ( stats_enabled ) stats_attribute ( repo ); } while ( 0 )
+
+void stats_start ( void );
+int stats_register ( const struct repo_stack_t * );
+enum stats_phase_t stats_enter ( enum stats_phase_t );
+void stats_add ( enum stats_counter_t, unsigned long );
+void stats_attribute ( const struct repo_t * );
+void stats_print ( int );
+void stats_free ( void );
+
+#endif /* STATS_H */
@@ -0,0 +1,122 @@
+/* owd-euses: search-pipeline tracing, writing the spans of the search as Chrome
+ * trace events (see ARG_TRACE), to be viewed in chrome://tracing or Perfetto.
+ * Oliver Dixon. */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "euses.h"
+#include "converse.h"
+#include "trace.h"
+
+int trace_enabled = 0;
+
+static FILE * trace_file = NULL;
+static unsigned long long origin = 0; /* the clock at `trace_open` */
+static long pid = 0;
+
+/* The id of the calling thread, once it has been named in the trace (see
+ * `name_thread`), or zero. */
+static _Thread_local long tid = 0;
+
+/* [exposed function] trace_clock: the monotonic clock, in nanoseconds. */
+
+unsigned long long trace_clock ( void )
+{
+    struct timespec ts = { 0, 0 };
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ( unsigned long long ) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* name_thread: find the id of the calling thread, and name it in the trace as
+ * the main thread or a worker. The trace file must be locked. */
+
+static void name_thread ( void )
+{
+    tid = syscall ( SYS_gettid );
+    fprintf ( trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\","
+            "\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}},\n", pid,
+            tid, ( tid == pid ) ? "main" : "worker" );
+}
+
+/* [exposed function] trace_open: begin writing the trace to the file at `path`,
+ * replacing it. Returns zero on success, or -1 on failure, in which case errno
+ * and the information buffer are set. */
+
+int trace_open ( const char * path )
+{
+    if ( ( trace_file = fopen ( path, "w" ) ) == NULL ) {
+        populate_info_buffer ( path );
+        return -1;
+    }
+
+    pid = getpid ( );
+    origin = trace_clock ( );
+    fprintf ( trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\","
+            "\"pid\":%ld,\"args\":{\"name\":\"" PROGRAM_NAME "\"}},\n",
+            pid );
+    trace_enabled = 1;
+    return 0;
+}
+
+/* [exposed function] trace_write: see `trace_span`. The span is a "complete"
+ * event, holding the `detail` (such as a path), if not NULL, and the `count`,
+ * as `unit`, if `unit` is not NULL, among its arguments. Every event is
+ * written whole, by any thread, and followed by a comma, so the file is valid
+ * even if the trace is never closed (see `trace_close`), as the closing bracket
+ * of the list is optional; its times are in microseconds since `trace_open`.
+ * The spans of a thread are nested, as long as its spans are. */
+
+void trace_write ( const char * cat, const char * name,
+        unsigned long long start, const char * detail, const char * unit,
+        long count )
+{
+    const unsigned long long end = trace_clock ( );
+
+    flockfile ( trace_file );
+    if ( tid == 0 )
+        name_thread ( );
+
+    fprintf ( trace_file, "{\"cat\":\"%s\",\"name\":", cat );
+    print_json_string ( trace_file, name );
+    fprintf ( trace_file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%ld,\"tid\":%ld,\"args\":{", ( start - origin ) / 1e3,
+            ( end - start ) / 1e3, pid, tid );
+
+    if ( detail != NULL ) {
+        fputs ( "\"detail\":", trace_file );
+        print_json_string ( trace_file, detail );
+    }
+
+    if ( unit != NULL )
+        fprintf ( trace_file, "%s\"%s\":%ld", ( detail != NULL ) ? "," : "",
+                unit, count );
+
+    fputs ( "}},\n", trace_file );
+    funlockfile ( trace_file );
+}
+
+/* [exposed function] trace_close: finish the trace, and close its file; no
+ * other thread may be writing to it. Returns zero on success, or -1 if the
+ * trace could not be written in full, in which case errno is set. */
+
+int trace_close ( void )
+{
+    int status = 0;
+
+    trace_enabled = 0;
+    fprintf ( trace_file, "{\"name\":\"process_sort_index\",\"ph\":\"M\","
+            "\"pid\":%ld,\"args\":{\"sort_index\":0}}\n]\n", pid );
+
+    if ( ferror ( trace_file ) )
+        status = -1;
+
+    if ( fclose ( trace_file ) == EOF )
+        status = -1;
+
+    trace_file = NULL;
+    return status;
+}
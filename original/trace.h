@@ -0,0 +1,81 @@
+/* owd-euses: search-pipeline tracing signatures (see ARG_TRACE)
+ * Oliver Dixon. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Set once the spans are being written (see `trace_open`); until then, each of
+ * the following macros costs no more than a test of it. */
+extern int trace_enabled;
+
+/* trace_now: the time at which a span begins, to be given to `trace_span`. */
+#define trace_now( ) ( trace_enabled ? trace_clock ( ) : 0 )
+
+/* trace_span: write a span of the category `cat`, named `name`, from `start`
+ * (see `trace_now`) until now, on the calling thread; see `trace_write`. */
+#define trace_span( cat, name, start, detail, unit, count ) \
+    do { \
+        if ( trace_enabled ) \
+            trace_write ( ( cat ), ( name ), ( start ), ( detail ), \
+                    ( unit ), ( count ) ); \
+    } while ( 0 )
+
+/* trace_probe: a static probe point of the provider "owd_euses", named `name`,
+ * with two integer or pointer arguments, `a` and `b`, which perf(1), bpftrace,
+ * or SystemTap can find in the binary and attach to without a rebuild, as a
+ * SystemTap SDT (USDT) note describes it. Until a tool attaches, it costs a
+ * single nop. The probes are:
+ *
+ *  - repo__start (name, location), repo__done (name, files): the collation of
+ *    the files of a repository; see `plan_files`;
+ *  - file__start (path, item), file__done (path, results): the search of a
+ *    file, or a chunk of one, by a worker; see `run_search_task`;
+ *  - fill__start (path, offset), fill__done (path, bytes): a fill of the
+ *    streamed buffer; see `populate_buffer`;
+ *  - search__start (path, length), search__done (path, status): a pass of the
+ *    searcher over a buffer; see `search_buffer`.
+ *
+ * The note is written here, rather than by <sys/sdt.h>, so that the probes are
+ * always present, whether or not that header is installed; they are only
+ * written for x86-64, and not at all if NO_PROBES is defined at compile-time.
+ */
+
+#if defined ( __x86_64__ ) && defined ( __GNUC__ ) && !defined ( NO_PROBES )
+#define trace_probe( name, a, b ) \
+    __asm__ __volatile__ ( \
+            "990: nop\n" \
+            ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+            ".balign 4\n" \
+            ".4byte 992f-991f, 994f-993f, 3\n" \
+            "991: .asciz \"stapsdt\"\n" \
+            "992: .balign 4\n" \
+            "993: .8byte 990b\n" \
+            ".8byte _.stapsdt.base\n" \
+            ".8byte 0\n" \
+            ".asciz \"owd_euses\"\n" \
+            ".asciz \"" #name "\"\n" \
+            ".asciz \"-8@%0 -8@%1\"\n" \
+            "994: .balign 4\n" \
+            ".popsection\n" \
+            ".ifndef _.stapsdt.base\n" \
+            ".pushsection .stapsdt.base,\"aG\",\"progbits\"," \
+            ".stapsdt.base,comdat\n" \
+            ".weak _.stapsdt.base\n" \
+            ".hidden _.stapsdt.base\n" \
+            "_.stapsdt.base: .space 1\n" \
+            ".size _.stapsdt.base, 1\n" \
+            ".popsection\n" \
+            ".endif\n" \
+            : : "nor" ( ( long ) ( a ) ), "nor" ( ( long ) ( b ) ) )
+#else
+#define trace_probe( name, a, b ) \
+    do { ( void ) ( a ); ( void ) ( b ); } while ( 0 )
+#endif /* __x86_64__ */
+
+int trace_open ( const char * );
+unsigned long long trace_clock ( void );
+void trace_write ( const char *, const char *, unsigned long long,
+        const char *, const char *, long );
+int trace_close ( void );
+
+#endif /* TRACE_H */
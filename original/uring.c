@@ -0,0 +1,441 @@
+/* owd-euses: batched file loader, driving io_uring through its system calls
+ * alone, so no library is needed; see uring.h.
+ * Oliver Dixon. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef NO_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif /* NO_IO_URING */
+
+#include "converse.h"
+#include "uring.h"
+
+#ifndef URING_BATCH
+/* The most files loaded at once; each has two operations in flight at most, so
+ * the ring has twice as many entries, and one more for a cancellation. */
+#define URING_BATCH ( 64 )
+#endif /* URING_BATCH */
+
+/* The data of a cancellation, which has no result of its own; see
+ * `uring_complete`. */
+#define URING_CANCEL ( ~0UL )
+
+#ifndef NO_IO_URING
+/* uring_t: an io_uring instance, with its submission and completion queues
+ * mapped from the kernel; see io_uring_setup(2), and the number of operations
+ * `queued` but not yet submitted, and `pending` completion. Only the thread
+ * loading the files uses it, so only the kernel is to be synchronised with. */
+
+struct uring_t {
+    int fd;
+    unsigned queued, pending;
+    unsigned * sq_tail, * sq_mask, * sq_array;
+    unsigned * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sq_ring, * cq_ring;
+    size_t sq_len, cq_len, sqes_len;
+};
+
+/* Set once io_uring has been found to be unavailable (such as on an older or
+ * restricted kernel), so every later load takes the synchronous path at once,
+ * rather than trying again. */
+static atomic_int unavailable = 0;
+
+/* ring_field: the field at the `offset` of a mapped ring. */
+#define ring_field( ring, offset ) \
+    ( ( unsigned * ) ( ( char * ) ( ring ) + ( offset ) ) )
+
+/* uring_close: release the `ring`, as far as it was set up. */
+
+static void uring_close ( struct uring_t * ring )
+{
+    if ( ring->sqes != NULL )
+        munmap ( ring->sqes, ring->sqes_len );
+
+    if ( ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring )
+        munmap ( ring->cq_ring, ring->cq_len );
+
+    if ( ring->sq_ring != NULL )
+        munmap ( ring->sq_ring, ring->sq_len );
+
+    close ( ring->fd );
+}
+
+/* map_ring: map `len` bytes of the `ring` at `offset`, returning the mapping,
+ * or NULL on failure. */
+
+static void * map_ring ( struct uring_t * ring, size_t len, off_t offset )
+{
+    void * map = mmap ( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED |
+            MAP_POPULATE, ring->fd, offset );
+
+    return ( map == MAP_FAILED ) ? NULL : map;
+}
+
+/* uring_open: set up the `ring` with room for `entries` operations at once.
+ * Returns zero on success, or -1 if io_uring is unavailable, in which case
+ * errno is set. */
+
+static int uring_open ( struct uring_t * ring, unsigned entries )
+{
+    struct io_uring_params params;
+    int error = 0;
+
+    memset ( ring, 0, sizeof ( *ring ) );
+    memset ( &params, 0, sizeof ( params ) );
+
+    if ( ( ring->fd = syscall ( __NR_io_uring_setup, entries, &params ) )
+            == -1 )
+        return -1;
+
+    ring->sq_len = params.sq_off.array + params.sq_entries *
+        sizeof ( unsigned );
+    ring->cq_len = params.cq_off.cqes + params.cq_entries *
+        sizeof ( struct io_uring_cqe );
+    ring->sqes_len = params.sq_entries * sizeof ( struct io_uring_sqe );
+
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+        /* both queues share a single mapping */
+        if ( ring->cq_len > ring->sq_len )
+            ring->sq_len = ring->cq_len;
+
+        ring->cq_len = ring->sq_len;
+    }
+
+    if ( ( ring->sq_ring = map_ring ( ring, ring->sq_len,
+                    IORING_OFF_SQ_RING ) ) == NULL ||
+            ( ring->cq_ring = ( params.features & IORING_FEAT_SINGLE_MMAP ) ?
+              ring->sq_ring : map_ring ( ring, ring->cq_len,
+                  IORING_OFF_CQ_RING ) ) == NULL ||
+            ( ring->sqes = map_ring ( ring, ring->sqes_len,
+                                      IORING_OFF_SQES ) ) == NULL ) {
+        error = errno;
+        uring_close ( ring );
+        errno = error;
+        return -1;
+    }
+
+    ring->sq_tail = ring_field ( ring->sq_ring, params.sq_off.tail );
+    ring->sq_mask = ring_field ( ring->sq_ring, params.sq_off.ring_mask );
+    ring->sq_array = ring_field ( ring->sq_ring, params.sq_off.array );
+    ring->cq_head = ring_field ( ring->cq_ring, params.cq_off.head );
+    ring->cq_tail = ring_field ( ring->cq_ring, params.cq_off.tail );
+    ring->cq_mask = ring_field ( ring->cq_ring, params.cq_off.ring_mask );
+    ring->cqes = ( struct io_uring_cqe * ) ( ( char * ) ring->cq_ring +
+            params.cq_off.cqes );
+    return 0;
+}
+
+/* uring_prepare: queue an operation of `opcode` on `fd` on the `ring`,
+ * returning its entry, to be completed by the caller; the completion is
+ * identified by `data`. The queue is never full, as every batch is completed
+ * before the next is prepared (see URING_BATCH). */
+
+static struct io_uring_sqe * uring_prepare ( struct uring_t * ring,
+        unsigned char opcode, int fd, unsigned long data )
+{
+    const unsigned tail = *ring->sq_tail, idx = tail & *ring->sq_mask;
+    struct io_uring_sqe * sqe = & ( ring->sqes [ idx ] );
+
+    memset ( sqe, 0, sizeof ( *sqe ) );
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = data;
+    ring->sq_array [ idx ] = idx;
+    ring->queued++;
+    ring->pending++;
+
+    /* the entry is visible to the kernel before the tail which covers it */
+    atomic_store_explicit ( ( _Atomic unsigned * ) ring->sq_tail, tail + 1,
+            memory_order_release );
+    return sqe;
+}
+
+/* uring_reap: submit the operations queued on the `ring`, and wait until none
+ * is pending, placing the result of each in `results`, at the index of its
+ * data. Returns zero on success, or -1 if the ring fails, in which case errno
+ * is set, and those still pending may yet complete. */
+
+static int uring_reap ( struct uring_t * ring, int * results )
+{
+    const struct io_uring_cqe * cqe = NULL;
+    unsigned head = 0, tail = 0;
+    long got = 0;
+
+    while ( ring->pending > 0 ) {
+        if ( ( got = syscall ( __NR_io_uring_enter, ring->fd, ring->queued,
+                        ring->pending, IORING_ENTER_GETEVENTS, NULL, 0 ) )
+                == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return -1;
+        }
+
+        ring->queued -= got;
+        head = *ring->cq_head;
+        tail = atomic_load_explicit ( ( _Atomic unsigned * ) ring->cq_tail,
+                memory_order_acquire );
+
+        for ( ; head != tail; head++, ring->pending-- ) {
+            cqe = & ( ring->cqes [ head & *ring->cq_mask ] );
+            if ( cqe->user_data != URING_CANCEL )
+                results [ cqe->user_data ] = cqe->res;
+        }
+
+        atomic_store_explicit ( ( _Atomic unsigned * ) ring->cq_head, head,
+                memory_order_release );
+    }
+
+    return 0;
+}
+
+/* uring_complete: submit the operations queued on the `ring`, and wait for
+ * every one of them to complete, placing the result of each in `results`, of
+ * 2 * URING_BATCH entries, at the index of its data; an operation which does
+ * not complete has the result -ECANCELED. Returns zero on success, or -1 if
+ * the ring fails. The operations still pending are then cancelled, and waited
+ * for, so none writes to the memory of the caller after the return, unless
+ * the ring fails again, in which case it can only be closed, and the memory
+ * they would write to must be kept until then; see `uring_load`. */
+
+static int uring_complete ( struct uring_t * ring, int * results )
+{
+    struct io_uring_sqe * sqe = NULL;
+
+    for ( unsigned i = 0; i < 2 * URING_BATCH; i++ )
+        results [ i ] = -ECANCELED;
+
+    if ( uring_reap ( ring, results ) == 0 )
+        return 0;
+
+#ifdef IORING_ASYNC_CANCEL_ANY
+    sqe = uring_prepare ( ring, IORING_OP_ASYNC_CANCEL, -1, URING_CANCEL );
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY;
+#else
+    ( void ) sqe; /* the operations are only waited for */
+#endif /* IORING_ASYNC_CANCEL_ANY */
+
+    uring_reap ( ring, results );
+    return -1;
+}
+
+/* close_open: close each of the `count` descriptors of `fds` which is open, and
+ * the operation on which, in `results`, did not complete. */
+
+static void close_open ( const int * fds, const int * results, unsigned count )
+{
+    for ( unsigned i = 0; i < count; i++ )
+        if ( fds [ i ] >= 0 && results [ i ] == -ECANCELED )
+            close ( fds [ i ] );
+}
+
+/* load_batch: load the `count` files of `files` (at most URING_BATCH) with the
+ * `ring`, in three rounds: every file is opened and measured at once, into
+ * `stx`, then the regular files are read at once into a single block, added to
+ * `blocks`, and then every file is closed at once. Returns zero on success, 1
+ * if the ring failed, or -1 if the block could not be allocated, in which case
+ * errno and the information buffer are set. */
+
+static int load_batch ( struct uring_t * ring, struct uring_file_t * files,
+        unsigned count, struct statx * stx, struct uring_block_t ** blocks )
+{
+    struct io_uring_sqe * sqe = NULL;
+    struct uring_block_t * block = NULL;
+    int results [ 2 * URING_BATCH ], fds [ URING_BATCH ];
+    size_t size = 0, at = 0;
+    unsigned reads = 0, opened = 0;
+
+    for ( unsigned i = 0; i < count; i++ ) {
+        sqe = uring_prepare ( ring, IORING_OP_OPENAT, files [ i ].dir, i );
+        sqe->addr = ( unsigned long ) files [ i ].name;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+        sqe = uring_prepare ( ring, IORING_OP_STATX, files [ i ].dir,
+                count + i );
+        sqe->addr = ( unsigned long ) files [ i ].name;
+        sqe->len = STATX_TYPE | STATX_SIZE;
+        sqe->off = ( unsigned long ) & ( stx [ i ] );
+    }
+
+    if ( uring_complete ( ring, results ) == -1 ) {
+        for ( unsigned i = 0; i < count; i++ )
+            if ( results [ i ] >= 0 )
+                close ( results [ i ] );
+
+        return 1;
+    }
+
+    for ( unsigned i = 0; i < count; i++ ) {
+        if ( ( fds [ i ] = results [ i ] ) < 0 ) {
+            if ( results [ i ] == -EINVAL )
+                /* the kernel predates these operations */
+                atomic_store ( &unavailable, 1 );
+
+            continue;
+        }
+
+        opened++;
+        if ( results [ count + i ] == 0 && S_ISREG ( stx [ i ].stx_mode ) &&
+                stx [ i ].stx_size > 0 && stx [ i ].stx_size < INT_MAX ) {
+            /* room for a line feed and a null-terminator */
+            size += stx [ i ].stx_size + 2;
+            files [ i ].len = stx [ i ].stx_size;
+        }
+    }
+
+    if ( size > 0 && ( block = malloc ( sizeof ( *block ) + size ) )
+            == NULL ) {
+        populate_info_buffer ( "Loaded files" );
+        for ( unsigned i = 0; i < count; i++ )
+            if ( fds [ i ] >= 0 )
+                close ( fds [ i ] );
+
+        return -1;
+    }
+
+    for ( unsigned i = 0; block != NULL && i < count; i++ )
+        if ( fds [ i ] >= 0 && files [ i ].len > 0 ) {
+            files [ i ].text = & ( block->text [ at ] );
+            at += files [ i ].len + 2;
+
+            sqe = uring_prepare ( ring, IORING_OP_READ, fds [ i ], i );
+            sqe->addr = ( unsigned long ) files [ i ].text;
+            sqe->len = files [ i ].len;
+            reads++;
+        }
+
+    if ( block != NULL ) {
+        block->next = *blocks;
+        *blocks = block;
+    }
+
+    if ( reads > 0 && uring_complete ( ring, results ) == -1 ) {
+        /* The reads may yet be written to the block, so it is kept
+         * until the plan is released, but none of the files is used. */
+        for ( unsigned i = 0; i < count; i++ ) {
+            files [ i ].text = NULL;
+            if ( fds [ i ] >= 0 )
+                close ( fds [ i ] );
+        }
+
+        return 1;
+    }
+
+    for ( unsigned i = 0; i < count; i++ ) {
+        if ( files [ i ].text == NULL )
+            continue;
+
+        if ( results [ i ] <= 0 ) {
+            files [ i ].text = NULL;
+            continue;
+        }
+
+        /* short if the file has shrunk since it was measured */
+        files [ i ].len = results [ i ];
+        if ( files [ i ].text [ files [ i ].len - 1 ] != '\n' )
+            /* complete the final line */
+            files [ i ].text [ files [ i ].len++ ] = '\n';
+
+        files [ i ].text [ files [ i ].len ] = '\0';
+    }
+
+    for ( unsigned i = 0; i < count; i++ )
+        if ( fds [ i ] >= 0 )
+            uring_prepare ( ring, IORING_OP_CLOSE, fds [ i ], i );
+
+    if ( opened > 0 && uring_complete ( ring, results ) == -1 ) {
+        /* only those which were not closed by the ring */
+        close_open ( fds, results, count );
+        return 1;
+    }
+
+    return 0;
+}
+#endif /* NO_IO_URING */
+
+/* [exposed function] uring_load: load the `count` `files` into memory, with as
+ * few system calls as possible: the files are opened, measured, read, and
+ * closed in batches, each of which costs a handful of calls, however many files
+ * it has, rather than several calls per file. The memory holding the files,
+ * and that into which they are measured, is added to `blocks`, so that it
+ * outlives the ring, even if the ring fails with operations in flight, and
+ * must be released with `uring_release`, even on failure. A file is not
+ * loaded if it cannot be opened or read, if it is not a regular file, or if it
+ * is empty; if io_uring is unavailable, none is loaded, and the files are read
+ * as usual. Returns zero on success, or -1 on failure, in which case errno and
+ * the information buffer are set.
+ *
+ * If NO_IO_URING is defined at compile-time, no file is ever loaded. */
+
+int uring_load ( struct uring_file_t * files, size_t count,
+        struct uring_block_t ** blocks )
+{
+    for ( size_t i = 0; i < count; i++ ) {
+        files [ i ].text = NULL;
+        files [ i ].len = 0;
+    }
+
+#ifdef NO_IO_URING
+    ( void ) blocks;
+    return 0;
+#else
+    struct uring_t ring;
+    struct uring_block_t * stats = NULL;
+    int status = 0;
+
+    if ( count == 0 || atomic_load ( &unavailable ) )
+        return 0;
+
+    if ( uring_open ( &ring, 2 * URING_BATCH + 1 ) == -1 ) {
+        atomic_store ( &unavailable, 1 );
+        return 0;
+    }
+
+    if ( ( stats = malloc ( sizeof ( *stats ) + sizeof ( struct statx ) *
+                    URING_BATCH ) ) == NULL ) {
+        populate_info_buffer ( "Loaded files" );
+        uring_close ( &ring );
+        return -1;
+    }
+
+    stats->next = *blocks;
+    *blocks = stats;
+
+    for ( size_t b = 0; b < count && status == 0; b += URING_BATCH )
+        status = load_batch ( &ring, & ( files [ b ] ), ( count - b <
+                    URING_BATCH ) ? count - b : URING_BATCH,
+                ( struct statx * ) ( void * ) stats->text, blocks );
+
+    uring_close ( &ring );
+    if ( status == 1 )
+        /* the ring failed; the rest are read as usual */
+        atomic_store ( &unavailable, 1 );
+
+    return ( status == -1 ) ? -1 : 0;
+#endif /* NO_IO_URING */
+}
+
+/* [exposed function] uring_release: release the `blocks` of `uring_load`. */
+
+void uring_release ( struct uring_block_t * blocks )
+{
+    struct uring_block_t * next = NULL;
+
+    for ( ; blocks != NULL; blocks = next ) {
+        next = blocks->next;
+        free ( blocks );
+    }
+}
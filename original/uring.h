@@ -0,0 +1,33 @@
+/* owd-euses: batched (io_uring) file-loader signatures
+ * Oliver Dixon. */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+/* uring_file_t: a file to be loaded by `uring_load`: `name`, relative to the
+ * directory open at `dir` (see openat(2)). Once loaded, `text` holds its `len`
+ * bytes, ending with a line feed, and null-terminated; `text` is NULL if the
+ * file was not loaded, for any reason, in which case it should be read as any
+ * other file, by which any genuine error is reported. */
+
+struct uring_file_t {
+    const char * name;
+    int dir;
+    char * text;
+    size_t len;
+};
+
+/* uring_block_t: the memory holding the `text` of a batch of loaded files; see
+ * `uring_load`. */
+
+struct uring_block_t {
+    struct uring_block_t * next;
+    char text [ ];
+};
+
+int uring_load ( struct uring_file_t *, size_t, struct uring_block_t ** );
+void uring_release ( struct uring_block_t * );
+
+#endif /* URING_H */
@@ -0,0 +1,105 @@
+/* owd-euses: file watches; see watch.h.
+ * Oliver Dixon. */
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "converse.h"
+#include "watch.h"
+
+/* The events of a watched directory which are changes; see watch_t. */
+#define WATCH_EVENTS ( IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+        IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+        IN_MOVE_SELF )
+
+/* The size of the buffer into which events are drained; enough for several
+ * events, each with a name of up to NAME_MAX bytes. */
+#define WATCH_BUFFER_SZ ( 4096 )
+
+/* [exposed function] watch_init: prepare an empty set of watches. Returns zero
+ * on success, or -1 if inotify(7) is unavailable, in which case errno and the
+ * information buffer are set. */
+
+int watch_init ( struct watch_t * watch )
+{
+    if ( ( watch->fd = inotify_init1 ( IN_CLOEXEC ) ) == -1 ) {
+        populate_info_buffer ( "inotify" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [exposed function] watch_free: remove every watch of the set. */
+
+void watch_free ( struct watch_t * watch )
+{
+    if ( watch->fd != -1 ) {
+        close ( watch->fd );
+        watch->fd = -1;
+    }
+}
+
+/* [exposed function] watch_add: watch the directory at `path`. A directory
+ * which does not exist is passed over, as it cannot be watched until it is
+ * created, which is seen as a change of its parent, if that is watched.
+ * Returns zero on success, or -1 on failure, in which case errno and the
+ * information buffer are set. */
+
+int watch_add ( struct watch_t * watch, const char * path )
+{
+    if ( inotify_add_watch ( watch->fd, path, WATCH_EVENTS | IN_ONLYDIR )
+            == -1 && errno != ENOENT && errno != ENOTDIR ) {
+        populate_info_buffer ( path );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* drain: read and discard the events waiting on `fd`, blocking until there are
+ * some. Returns zero on success, or -1 on failure, in which case errno is set.
+ * The events themselves are of no interest, as any of them is a change. */
+
+static int drain ( int fd )
+{
+    char buffer [ WATCH_BUFFER_SZ ];
+
+    while ( read ( fd, buffer, sizeof ( buffer ) ) == -1 )
+        if ( errno != EINTR )
+            return -1;
+
+    return 0;
+}
+
+/* [exposed function] watch_wait: block until a watched directory changes, then
+ * until no further change has been seen for WATCH_SETTLE_MS, so that a burst of
+ * changes, such as that of a repository being synchronised, is waited out, and
+ * seen as one. Returns zero on success, or -1 on failure, in which case errno
+ * and the information buffer are set. */
+
+int watch_wait ( struct watch_t * watch )
+{
+    struct pollfd pfd = { .fd = watch->fd, .events = POLLIN };
+    int ready = 0;
+
+    populate_info_buffer ( "inotify" );
+    if ( drain ( watch->fd ) == -1 )
+        return -1;
+
+    while ( ( ready = poll ( &pfd, 1, WATCH_SETTLE_MS ) ) != 0 ) {
+        if ( ready == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return -1;
+        }
+
+        if ( drain ( watch->fd ) == -1 )
+            return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+/* owd-euses: file-watch signatures
+ * Oliver Dixon. */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#ifndef WATCH_SETTLE_MS
+/* The quiet period, in milliseconds, which ends a burst of changes; see
+ * `watch_wait`. */
+#define WATCH_SETTLE_MS ( 200 )
+#endif /* WATCH_SETTLE_MS */
+
+/* watch_t: a set of directories watched for changes with inotify(7). Only the
+ * directories themselves are watched, not their subdirectories: a file being
+ * written, created, removed, or renamed within one, or the directory itself
+ * being removed or renamed, is a change. */
+
+struct watch_t {
+    int fd; /* the inotify instance */
+};
+
+int watch_init ( struct watch_t * );
+void watch_free ( struct watch_t * );
+int watch_add ( struct watch_t *, const char * );
+int watch_wait ( struct watch_t * );
+
+#endif /* WATCH_H */